@@ -17,7 +17,7 @@
 #* http://www.gnu.org/copyleft/gpl.html.
 #*/
 
-QT       += core
+QT       += core network
 QT       -= gui
 
 CONFIG += HAVE_GUI
@@ -49,7 +49,8 @@ SOURCES += \
     ObxLibFfi.cpp \
     ObxLjRuntime.cpp \
     ObxCGen.cpp \
-    ObsFiles.cpp
+    ObsFiles.cpp \
+    ObxBuildServer.cpp
 
 HEADERS += \
     ../LjTools/LuaJitComposer.h \
@@ -59,7 +60,8 @@ HEADERS += \
     ObxLibFfi.h \
     ObxLjRuntime.h \
     ObxCGen.h \
-    ObsFiles.h
+    ObsFiles.h \
+    ObxBuildServer.h
 
 HAVE_GUI {
     message( Compiling with GUI support )
@@ -17,7 +17,7 @@
 #* http://www.gnu.org/copyleft/gpl.html.
 #*/
 
-QT       += core
+QT       += core network
 
 QT       -= gui
 
@@ -37,14 +37,16 @@ SOURCES += \
     ObxPelibGen.cpp \
     ObxCilGen.cpp \
     ../MonoTools/MonoMdbGen.cpp \
-    ObxCGen2.cpp
+    ObxCGen2.cpp \
+    ObxBuildServer.cpp
 
 HEADERS += \
     ObxIlEmitter.h \
     ObxPelibGen.h \
     ObxCilGen.h \
     ../MonoTools/MonoMdbGen.h \
-    ObxCGen2.h
+    ObxCGen2.h \
+    ObxBuildServer.h
 
 include( ../PeLib/PeLib.pri )
 include( ObxParser.pri )
@@ -230,7 +230,7 @@ static int docompile1(const QStringList& files, int gen, const QString& run, con
 }
 
 static int dorun( const QStringList& files, QString run, const QString& mod,
-                  const QString& outPath, bool useOakwood, int n )
+                  const QString& outPath, bool useOakwood, int n, bool luaLib )
 {
 #ifdef OBNLC_USING_LUAJIT
     if( run == "?" )
@@ -278,7 +278,10 @@ static int dorun( const QStringList& files, QString run, const QString& mod,
         lua.addLibrary(Lua::Engine2::JIT);
         lua.addLibrary(Lua::Engine2::OS);
         lua.addLibrary(Lua::Engine2::FFI);
-        Ob::LjLib::install(lua.getCtx());
+        if( luaLib )
+            loadLuaLib( lua, "obnljlib" ); // pure Lua/FFI version, traceable by the JIT
+        else
+            Ob::LjLib::install(lua.getCtx());
         loadLuaLib( lua, "obnlj" );
         if( useOakwood )
         {
@@ -338,6 +341,7 @@ int main(int argc, char *argv[])
     int gen = 3;
     bool forceObnExt = false;
     bool useOakwood = false;
+    bool luaLib = false;
     bool ok;
     const QStringList args = QCoreApplication::arguments();
     for( int i = 1; i < args.size(); i++ ) // arg 0 enthaelt Anwendungspfad
@@ -354,6 +358,7 @@ int main(int argc, char *argv[])
             out << "  -run=A[.B]    run module A or procedure B in module A and quit" << endl;
             out << "  -n=x          number of times to run A or A.B" << endl;
             out << "  -gen=n        n=1..thunk for VAR; n=2..multi-return for VAR; n=3..bytecode (default)" << endl;
+            out << "  -lualib       use the pure Lua runtime library instead of the C one" << endl;
 #endif
             out << "  -ext          force Oberon extensions (default autosense)" << endl;
             out << "  -oak          use built-in oakwood definitions" << endl;
@@ -381,6 +386,8 @@ int main(int argc, char *argv[])
             run = "?";
         else if( args[i].startsWith("-gen=") )
             gen = args[i].mid(5).toUInt();
+        else if( args[i] == "-lualib" )
+            luaLib = true;
 #endif
         else if( args[i] == "-ext" )
             forceObnExt = true;
@@ -429,7 +436,7 @@ int main(int argc, char *argv[])
         return -1;
     }
 
-    return dorun( files, run, mod, outPath, useOakwood, n );
+    return dorun( files, run, mod, outPath, useOakwood, n, luaLib );
 
     return 0;
 }
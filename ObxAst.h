@@ -355,6 +355,7 @@ namespace Obx
         uint d_upvalSource : 1; // the scope from which locals are used; the local used as upval
         uint d_upvalIntermediate: 1; // the scopes between source and user
         uint d_upvalSink : 1; // the scope from which locals from the outer scope are used
+        uint d_upvalReadOnly : 1; // LocalVar, Parameter: upval not modified while a user runs, so a copy can be passed
         uint d_visibility : 3; // Visibility enum
         uint d_synthetic: 1;
         uint d_hasErrors : 1;
@@ -364,7 +365,7 @@ namespace Obx
 
         Named(const QByteArray& n = QByteArray(), Type* t = 0, Scope* s = 0):d_scope(s),d_type(t),d_name(n),
             d_visibility(Invalid),d_synthetic(false),d_liveFrom(0),d_liveTo(0),
-            d_upvalSource(0),d_upvalIntermediate(0),d_upvalSink(0),
+            d_upvalSource(0),d_upvalIntermediate(0),d_upvalSink(0),d_upvalReadOnly(0),
             d_hasErrors(0),d_noBody(0),d_used(0) {}
         virtual QByteArray getName() const { return d_name; }
         bool isNamed() const { return true; }
@@ -543,9 +544,10 @@ namespace Obx
         bool d_isDef; // DEFINITION module
         bool d_isExt;
         bool d_externC;
+        bool d_bodiesDeferred; // only the declarations are validated yet, see Validator::checkBodies
         QList< Ref<Type> > d_helper2; // filled with pointers because of ADDROF
 
-        Module():d_isDef(false),d_isValidated(false),d_isExt(false),d_externC(false) {}
+        Module():d_isDef(false),d_isValidated(false),d_isExt(false),d_externC(false),d_bodiesDeferred(false) {}
         int getTag() const { return T_Module; }
         void accept(AstVisitor* v) { v->visit(this); }
         QByteArray getName() const;
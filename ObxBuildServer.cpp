@@ -0,0 +1,272 @@
+/*
+* Copyright 2021 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Oberon+ parser/compiler library.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include "ObxBuildServer.h"
+#include "ObxProject.h"
+#include "ObxAst.h"
+#include "ObErrors.h"
+#include "ObFileCache.h"
+#include <QFileSystemWatcher>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QCryptographicHash>
+#include <QCoreApplication>
+#include <QFileInfo>
+#include <QFile>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QtDebug>
+using namespace Obx;
+
+// The model cannot re-parse single modules in place because the validated modules which import them
+// point into their declarations; so the changed modules are re-parsed together with all modules which
+// (transitively) import them, see Model::reparseFiles, and only the outputs of the modules whose fingerprint
+// changed are regenerated. Projects with generic modules among these are re-parsed as a whole.
+
+BuildServer::BuildServer(Project* pro, QObject* p):QObject(p),d_pro(pro),d_watcher(0),d_server(0),
+    d_regenerated(0)
+{
+    Q_ASSERT( pro );
+    d_delay = new QTimer(this);
+    d_delay->setSingleShot(true);
+    d_delay->setInterval(20); // editors often write a file in more than one step
+    connect( d_delay, SIGNAL(timeout()), this, SLOT(onBuild()) );
+}
+
+bool BuildServer::watch()
+{
+    if( d_watcher == 0 )
+    {
+        d_watcher = new QFileSystemWatcher(this);
+        connect( d_watcher, SIGNAL(fileChanged(QString)), this, SLOT(onFileChanged()) );
+        connect( d_watcher, SIGNAL(directoryChanged(QString)), this, SLOT(onFileChanged()) );
+    }
+    updateWatchList();
+    return !d_watcher->files().isEmpty();
+}
+
+bool BuildServer::listen(const QString& name)
+{
+    if( d_server == 0 )
+    {
+        d_server = new QLocalServer(this);
+        connect( d_server, SIGNAL(newConnection()), this, SLOT(onConnection()) );
+    }
+    QLocalServer::removeServer(name); // remove a stale socket file of a crashed server
+    if( !d_server->listen(name) )
+    {
+        qCritical() << "cannot listen on" << name << d_server->errorString();
+        return false;
+    }
+    qDebug() << "listening on" << d_server->fullServerName();
+    return true;
+}
+
+static QByteArray sourceOf( Project* pro, const QString& path )
+{
+    bool found;
+    Ob::FileCache::Entry content = pro->getFc()->getFile(path, &found );
+    if( found )
+        return content.d_code;
+    QFile f(path);
+    if( f.open(QIODevice::ReadOnly) )
+        return f.readAll();
+    return path.toUtf8(); // e.g. built-in definitions
+}
+
+static QByteArray fingerprint( Project* pro, Module* m, QHash<Module*,QByteArray>& done,
+                               const QByteArray& all )
+{
+    QHash<Module*,QByteArray>::const_iterator i = done.find(m);
+    if( i != done.end() )
+        return i.value();
+    done.insert(m, QByteArray()); // imports are acyclic; this only protects against invalid models
+    QCryptographicHash h(QCryptographicHash::Sha1);
+    h.addData(m->getName());
+    h.addData(sourceOf(pro, m->d_file));
+    foreach( Import* imp, m->d_imports )
+    {
+        if( !imp->d_mod.isNull() )
+            h.addData( fingerprint(pro, imp->d_mod.data(), done, all) );
+    }
+    if( !m->d_metaActuals.isEmpty() )
+        h.addData(all); // the actuals can come from any module
+    const QByteArray res = h.result();
+    done.insert(m, res);
+    return res;
+}
+
+bool BuildServer::build()
+{
+    if( !d_changed.isValid() )
+        d_changed.start();
+
+    QHash<QString,QByteArray> sources;
+    QStringList files = d_pro->getFiles().keys();
+    files.sort();
+    QCryptographicHash all(QCryptographicHash::Sha1);
+    foreach( const QString& path, files )
+    {
+        const QByteArray hash = QCryptographicHash::hash(sourceOf(d_pro, path), QCryptographicHash::Sha1);
+        sources.insert(path, hash);
+        all.addData(hash);
+    }
+    const QByteArray allHash = all.result();
+
+    QStringList changed;
+    bool incremental = !d_sources.isEmpty() && d_sources.size() == sources.size();
+    QHash<QString,QByteArray>::const_iterator i;
+    for( i = sources.begin(); incremental && i != sources.end(); ++i )
+    {
+        QHash<QString,QByteArray>::const_iterator j = d_sources.find(i.key());
+        if( j == d_sources.end() )
+            incremental = false; // the files of the project changed
+        else if( j.value() != i.value() )
+            changed.append(i.key());
+    }
+
+    const quint32 errCount = d_pro->getErrs()->getErrCount();
+    QElapsedTimer timer;
+    timer.start();
+    if( !reparse( incremental ? &changed : 0 ) || d_pro->getErrs()->getErrCount() != errCount )
+    {
+        d_fingerprints.clear();
+        d_sources.clear();
+        qDebug() << "build failed after" << d_changed.elapsed() << "[ms]";
+        d_changed = QTime();
+        return false;
+    }
+    d_sources = sources;
+    qDebug() << "reparsed" << ( incremental ? "incrementally" : "all" ) << "in" << timer.elapsed() << "[ms]";
+
+    QList<Module*> mods = d_pro->getModulesToGenerate(true);
+    if( d_pro->getErrs()->getErrCount() != errCount )
+    {
+        // a lazily validated body has errors
+        d_fingerprints.clear();
+        d_sources.clear();
+        qDebug() << "build failed after" << d_changed.elapsed() << "[ms]";
+        d_changed = QTime();
+        return false;
+    }
+    foreach( Module* m, d_pro->getModulesToGenerate() )
+        m->findAllInstances(mods);
+
+    QHash<Module*,QByteArray> done;
+    QHash<QByteArray,QByteArray> fingerprints;
+    QSet<QByteArray> upToDate;
+    foreach( Module* m, mods )
+    {
+        const QByteArray name = m->getName();
+        const QByteArray fp = fingerprint(d_pro, m, done, allHash);
+        fingerprints.insert(name, fp);
+        if( d_fingerprints.value(name) == fp )
+            upToDate.insert(name);
+    }
+
+    const bool ok = generate(upToDate);
+    if( ok )
+        d_fingerprints = fingerprints;
+    else
+    {
+        d_fingerprints.clear();
+        d_sources.clear();
+    }
+    d_regenerated = fingerprints.size() - upToDate.size();
+    qDebug() << "regenerated" << d_regenerated << "of" << fingerprints.size() << "modules"
+             << d_changed.elapsed() << "[ms] after the change";
+    d_changed = QTime();
+    return ok;
+}
+
+bool BuildServer::reparse(const QStringList* changed)
+{
+    if( changed )
+        return d_pro->reparse(*changed);
+    else
+        return d_pro->reparse();
+}
+
+void BuildServer::updateWatchList()
+{
+    if( d_watcher == 0 )
+        return;
+    QStringList files = d_pro->getFiles().keys();
+    QSet<QString> dirs;
+    foreach( const QString& path, files )
+        dirs.insert( QFileInfo(path).absolutePath() );
+    // editors which save by renaming remove the original file from the watch list
+    files = files.toSet().subtract(d_watcher->files().toSet()).toList();
+    if( !files.isEmpty() )
+        d_watcher->addPaths(files);
+    dirs.subtract(d_watcher->directories().toSet());
+    if( !dirs.isEmpty() )
+        d_watcher->addPaths(dirs.toList());
+}
+
+void BuildServer::onFileChanged()
+{
+    if( !d_changed.isValid() )
+        d_changed.start();
+    d_delay->start();
+}
+
+void BuildServer::onBuild()
+{
+    build();
+    updateWatchList();
+}
+
+void BuildServer::onConnection()
+{
+    while( QLocalSocket* s = d_server->nextPendingConnection() )
+    {
+        connect( s, SIGNAL(readyRead()), this, SLOT(onRequest()) );
+        connect( s, SIGNAL(disconnected()), s, SLOT(deleteLater()) );
+    }
+}
+
+void BuildServer::onRequest()
+{
+    // line based protocol: "build" answers "ok n" or "error" where n is the number of regenerated modules,
+    // "quit" stops the server
+    QLocalSocket* s = qobject_cast<QLocalSocket*>(sender());
+    if( s == 0 )
+        return;
+    while( s->canReadLine() )
+    {
+        const QByteArray cmd = s->readLine().trimmed();
+        if( cmd == "build" )
+        {
+            d_delay->stop();
+            if( build() )
+                s->write("ok " + QByteArray::number(d_regenerated) + "\n");
+            else
+                s->write("error\n");
+            updateWatchList();
+        }else if( cmd == "quit" )
+        {
+            s->write("bye\n");
+            s->flush();
+            QCoreApplication::quit();
+        }else if( !cmd.isEmpty() )
+            s->write("unknown command " + cmd + "\n");
+    }
+    s->flush();
+}
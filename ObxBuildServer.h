@@ -0,0 +1,72 @@
+#ifndef OBXBUILDSERVER_H
+#define OBXBUILDSERVER_H
+
+/*
+* Copyright 2021 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Oberon+ parser/compiler library.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+#include <QTime>
+
+class QFileSystemWatcher;
+class QLocalServer;
+class QTimer;
+
+namespace Obx
+{
+    class Project;
+
+    // Keeps a project in memory, rebuilds it when one of its files changes (-watch) or when a client
+    // sends "build" over a local socket (-listen), and only re-parses and regenerates the modules whose
+    // source or (transitive) imports changed since the last successful build.
+    class BuildServer : public QObject
+    {
+        Q_OBJECT
+    public:
+        BuildServer(Project*, QObject* = 0);
+
+        Project* getPro() const { return d_pro; }
+        bool watch();
+        bool listen( const QString& name );
+        bool build(); // returns false on errors; also prints the latency
+        quint32 getRegenerated() const { return d_regenerated; }
+    protected:
+        virtual bool reparse( const QStringList* changed ); // null if all files have to be parsed
+        virtual bool generate( const QSet<QByteArray>& upToDate ) = 0; // names of modules with unchanged output
+        void updateWatchList();
+    protected slots:
+        void onFileChanged();
+        void onBuild();
+        void onConnection();
+        void onRequest();
+    private:
+        Project* d_pro;
+        QFileSystemWatcher* d_watcher;
+        QLocalServer* d_server;
+        QTimer* d_delay;
+        QHash<QByteArray,QByteArray> d_fingerprints; // module name -> hash of source and imports
+        QHash<QString,QByteArray> d_sources; // file path -> hash of source
+        QTime d_changed;
+        quint32 d_regenerated;
+    };
+}
+
+#endif // OBXBUILDSERVER_H
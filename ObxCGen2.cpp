@@ -21,6 +21,7 @@
 #include "ObxAst.h"
 #include "ObErrors.h"
 #include "ObxProject.h"
+#include "ObxLowering.h"
 #include <QtDebug>
 #include <QFile>
 #include <QDir>
@@ -47,6 +48,12 @@ Q_DECLARE_METATYPE( Obx::Literal::SET )
      * cost is neglible, so we can just leave it enabled.
      */
 
+#define _OBX_SPECIALIZE_OPEN_ARRAYS_ 4000
+    /* Procedures with open array parameters are cloned for the fixed size arrays passed at the call sites of the
+     * module (see ObxCGenShapeCheck); the value is the maximum number of statements cloned per module. Undefine it
+     * to always pass the lengths at runtime.
+     */
+
 /* NOTE: unsafe arrays are treated the same way as regular arrays
  * only parameters and return values are normal C types
  */
@@ -129,6 +136,611 @@ struct ObxCGenCollector : public AstVisitor
     }
 };
 
+// Finds the VAR and IN record parameters which can be declared restrict, i.e. which provably alias neither each
+// other nor module variables nor heap objects. This is the case if the procedure is private, is never used as a
+// procedure value, has no non-local access, and at each call site all VAR/IN actuals designate distinct locals
+// or value parameters of the calling procedure. Taking an address anywhere in the module disables it.
+struct ObxCGenAliasCheck : public AstVisitor
+{
+    QHash<Procedure*,bool> candidates; // value is false if disqualified
+    Scope* curScope;
+    bool addrTaken;
+
+    ObxCGenAliasCheck():curScope(0),addrTaken(false){}
+
+    static bool isPointerParam( Parameter* p )
+    {
+        // corresponds to ObxCGenImp::passByRef and excludes arrays, which are passed as OBX$Array$ descriptors
+        if( !p->d_var )
+            return false;
+        Type* td = p->d_type.isNull() ? 0 : p->d_type->derefed();
+        if( td == 0 || td->getTag() == Thing::T_Array )
+            return false;
+        return !p->d_const || p->d_unsafe || td->isStructured();
+    }
+
+    static Named* rootOf( Expression* e )
+    {
+        while( e )
+        {
+            Type* sub = 0;
+            switch( e->getTag() )
+            {
+            case Thing::T_IdentLeaf:
+                return e->getIdent();
+            case Thing::T_IdentSel:
+            case Thing::T_ArgExpr:
+                if( e->getUnOp() == UnExpr::CALL )
+                    return 0;
+                sub = cast<UnExpr*>(e)->d_sub.isNull() ? 0 : cast<UnExpr*>(e)->d_sub->d_type.data();
+                sub = sub ? sub->derefed() : 0;
+                if( sub && sub->getTag() == Thing::T_Pointer && e->getUnOp() != UnExpr::CAST )
+                    return 0; // implicit dereference
+                e = cast<UnExpr*>(e)->d_sub.data();
+                break;
+            default:
+                return 0;
+            }
+        }
+        return 0;
+    }
+
+    void run( Module* me, const QList<Procedure*>& procs )
+    {
+        foreach( Procedure* p, procs )
+        {
+            ProcType* pt = p->getProcType();
+            bool hasPtr = false;
+            foreach( const Ref<Parameter>& f, pt->d_formals )
+                hasPtr = hasPtr || isPointerParam(f.data());
+            if( hasPtr && !p->isPublic() && p->d_receiver.isNull() && pt->d_nonLocals.isEmpty() && !pt->d_unsafe )
+                candidates[p] = true;
+        }
+        if( candidates.isEmpty() )
+            return;
+        curScope = me;
+        checkDecls(me);
+        visitSeq(me->d_body);
+        foreach( Procedure* p, procs )
+        {
+            curScope = p;
+            checkDecls(p);
+            visitSeq(p->d_body);
+        }
+        if( addrTaken )
+            candidates.clear();
+    }
+
+    void getRestricted( QSet<Parameter*>& res ) const
+    {
+        QHash<Procedure*,bool>::const_iterator i;
+        for( i = candidates.begin(); i != candidates.end(); ++i )
+        {
+            if( !i.value() )
+                continue;
+            foreach( const Ref<Parameter>& f, i.key()->getProcType()->d_formals )
+            {
+                if( isPointerParam(f.data()) )
+                    res.insert(f.data());
+            }
+        }
+    }
+
+    void disqualify( Named* n )
+    {
+        if( n && n->getTag() == Thing::T_Procedure && candidates.contains(cast<Procedure*>(n)) )
+            candidates[cast<Procedure*>(n)] = false;
+    }
+
+    void checkDecls( Scope* s )
+    {
+        foreach( const Ref<Named>& n, s->d_order )
+        {
+            if( n->getTag() == Thing::T_Const && cast<Const*>(n.data())->d_vtype == Const::ProcLit )
+                disqualify(cast<Const*>(n.data())->findProc());
+        }
+    }
+
+    void visitSeq( const StatSeq& ss )
+    {
+        foreach( const Ref<Statement>& s, ss )
+            s->accept(this);
+    }
+
+    void visitExpr( const Ref<Expression>& e )
+    {
+        if( !e.isNull() )
+            e->accept(this);
+    }
+
+    void checkCall( Procedure* p, ArgExpr* me )
+    {
+        ProcType* pt = p->getProcType();
+        QSet<Named*> roots;
+        for( int i = 0; i < pt->d_formals.size() && i < me->d_args.size(); i++ )
+        {
+            if( !pt->d_formals[i]->d_var )
+                continue;
+            Named* root = rootOf(me->d_args[i].data());
+            bool ok = root && root->d_scope == curScope && !roots.contains(root);
+            if( ok && root->getTag() == Thing::T_Parameter )
+                ok = !cast<Parameter*>(root)->d_var;
+            else if( ok )
+                ok = root->getTag() == Thing::T_LocalVar;
+            if( !ok )
+            {
+                candidates[p] = false;
+                return;
+            }
+            roots.insert(root);
+        }
+    }
+
+    void visit( Call* me ) { visitExpr(me->d_what); }
+    void visit( Return* me ) { visitExpr(me->d_what); }
+    void visit( Assign* me )
+    {
+        visitExpr(me->d_lhs);
+        visitExpr(me->d_rhs);
+    }
+    void visit( IfLoop* me )
+    {
+        foreach( const Ref<Expression>& e, me->d_if )
+            visitExpr(e);
+        foreach( const StatSeq& ss, me->d_then )
+            visitSeq(ss);
+        visitSeq(me->d_else);
+    }
+    void visit( ForLoop* me )
+    {
+        visitExpr(me->d_id);
+        visitExpr(me->d_from);
+        visitExpr(me->d_to);
+        visitExpr(me->d_by);
+        visitSeq(me->d_do);
+    }
+    void visit( CaseStmt* me )
+    {
+        visitExpr(me->d_exp);
+        foreach( const CaseStmt::Case& c, me->d_cases )
+        {
+            foreach( const Ref<Expression>& e, c.d_labels )
+                visitExpr(e);
+            visitSeq(c.d_block);
+        }
+        visitSeq(me->d_else);
+    }
+    void visit( SetExpr* me )
+    {
+        foreach( const Ref<Expression>& e, me->d_parts )
+            visitExpr(e);
+    }
+    void visit( IdentLeaf* me )
+    {
+        disqualify(me->getIdent()); // a procedure used as a value
+    }
+    void visit( IdentSel* me )
+    {
+        visitExpr(me->d_sub);
+        disqualify(me->getIdent());
+    }
+    void visit( UnExpr* me )
+    {
+        if( me->d_op == UnExpr::ADDROF )
+            addrTaken = true;
+        visitExpr(me->d_sub);
+    }
+    void visit( ArgExpr* me )
+    {
+        Named* n = me->d_sub.isNull() ? 0 : me->d_sub->getIdent();
+        if( me->d_op == ArgExpr::CALL && n && n->getTag() == Thing::T_Procedure &&
+                me->d_sub->getTag() == Thing::T_IdentLeaf )
+        {
+            Procedure* p = cast<Procedure*>(n);
+            if( candidates.contains(p) )
+                checkCall(p, me);
+        }else
+        {
+            if( me->d_op == ArgExpr::CALL && n && n->getTag() == Thing::T_BuiltIn &&
+                    ( cast<BuiltIn*>(n)->d_func == BuiltIn::SYS_ADR || cast<BuiltIn*>(n)->d_func == BuiltIn::ADR ) )
+                addrTaken = true;
+            visitExpr(me->d_sub);
+        }
+        foreach( const Ref<Expression>& e, me->d_args )
+            visitExpr(e);
+    }
+    void visit( BinExpr* me )
+    {
+        visitExpr(me->d_lhs);
+        visitExpr(me->d_rhs);
+    }
+};
+
+// Finds the procedures of a generic instance which can share the code generated for another instance whose meta
+// actuals have the same representation (see CGen2::translateAll). Since the other instance is generated from the
+// same source this is the case if the procedure only uses its parameters and locals, declarations of other modules
+// and other shareable procedures of the instance, and if it neither allocates nor tests types, because this depends
+// on the class of the actual. Records declared in the instance may only be accessed via pointers.
+struct ObxCGenShareCheck : public AstVisitor
+{
+    Module* inst;
+    QHash<Procedure*,QSet<Procedure*> > calls; // the instance procedures each candidate calls
+    Procedure* cur;
+    bool ok;
+
+    ObxCGenShareCheck(Module* m):inst(m),cur(0),ok(true){}
+
+    bool isInstType( Type* t ) const
+    {
+        while( t && t->d_decl == 0 && t->d_binding )
+            t = t->d_binding;
+        if( t == 0 || t->d_decl == 0 )
+            return true; // anonymous, don't know
+        return t->d_decl->getModule() == inst;
+    }
+
+    bool containsInstRecord( Type* t ) const
+    {
+        // true if t embeds a record declared in the instance by value
+        t = t ? t->derefed() : 0;
+        if( t == 0 )
+            return false;
+        switch( t->getTag() )
+        {
+        case Thing::T_Record:
+            return isInstType(t);
+        case Thing::T_Array:
+            return containsInstRecord(cast<Array*>(t)->d_type.data());
+        case Thing::T_ProcType:
+            return true; // the signature could depend on the actuals
+        default:
+            return false;
+        }
+    }
+
+    void run( const QList<Procedure*>& procs )
+    {
+        foreach( Procedure* p, procs )
+        {
+            ProcType* pt = p->getProcType();
+            if( p->d_scope != inst || !p->d_receiver.isNull() || !pt->d_nonLocals.isEmpty() || pt->d_unsafe )
+                continue;
+            ok = !containsInstRecord(pt->d_return.data());
+            foreach( const Ref<Parameter>& f, pt->d_formals )
+                ok = ok && !containsInstRecord(f->d_type.data());
+            foreach( const Ref<Named>& n, p->d_order )
+            {
+                if( n->getTag() == Thing::T_Procedure )
+                    ok = false; // nested procedures are not considered
+                else if( n->getTag() == Thing::T_LocalVar && containsInstRecord(n->d_type.data()) )
+                    ok = false;
+            }
+            if( !ok )
+                continue;
+            cur = p;
+            calls[p];
+            foreach( const Ref<Statement>& s, p->d_body )
+                s->accept(this);
+            if( !ok )
+                calls.remove(p);
+        }
+        bool changed = true;
+        while( changed )
+        {
+            changed = false;
+            QHash<Procedure*,QSet<Procedure*> >::iterator i = calls.begin();
+            while( i != calls.end() )
+            {
+                bool callsAll = true;
+                foreach( Procedure* q, i.value() )
+                    callsAll = callsAll && calls.contains(q);
+                if( !callsAll )
+                {
+                    i = calls.erase(i);
+                    changed = true;
+                }else
+                    ++i;
+            }
+        }
+    }
+
+    QSet<Procedure*> getShared() const
+    {
+        return calls.keys().toSet();
+    }
+
+    void visitSeq( const StatSeq& ss )
+    {
+        foreach( const Ref<Statement>& s, ss )
+            s->accept(this);
+    }
+
+    void visitExpr( const Ref<Expression>& e )
+    {
+        if( !e.isNull() )
+            e->accept(this);
+    }
+
+    void checkIdent( Named* n )
+    {
+        if( n == 0 || n->d_scope != inst )
+            return;
+        switch( n->getTag() )
+        {
+        case Thing::T_Procedure:
+            calls[cur].insert(cast<Procedure*>(n));
+            break;
+        case Thing::T_Const:
+            if( cast<Const*>(n)->d_vtype == Const::ProcLit )
+                ok = false;
+            break;
+        default:
+            ok = false; // module variables and types of the instance
+            break;
+        }
+    }
+
+    void visit( Call* me ) { visitExpr(me->d_what); }
+    void visit( Return* me ) { visitExpr(me->d_what); }
+    void visit( Assign* me )
+    {
+        visitExpr(me->d_lhs);
+        visitExpr(me->d_rhs);
+    }
+    void visit( IfLoop* me )
+    {
+        if( me->d_op == IfLoop::WITH )
+            ok = false;
+        foreach( const Ref<Expression>& e, me->d_if )
+            visitExpr(e);
+        foreach( const StatSeq& ss, me->d_then )
+            visitSeq(ss);
+        visitSeq(me->d_else);
+    }
+    void visit( ForLoop* me )
+    {
+        visitExpr(me->d_id);
+        visitExpr(me->d_from);
+        visitExpr(me->d_to);
+        visitExpr(me->d_by);
+        visitSeq(me->d_do);
+    }
+    void visit( CaseStmt* me )
+    {
+        if( me->d_typeCase )
+            ok = false;
+        visitExpr(me->d_exp);
+        foreach( const CaseStmt::Case& c, me->d_cases )
+        {
+            foreach( const Ref<Expression>& e, c.d_labels )
+                visitExpr(e);
+            visitSeq(c.d_block);
+        }
+        visitSeq(me->d_else);
+    }
+    void visit( SetExpr* me )
+    {
+        foreach( const Ref<Expression>& e, me->d_parts )
+            visitExpr(e);
+    }
+    void visit( IdentLeaf* me )
+    {
+        checkIdent(me->getIdent());
+    }
+    void visit( IdentSel* me )
+    {
+        visitExpr(me->d_sub);
+        checkIdent(me->getIdent());
+    }
+    void visit( UnExpr* me )
+    {
+        visitExpr(me->d_sub);
+    }
+    void visit( ArgExpr* me )
+    {
+        Named* n = me->d_sub.isNull() ? 0 : me->d_sub->getIdent();
+        if( me->d_op == ArgExpr::CAST )
+            ok = false;
+        else if( me->d_op == ArgExpr::CALL && n && n->getTag() == Thing::T_BuiltIn &&
+                 ( cast<BuiltIn*>(n)->d_func == BuiltIn::NEW || cast<BuiltIn*>(n)->d_func == BuiltIn::SYS_NEW ) )
+            ok = false;
+        visitExpr(me->d_sub);
+        foreach( const Ref<Expression>& e, me->d_args )
+            visitExpr(e);
+    }
+    void visit( BinExpr* me )
+    {
+        if( me->d_op == BinExpr::IS )
+            ok = false;
+        visitExpr(me->d_lhs);
+        visitExpr(me->d_rhs);
+    }
+};
+
+// Finds the static shapes of the arrays passed to open array parameters at the call sites of the module. For each
+// shape a procedure gets a static clone in which the lengths of its open arrays are constants, so the C compiler
+// can unroll and vectorize the loops over them; calls with this shape use the clone, all others the original.
+// The clones have the same signature as the original; the number of clones is limited by maxClones per procedure
+// and by the budget of cloned statements per module.
+struct ObxCGenShapeCheck : public AstVisitor
+{
+    typedef QList<quint32> Shape; // the lengths of all dimensions of all open array parameters in order
+    enum { maxClones = 4 };
+    QHash<Procedure*,QList<Shape> > clones;
+    QHash<Procedure*,int> size; // number of statements of the candidates
+    int budget;
+
+    ObxCGenShapeCheck(int b):budget(b){}
+
+    static bool isOpenArray( Parameter* p )
+    {
+        Type* td = p->d_type.isNull() ? 0 : p->d_type->derefed();
+        if( td == 0 || td->getTag() != Thing::T_Array || td->d_unsafe )
+            return false;
+        foreach( Array* a, cast<Array*>(td)->getDims() )
+        {
+            if( a->d_lenExpr.isNull() )
+                return true;
+        }
+        return false;
+    }
+
+    static bool shapeOf( ProcType* pt, ArgExpr* me, Shape& res )
+    {
+        // true if all actuals of open array parameters have a static array type
+        for( int i = 0; i < pt->d_formals.size() && i < me->d_args.size(); i++ )
+        {
+            if( !isOpenArray(pt->d_formals[i].data()) )
+                continue;
+            Type* td = me->d_args[i]->d_type.isNull() ? 0 : me->d_args[i]->d_type->derefed();
+            if( td == 0 || td->getTag() != Thing::T_Array || td->d_unsafe )
+                return false;
+            const QList<Array*> dims = cast<Array*>(td)->getDims();
+            if( dims.size() != cast<Array*>(pt->d_formals[i]->d_type->derefed())->getDims().size() )
+                return false;
+            foreach( Array* a, dims )
+            {
+                if( a->d_lenExpr.isNull() || a->d_vla )
+                    return false;
+                res.append(a->d_len);
+            }
+        }
+        return !res.isEmpty();
+    }
+
+    static int countStats( const StatSeq& ss )
+    {
+        int res = ss.size();
+        foreach( const Ref<Statement>& s, ss )
+        {
+            switch( s->getTag() )
+            {
+            case Thing::T_IfLoop:
+                foreach( const StatSeq& t, cast<IfLoop*>(s.data())->d_then )
+                    res += countStats(t);
+                res += countStats(cast<IfLoop*>(s.data())->d_else);
+                break;
+            case Thing::T_ForLoop:
+                res += countStats(cast<ForLoop*>(s.data())->d_do);
+                break;
+            case Thing::T_CaseStmt:
+                foreach( const CaseStmt::Case& c, cast<CaseStmt*>(s.data())->d_cases )
+                    res += countStats(c.d_block);
+                res += countStats(cast<CaseStmt*>(s.data())->d_else);
+                break;
+            }
+        }
+        return res;
+    }
+
+    void run( Module* me, const QList<Procedure*>& procs )
+    {
+        foreach( Procedure* p, procs )
+        {
+            ProcType* pt = p->getProcType();
+            if( !p->d_receiver.isNull() || pt->d_unsafe || pt->d_varargs || p->d_body.isEmpty() )
+                continue;
+            bool open = false;
+            foreach( const Ref<Parameter>& f, pt->d_formals )
+                open = open || isOpenArray(f.data());
+            if( open )
+                size[p] = countStats(p->d_body);
+        }
+        if( size.isEmpty() )
+            return;
+        visitSeq(me->d_body);
+        foreach( Procedure* p, procs )
+            visitSeq(p->d_body);
+    }
+
+    void visitSeq( const StatSeq& ss )
+    {
+        foreach( const Ref<Statement>& s, ss )
+            s->accept(this);
+    }
+
+    void visitExpr( const Ref<Expression>& e )
+    {
+        if( !e.isNull() )
+            e->accept(this);
+    }
+
+    void visit( Call* me ) { visitExpr(me->d_what); }
+    void visit( Return* me ) { visitExpr(me->d_what); }
+    void visit( Assign* me )
+    {
+        visitExpr(me->d_lhs);
+        visitExpr(me->d_rhs);
+    }
+    void visit( IfLoop* me )
+    {
+        foreach( const Ref<Expression>& e, me->d_if )
+            visitExpr(e);
+        foreach( const StatSeq& ss, me->d_then )
+            visitSeq(ss);
+        visitSeq(me->d_else);
+    }
+    void visit( ForLoop* me )
+    {
+        visitExpr(me->d_id);
+        visitExpr(me->d_from);
+        visitExpr(me->d_to);
+        visitExpr(me->d_by);
+        visitSeq(me->d_do);
+    }
+    void visit( CaseStmt* me )
+    {
+        visitExpr(me->d_exp);
+        foreach( const CaseStmt::Case& c, me->d_cases )
+        {
+            foreach( const Ref<Expression>& e, c.d_labels )
+                visitExpr(e);
+            visitSeq(c.d_block);
+        }
+        visitSeq(me->d_else);
+    }
+    void visit( SetExpr* me )
+    {
+        foreach( const Ref<Expression>& e, me->d_parts )
+            visitExpr(e);
+    }
+    void visit( IdentSel* me )
+    {
+        visitExpr(me->d_sub);
+    }
+    void visit( UnExpr* me )
+    {
+        visitExpr(me->d_sub);
+    }
+    void visit( ArgExpr* me )
+    {
+        Named* n = me->d_sub.isNull() ? 0 : me->d_sub->getIdent();
+        if( me->d_op == ArgExpr::CALL && n && n->getTag() == Thing::T_Procedure &&
+                me->d_sub->getTag() == Thing::T_IdentLeaf && size.contains(cast<Procedure*>(n)) )
+        {
+            Procedure* p = cast<Procedure*>(n);
+            Shape shape;
+            if( shapeOf(p->getProcType(), me, shape) )
+            {
+                QList<Shape>& l = clones[p];
+                if( !l.contains(shape) && l.size() < maxClones && size[p] <= budget )
+                {
+                    l.append(shape);
+                    budget -= size[p];
+                }
+            }
+        }
+        visitExpr(me->d_sub);
+        foreach( const Ref<Expression>& e, me->d_args )
+            visitExpr(e);
+    }
+    void visit( BinExpr* me )
+    {
+        visitExpr(me->d_lhs);
+        visitExpr(me->d_rhs);
+    }
+};
+
 struct ObxCGenImp : public AstVisitor
 {
     Errors* err;
@@ -139,10 +751,25 @@ struct ObxCGenImp : public AstVisitor
     QList<QPair<QString,QIODevice*> > overlay;
     bool ownsErr;
     bool debug; // generate line pragmas
+    bool amalgamated; // all modules end up in the same translation unit
+    int profiling; // CGen2::Profiling
+    QList<quint64> profCounts; // counters of a previous instrumented run, indexed like profCount
+    quint64 profHot;
+    int profCount; // procedures and IF/CASE arms get consecutive counters in source order
+    QHash<Statement*,int> profCounters; // the first counter of the IF, WITH, WHILE, FOR and CASE of the current body
+    Module* shareWith; // an instance of the same generic module with the same representation, or null
+    QSet<Procedure*> shared; // see ObxCGenShareCheck
     quint32 anonymousDeclNr; // starts with one, zero is an invalid slot
     Procedure* curProc;
     Named* curVarDecl;
     QSet<Record*> declToInline;
+    QHash<QByteArray,QByteArray> litPool; // literal -> name of static table
+    QByteArrayList litPoolDecls;
+    QSet<Parameter*> restricted; // see ObxCGenAliasCheck
+    QSet<Statement*> tailCalls; // of curProc, see Lowering::findTailCalls
+    bool tailLoop; // curProc has a $tail label where self tail calls restart the body
+    QHash<Procedure*,QList<ObxCGenShapeCheck::Shape> > clones; // see ObxCGenShapeCheck
+    QHash<Parameter*,QList<quint32> > curShape; // the lengths of the open array parameters if curProc is a clone
 
 #ifdef _OBX_FUNC_SEQ_POINT_
     struct Temp
@@ -158,8 +785,9 @@ struct ObxCGenImp : public AstVisitor
 #endif
     QList<int> sellLater;
 
-    ObxCGenImp():err(0),thisMod(0),ownsErr(false),level(0),debug(false),anonymousDeclNr(1),
-        curProc(0),curVarDecl(0){}
+    ObxCGenImp():err(0),thisMod(0),ownsErr(false),level(0),debug(false),amalgamated(false),
+        profiling(CGen2::NoProfiling),profHot(0),profCount(0),shareWith(0),anonymousDeclNr(1),
+        curProc(0),curVarDecl(0),tailLoop(false){}
 
     inline QByteArray ws() { return QByteArray(level*4,' '); }
 
@@ -378,7 +1006,15 @@ struct ObxCGenImp : public AstVisitor
 
     static inline bool passByRef( Parameter* p )
     {
-        return p->d_var;
+        if( !p->d_var )
+            return false;
+        if( p->d_const && !p->d_unsafe )
+        {
+            // IN parameters of non-structured type are passed by value; the validator makes sure they are not modified
+            Type* td = derefed(p->d_type.data());
+            return td == 0 || td->isStructured();
+        }
+        return true;
     }
 
     QByteArray formatFormals( ProcType* pt, bool withName = true, Parameter* receiver = 0 )
@@ -392,18 +1028,23 @@ struct ObxCGenImp : public AstVisitor
         {
             if( i != 0 || pt->d_typeBound )
                 res += ", ";
-            Type* t = pt->d_formals[i]->d_type.data();
+            Parameter* f = pt->d_formals[i].data();
+            Type* t = f->d_type.data();
             Type* td = derefed(t);
             Pointer p;
-            if( passByRef(pt->d_formals[i].data()) || td->getTag() == Thing::T_Array )
+            QByteArray name = withName ? escape(f->d_name) : "";
+            if( passByRef(f) || td->getTag() == Thing::T_Array )
             {
-                // TODO: avoid passing by ref when IN with non-structured types
                 t = &p;
-                p.d_to = pt->d_formals[i]->d_type.data();
-                p.d_decl = pt->d_formals[i].data();
-                p.d_loc = pt->d_formals[i]->d_loc;
+                p.d_to = f->d_type.data();
+                p.d_decl = f;
+                p.d_loc = f->d_loc;
+                if( withName && restricted.contains(f) )
+                    name = "restrict " + name;
+                if( f->d_const && td->getTag() == Thing::T_Record )
+                    res += "const ";
             }
-            res += formatType( t, withName ? escape(pt->d_formals[i]->d_name) : "" );
+            res += formatType( t, name );
         }
         if( pt->d_varargs )
         {
@@ -440,10 +1081,12 @@ struct ObxCGenImp : public AstVisitor
 #else
                 // this also works with function pointers
                 QByteArray name;
-                if( tag != Thing::T_Array )
+                if( tag != Thing::T_Array && !n->d_upvalReadOnly )
                     name += "*";
                 if( withName )
                     name += " " + escape(n->d_name);
+                if( tag == Thing::T_Record && n->isVarParam() && cast<Parameter*>(n)->d_const )
+                    res += "const "; // an IN record is passed on as pointer to const
                 res += formatType( t, name );
 #endif
             }
@@ -819,6 +1462,60 @@ struct ObxCGenImp : public AstVisitor
         h << "extern struct " << className << "$Class$ " << className << "$class$;" << endl << endl;
     }
 
+    inline quint64 profCountOf( int counter ) const
+    {
+        return counter < profCounts.size() ? profCounts[counter] : 0;
+    }
+
+    void emitProfCount( int counter )
+    {
+        if( profiling == CGen2::Instrument )
+            b << ws() << modName << "$prof$[" << counter << "]++;" << endl;
+    }
+
+    void numberProfCounters( const StatSeq& ss )
+    {
+        // the counters are numbered before the body is generated, so they neither depend on the order in which
+        // emitIf renders the arms nor on how often the body is rendered (see the clones)
+        foreach( const Ref<Statement>& s, ss )
+        {
+            switch( s->getTag() )
+            {
+            case Thing::T_IfLoop:
+                {
+                    IfLoop* me = cast<IfLoop*>(s.data());
+                    if( me->d_op == IfLoop::IF || me->d_op == IfLoop::WITH || me->d_op == IfLoop::WHILE )
+                    {
+                        profCounters[me] = profCount;
+                        profCount += me->d_if.size() + 1;
+                    }
+                    for( int i = 0; i < me->d_then.size(); i++ )
+                        numberProfCounters(me->d_then[i]);
+                    numberProfCounters(me->d_else);
+                }
+                break;
+            case Thing::T_ForLoop:
+                {
+                    ForLoop* me = cast<ForLoop*>(s.data());
+                    profCounters[me] = profCount; // see Lowering::lowerFor
+                    profCount += 2;
+                    numberProfCounters(me->d_do);
+                }
+                break;
+            case Thing::T_CaseStmt:
+                {
+                    CaseStmt* me = cast<CaseStmt*>(s.data());
+                    profCounters[me] = profCount; // see Lowering::lowerCase
+                    profCount += me->d_cases.size() + 1;
+                    for( int i = 0; i < me->d_cases.size(); i++ )
+                        numberProfCounters(me->d_cases[i].d_block);
+                    numberProfCounters(me->d_else);
+                }
+                break;
+            }
+        }
+    }
+
     void visit( Module* me)
     {
         const QByteArray moduleName = moduleRef(me);
@@ -837,6 +1534,30 @@ struct ObxCGenImp : public AstVisitor
         ObxCGenCollector co;
         me->accept(&co);
 
+        ObxCGenAliasCheck ac;
+        ac.run(me, co.allProcs);
+        ac.getRestricted(restricted);
+
+        if( shareWith )
+        {
+            ObxCGenShareCheck sc(me);
+            sc.run(co.allProcs);
+            shared = sc.getShared();
+            if( !shared.isEmpty() )
+                b << "#include \"" << fileName(shareWith) << ".h\"" << endl;
+        }
+
+#ifdef _OBX_SPECIALIZE_OPEN_ARRAYS_
+        if( !me->d_externC )
+        {
+            ObxCGenShapeCheck shc(_OBX_SPECIALIZE_OPEN_ARRAYS_);
+            shc.run(me, co.allProcs);
+            clones = shc.clones;
+            foreach( Procedure* p, shared )
+                clones.remove(p);
+        }
+#endif
+
         foreach( Import* imp, me->d_imports )
         {
             if(imp->d_mod->d_synthetic )
@@ -881,6 +1602,13 @@ struct ObxCGenImp : public AstVisitor
         }
         b << endl;
 
+        // the rest of the body is buffered so the literal pool collected on the way can precede it
+        b.flush();
+        QIODevice* bodyOut = b.device();
+        QBuffer bodyBuf;
+        bodyBuf.open(QIODevice::WriteOnly);
+        b.setDevice(&bodyBuf);
+
         if( !Record::calcDependencyOrder(co.allRecords).isEmpty() )
             err->error(Errors::Generator, thisMod->d_file, 1,1, // shouldn't acutally happen since caught by validator
                          "circular record by value dependencies are not supported by C");
@@ -914,6 +1642,13 @@ struct ObxCGenImp : public AstVisitor
                 n->accept(this);
         }
 
+        foreach( Procedure* p, co.allProcs )
+        {
+            // the clones are local to the body and can be called before they are defined
+            for( int i = 0; i < clones.value(p).size(); i++ )
+                b << cloneSignature(p,i) << ";" << endl;
+        }
+
         foreach( Procedure* p, co.allProcs )
             p->accept(this);
 
@@ -921,12 +1656,15 @@ struct ObxCGenImp : public AstVisitor
             emitClassDecl(r);
 
         h << "extern void " << moduleName << "$init$(void);" << endl;
-        b << "static int initDone$ = 0;" << endl;
+        b << "static int " << moduleName << "$initDone$ = 0;" << endl;
         b << "void " << moduleName << "$init$(void) {" << endl;
 
         level++;
         beginBody();
-        b << ws() << "if(initDone$) return; else initDone$ = 1;" << endl;
+        b << ws() << "if(" << moduleName << "$initDone$) return; else " << moduleName << "$initDone$ = 1;" << endl;
+        if( profiling == CGen2::Instrument )
+            b << ws() << "OBX$RegisterProfile(\"" << fileName(me) << "\"," << moduleName << "$prof$,sizeof("
+              << moduleName << "$prof$)/sizeof(uint64_t));" << endl;
         foreach( Import* imp, me->d_imports )
         {
             if(imp->d_mod->d_synthetic )
@@ -951,10 +1689,12 @@ struct ObxCGenImp : public AstVisitor
             }
         }
 
+        numberProfCounters(me->d_body);
         foreach( const Ref<Statement>& s, me->d_body )
         {
             emitStatement(s.data());
         }
+        profCounters.clear();
 
         if( me->d_externC )
         {
@@ -1042,6 +1782,17 @@ struct ObxCGenImp : public AstVisitor
         level--;
         b << "}" << endl;
 
+        b.flush();
+        b.setDevice(bodyOut);
+        foreach( const QByteArray& decl, litPoolDecls )
+            b << decl;
+        if( !litPoolDecls.isEmpty() )
+            b << endl;
+        if( profiling == CGen2::Instrument )
+            b << "static uint64_t " << moduleName << "$prof$[" << qMax(profCount,1) << "];" << endl << endl;
+        b.flush();
+        bodyOut->write(bodyBuf.data());
+
         h << "#endif" << endl;
     }
 
@@ -1101,28 +1852,173 @@ struct ObxCGenImp : public AstVisitor
         }
     }
 
-    void visit( Procedure* me)
+    static bool isRecordPointer( Type* t )
+    {
+        t = derefed(t);
+        return t && t->getTag() == Thing::T_Pointer && derefed(cast<Pointer*>(t)->d_to.data())
+                && derefed(cast<Pointer*>(t)->d_to.data())->getTag() == Thing::T_Record;
+    }
+
+    void emitSharedCall( Procedure* me )
+    {
+        // the code of the instance we share with works on the same representation; only the C types of
+        // the pointers differ, so they are passed as void*
+        Procedure* other = 0;
+        foreach( const Ref<Named>& n, shareWith->d_order )
+        {
+            if( n->getTag() == Thing::T_Procedure && n->d_name == me->d_name )
+                other = cast<Procedure*>(n.data());
+        }
+        Q_ASSERT( other );
+        ProcType* pt = me->getProcType();
+        b << ws();
+        if( !pt->d_return.isNull() )
+        {
+            b << "return ";
+            if( isRecordPointer(pt->d_return.data()) )
+                b << "(void*)";
+        }
+        b << dottedName(other) << "(";
+        for( int i = 0; i < pt->d_formals.size(); i++ )
+        {
+            if( i != 0 )
+                b << ", ";
+            Parameter* p = pt->d_formals[i].data();
+            Type* td = derefed(p->d_type.data());
+            // arrays and pointers to arrays are OBX$Array$ descriptors in both instances
+            if( ( passByRef(p) && td->getTag() != Thing::T_Array ) || isRecordPointer(td) )
+                b << "(void*)";
+            b << escape(p->d_name);
+        }
+        b << "); // shared with " << shareWith->getName() << endl;
+    }
+
+    void visit( Procedure* me)
+    {
+        curProc = me;
+
+        ProcType* pt = me->getProcType();
+        QByteArray name = dottedName(me);
+
+        if( thisMod->d_externC )
+        {
+            h << "extern " << formatType(pt, name ) << ";" << endl;
+            b << formatType(pt, name ) << " = 0;" << endl;
+            curProc = 0;
+            return;
+        }
+
+        const int counter = profCount++;
+        numberProfCounters(me->d_body);
+
+        name += formatFormals(pt,true,me->d_receiver.data());
+        name = formatReturn(pt, name);
+        QByteArray storage;
+        if( amalgamated && !me->isPublic() )
+            storage = "static "; // lets the C compiler inline or drop it
+
+        h << storage << name << ";" << endl;
+
+        b << storage; // the storage class must come first, otherwise -Wold-style-declaration complains
+        if( profiling == CGen2::UseProfile && !profCounts.isEmpty() )
+        {
+            const quint64 n = profCountOf(counter);
+            if( n == 0 )
+                b << "OBX_COLD ";
+            else if( n >= profHot )
+            {
+                if( !storage.isEmpty() )
+                    b << "inline ";
+                b << "OBX_HOT ";
+            }
+        }
+        b << name << " {" << endl;
+        level++;
+
+        if( shared.contains(me) )
+        {
+            emitSharedCall(me);
+            level--;
+            b << "}" << endl;
+            profCounters.clear();
+            curProc = 0;
+            return;
+        }
+
+        emitProcBody(me,counter);
+
+        level--;
+        b << "}" << endl << endl;
+
+        const QList<ObxCGenShapeCheck::Shape> shapes = clones.value(me);
+        for( int i = 0; i < shapes.size(); i++ )
+        {
+            int off = 0;
+            foreach( const Ref<Parameter>& f, pt->d_formals )
+            {
+                if( !ObxCGenShapeCheck::isOpenArray(f.data()) )
+                    continue;
+                const int n = cast<Array*>(f->d_type->derefed())->getDims().size();
+                curShape[f.data()] = shapes[i].mid(off,n);
+                off += n;
+            }
+            b << cloneSignature(me,i) << " {" << endl;
+            level++;
+            emitProcBody(me,counter);
+            level--;
+            b << "}" << endl << endl;
+            curShape.clear();
+        }
+        profCounters.clear();
+        curProc = 0;
+    }
+
+    QByteArray cloneSignature( Procedure* p, int i )
+    {
+        ProcType* pt = p->getProcType();
+        QByteArray name = dottedName(p) + "$" + QByteArray::number(i+1);
+        name += formatFormals(pt,true,p->d_receiver.data());
+        return "static " + formatReturn(pt, name);
+    }
+
+    int cloneOf( ArgExpr* me )
+    {
+        // the number of the clone to call instead of the procedure, or zero
+        Named* n = me->d_sub->getIdent();
+        if( me->d_sub->getTag() != Thing::T_IdentLeaf || n == 0 || n->getTag() != Thing::T_Procedure )
+            return 0;
+        const QList<ObxCGenShapeCheck::Shape> shapes = clones.value(cast<Procedure*>(n));
+        if( shapes.isEmpty() )
+            return 0;
+        ObxCGenShapeCheck::Shape shape;
+        if( !ObxCGenShapeCheck::shapeOf(cast<Procedure*>(n)->getProcType(), me, shape) )
+            return 0;
+        return shapes.indexOf(shape) + 1;
+    }
+
+    int constLen( Expression* e, int dim )
     {
-        curProc = me;
-
-        ProcType* pt = me->getProcType();
-        QByteArray name = dottedName(me);
-
-        if( thisMod->d_externC )
+        // the length of the dimension of e if e is (an element of) an open array parameter of a clone, or -1
+        if( curShape.isEmpty() )
+            return -1;
+        while( e->getUnOp() == UnExpr::IDX )
         {
-            h << "extern " << formatType(pt, name ) << ";" << endl;
-            b << formatType(pt, name ) << " = 0;" << endl;
-            curProc = 0;
-            return;
+            e = cast<ArgExpr*>(e)->d_sub.data();
+            dim++;
         }
+        Named* id = e->getIdent();
+        if( e->getTag() != Thing::T_IdentLeaf || id == 0 || id->getTag() != Thing::T_Parameter ||
+                !curShape.contains(cast<Parameter*>(id)) )
+            return -1;
+        const QList<quint32>& lens = curShape[cast<Parameter*>(id)];
+        if( dim >= lens.size() )
+            return -1;
+        return lens[dim];
+    }
 
-        name += formatFormals(pt,true,me->d_receiver.data());
-        name = formatReturn(pt, name);
-
-        h << name << ";" << endl;
-
-        b << name << " {" << endl;
-        level++;
+    void emitProcBody( Procedure* me, int counter )
+    {
+        ProcType* pt = me->getProcType();
 
         // declaration
         foreach( const Ref<Named>& n, me->d_order )
@@ -1161,6 +2057,28 @@ struct ObxCGenImp : public AstVisitor
 
         beginBody();
 
+        tailCalls = Lowering::findTailCalls(me);
+        bool canLoop = Lowering::canLoop(me);
+        for( int i = 0; i < pt->d_formals.size() && canLoop; i++ )
+        {
+            // a temp of proc type would need a declarator
+            Type* td = derefed(pt->d_formals[i]->d_type.data());
+            canLoop = td->getTag() != Thing::T_ProcType;
+        }
+        if( canLoop )
+        {
+            foreach( Statement* s, tailCalls )
+            {
+                if( Lowering::calledProc(Lowering::callOf(s)) == me )
+                {
+                    // the locals are initialized again when a self tail call restarts the body
+                    tailLoop = true;
+                    b << "$tail:" << endl;
+                    break;
+                }
+            }
+        }
+
         // initializer
         foreach( const Ref<Named>& n, me->d_order )
         {
@@ -1205,10 +2123,14 @@ struct ObxCGenImp : public AstVisitor
             }
         }
 
+        emitProfCount(counter);
+
         foreach( const Ref<Statement>& s, me->d_body )
         {
             emitStatement(s.data());
         }
+        tailCalls.clear();
+        tailLoop = false;
 
         if( !pt->d_return.isNull() && ( me->d_body.isEmpty() || me->d_body.last()->getTag() != Thing::T_Return ) )
         {
@@ -1218,10 +2140,6 @@ struct ObxCGenImp : public AstVisitor
         }
 
         endBody();
-
-        level--;
-        b << "}" << endl << endl;
-        curProc = 0;
     }
 
 #if 0
@@ -1234,6 +2152,58 @@ struct ObxCGenImp : public AstVisitor
     }
 #endif
 
+    QByteArray internLiteral( quint8 basetype, const QVariant& val, quint32& len )
+    {
+        // string and byte array literals are encoded at compile time into read-only tables shared by all
+        // occurrences in the module; the OBX$Array$1 referencing them has $s=1, so code which has to own or
+        // modify the data (e.g. by value parameters or Files.Old) makes a copy, and nothing is decoded at runtime.
+        QByteArray key;
+        QByteArray elemType;
+        QVector<uint> data;
+        if( basetype == Type::BYTEARRAY )
+        {
+            const QByteArray ba = val.toByteArray();
+            key = "b" + ba;
+            elemType = "uint8_t";
+            data.resize(ba.size());
+            for( int i = 0; i < ba.size(); i++ )
+                data[i] = quint8(ba[i]);
+        }else
+        {
+            const bool wide = basetype == Type::WSTRING;
+            const QString str = val.toString();
+            key = ( wide ? "w" : "s" ) + str.toUtf8();
+            elemType = wide ? "wchar_t" : "uint8_t";
+            data = str.toUcs4(); // same code points as OBX$FromUtf produced
+            if( !wide )
+                for( int i = 0; i < data.size(); i++ )
+                    data[i] = quint8(data[i]);
+            data.append(0);
+        }
+        len = data.size();
+
+        QByteArray name = litPool.value(key);
+        if( !name.isEmpty() )
+            return name;
+        name = modName + "$str$" + QByteArray::number(litPool.size() + 1);
+        litPool.insert(key,name);
+
+        QByteArray decl = "static const " + elemType + " " + name + "[] = {";
+        if( data.isEmpty() )
+            decl += "0"; // empty byte array; C doesn't accept empty initializers
+        for( int i = 0; i < data.size(); i++ )
+        {
+            if( i != 0 )
+                decl += ",";
+            if( i % 16 == 0 )
+                decl += "\n    ";
+            decl += "0x" + QByteArray::number(data[i],16);
+        }
+        decl += "};\n";
+        litPoolDecls.append(decl);
+        return name;
+    }
+
     void emitConst(quint8 basetype, const QVariant& val, const RowCol& loc )
     {
         switch( basetype )
@@ -1262,53 +2232,11 @@ struct ObxCGenImp : public AstVisitor
             break;
         case Type::STRING:
         case Type::WSTRING:
-            {
-                QString str = val.toString();
-                const int len = str.length();
-                const int utfLen = str.toUtf8().size();
-                // no L prefix, we want UTF-8 in any case
-                b << "(const struct OBX$Array$1){";
-                b << len+1 << ",0,";
-                if( utfLen < 16000 )
-                {
-                    str.replace('\\', "\\\\");
-                    str.replace("\"","\\\"");
-                    b << "OBX$FromUtf(\"" << str << "\"," << len+1 << ","
-                      << int(basetype==Type::WSTRING) << ")";
-                }else
-                {
-                    // MSVC cl has a 16k lenth limitation for string literals
-                    b << "OBX$FromUtf2(" << len+1 << "," << int(basetype==Type::WSTRING) << ",";
-                    const int chunk = 4000; // each unicode can expand to 1 to 4 utf-8 bytes
-                    const int n = (len + chunk) / chunk;
-                    b << n;
-                    int i = 0;
-                    while( i < str.size() )
-                    {
-                        b << ", " << endl << ws();
-                        QString str2 = str.mid(i,chunk);
-                        str2.replace('\\', "\\\\");
-                        str2.replace("\"","\\\"");
-                        b << "\"" << str2 << "\""; // never cuts in an utf-8 sequence
-                        i += chunk;
-                    }
-                    b << ")";
-                }
-                b << "}";
-            }
-            break;
         case Type::BYTEARRAY:
             {
-                const QByteArray ba = val.toByteArray();
-                b << "(const struct OBX$Array$1){";
-                b << ba.length() << ",1,&(const uint8_t[]){";
-                for( int i = 0; i < ba.size(); i++ )
-                {
-                    if( i != 0 && i % 16 == 0 )
-                        b << endl << ws();
-                    b << "0x" << QByteArray::number(quint8(ba[i]),16) << ", ";
-                }
-                b << "}}";
+                quint32 len = 0;
+                const QByteArray name = internLiteral(basetype, val, len);
+                b << "(const struct OBX$Array$1){" << len << ",1,(void*)" << name << "}";
             }
             break;
         case Type::CHAR:
@@ -1387,7 +2315,7 @@ struct ObxCGenImp : public AstVisitor
             else
             {
                 // non-local access via extra arg
-                if( td->getTag() != Thing::T_Array )
+                if( td->getTag() != Thing::T_Array && !id->d_upvalReadOnly )
                     b << "(*" << escape(id->d_name) << ")";
                 else
                     b << escape(id->d_name);
@@ -1412,7 +2340,7 @@ struct ObxCGenImp : public AstVisitor
 
                 // we dereference here in case of VAR/IN so the succeeding desigs can assume a value based on d_type
                 // without checking the prefix desig. But we don't do it for array values.
-                const bool doDeref = p->d_var && td->getTag() != Thing::T_Array;
+                const bool doDeref = passByRef(p) && td->getTag() != Thing::T_Array;
                 if( doDeref )
                     b << "(*";
                 if( p->d_receiver )
@@ -1424,7 +2352,7 @@ struct ObxCGenImp : public AstVisitor
             }else
             {
                 // non-local access via extra arg
-                if( td->getTag() != Thing::T_Array )
+                if( td->getTag() != Thing::T_Array && !id->d_upvalReadOnly )
                     b << "(*" << escape(id->d_name) << ")";
                 else
                     b << escape(id->d_name);
@@ -2116,7 +3044,9 @@ struct ObxCGenImp : public AstVisitor
                             b << escape(id->d_name) << "$len[0]";
                         }else
                             b << a->d_len;
-                    }else
+                    }else if( constLen(ae->d_args.first().data(),0) >= 0 )
+                        b << constLen(ae->d_args.first().data(),0);
+                    else
                     {
                         b << "(";
                         renderDesig(0, ae->d_args.first().data(),false);
@@ -2282,15 +3212,32 @@ struct ObxCGenImp : public AstVisitor
                 }
             }else if( ae->d_args.size() == 2 )
             {
-                b << "(";
-                ae->d_args.first()->accept(this);
-                b << ( bi->d_func == BuiltIn::MAX ? " > " : " < " );
-                ae->d_args.last()->accept(this);
-                b << " ? ";
-                ae->d_args.first()->accept(this); // TODO: use runtime calls to avoid multiple evaluation
-                b << " : ";
-                ae->d_args.last()->accept(this);
-                b << ")";
+                if( Lowering::isSimple(ae->d_args.first().data()) && Lowering::isSimple(ae->d_args.last().data()) )
+                {
+                    b << "(";
+                    ae->d_args.first()->accept(this);
+                    b << ( bi->d_func == BuiltIn::MAX ? " > " : " < " );
+                    ae->d_args.last()->accept(this);
+                    b << " ? ";
+                    ae->d_args.first()->accept(this);
+                    b << " : ";
+                    ae->d_args.last()->accept(this);
+                    b << ")";
+                }else
+                {
+                    // each argument is evaluated only once
+                    const QByteArray type = formatType(ae->d_type.data());
+                    const int lhs = buyTemp(type);
+                    const int rhs = buyTemp(type);
+                    b << "($t" << lhs << " = ";
+                    ae->d_args.first()->accept(this);
+                    b << ", $t" << rhs << " = ";
+                    ae->d_args.last()->accept(this);
+                    b << ", $t" << lhs << ( bi->d_func == BuiltIn::MAX ? " > " : " < " ) << "$t" << rhs;
+                    b << " ? $t" << lhs << " : $t" << rhs << ")";
+                    sellTemp(lhs);
+                    sellTemp(rhs);
+                }
             }else
                 Q_ASSERT( false );
             break;
@@ -2647,7 +3594,7 @@ struct ObxCGenImp : public AstVisitor
                             b << dims[i]->d_len;
                         b << ",";
                     }
-                    b << "1,";
+                    b << "1,(void*)"; // the array might be a field of an IN record
                     rhs->accept(this);
                     b << "}";
                 }
@@ -2800,7 +3747,7 @@ struct ObxCGenImp : public AstVisitor
                 b << ", ";
             Parameter* p = pt->d_formals[i].data();
             Type* ta = derefed(me->d_args[i]->d_type.data());
-            if( p->d_const && !ta->isStructured(true) && !ta->isString() &&
+            if( passByRef(p) && p->d_const && !ta->isStructured(true) && !ta->isString() &&
                     ta->getBaseType() != Type::BYTEARRAY && !isLvalue(me->d_args[i].data()) )
             {
                 // if IN and not an lvalue and not structured use a compound literal
@@ -2831,7 +3778,7 @@ struct ObxCGenImp : public AstVisitor
                 if( i != 0 )
                     b << ", ";
                 Named* nl = pt->d_nonLocals[i];
-                // non-local locals/params are passed by var param
+                // non-local locals/params are passed by var param, or by value if nobody modifies them
                 if( nl->d_scope == curProc )
                 {
                     // here we are at the source of the local/param
@@ -2847,10 +3794,10 @@ struct ObxCGenImp : public AstVisitor
                     case Thing::T_Parameter:
                         // renderArg returns derefed var param unless array;
                         // so it is safe to take the address here unless it is a value array
-                        renderDesig(nl->d_type.data(), &id, td->getTag() != Thing::T_Array );
+                        renderDesig(nl->d_type.data(), &id, td->getTag() != Thing::T_Array && !nl->d_upvalReadOnly );
                         break;
                     case Thing::T_LocalVar:
-                        renderDesig(nl->d_type.data(), &id, td->getTag() != Thing::T_Array );
+                        renderDesig(nl->d_type.data(), &id, td->getTag() != Thing::T_Array && !nl->d_upvalReadOnly );
                         break;
                     default:
                         Q_ASSERT(false);
@@ -2987,7 +3934,7 @@ struct ObxCGenImp : public AstVisitor
                 const int fptr = buyTemp(formatProcType(pt),pt);
                 b << "($t" << fptr << " = ";
 #endif
-                b << "((" << formatType(p->d_receiverRec,"*") << ")($t" << self << " = ";
+                b << "((" << formatType(p->d_receiverRec,"*") << ")($t" << self << " = (void*)"; // might be an IN record
 #if 0
                 // causes lvalue error if d_sub is a function call
                 b << "&(";
@@ -3048,7 +3995,7 @@ struct ObxCGenImp : public AstVisitor
                 const int fptr = buyTemp(formatProcType(pt),pt);
                 b << "($t" << fptr << " = ";
 #endif
-            b << "((" << formatType(p->d_receiverRec,"*") << ")($t" << self << " = ";
+            b << "((" << formatType(p->d_receiverRec,"*") << ")($t" << self << " = (void*)";
 #if 1
             // TODO is this ok or is it necessary to handle like !superCall above?
             b << "&(";
@@ -3075,7 +4022,11 @@ struct ObxCGenImp : public AstVisitor
             sellTemp(self);
         }else
         {
-            me->d_sub->accept(this);
+            const int clone = cloneOf(me);
+            if( clone )
+                b << dottedName(me->d_sub->getIdent()) << "$" << clone;
+            else
+                me->d_sub->accept(this);
             b << "(";
             emitActuals(pt,me);
             b << ")";
@@ -3104,7 +4055,7 @@ struct ObxCGenImp : public AstVisitor
                 Q_ASSERT( td->getTag() == Thing::T_Array );
 
                 QList<Array*> dims = cast<Array*>(td)->getDims();
-                const bool dynLen = hasDynLen(dims);
+                const bool dynLen = hasDynLen(dims) && constLen(e->d_sub.data(),0) < 0;
                 b << "(";
                 const int temp = buyTemp(arrayType(dims.size(),e->d_sub->d_loc)+"*");
                 if( dynLen )
@@ -3150,11 +4101,10 @@ struct ObxCGenImp : public AstVisitor
                                     b << escape(id->d_name) << "$len[" << i << "]";
                                 }else
                                     b << dims[i]->d_len;
-                            }else
-                            {
-                                Q_ASSERT(dynLen);
+                            }else if( !dynLen )
+                                b << constLen(e->d_sub.data(),i); // a clone knows the length
+                            else
                                 b << "$t" << temp << "->$" << i+1;
-                            }
                         }
                     }
                 }
@@ -3477,27 +4427,94 @@ struct ObxCGenImp : public AstVisitor
 
     void visit( SetExpr* me)
     {
-        b << "OBX$MakeSet(" << me->d_parts.size() * 2;
+        // constant elements and ranges are folded to a bitmask; the remaining parts are or'ed inline
+        quint32 mask = 0;
+        QList<Expression*> dynamic;
         for( int i = 0; i < me->d_parts.size(); i++ )
         {
-            b << ",";
             BinExpr* bi = me->d_parts[i]->getTag() == Thing::T_BinExpr ? cast<BinExpr*>( me->d_parts[i].data() ) : 0;
+            qint64 l, r;
+            if( bi && bi->d_op == BinExpr::Range )
+            {
+                Q_ASSERT( bi->d_lhs && bi->d_rhs );
+                if( Lowering::isConstInt(bi->d_lhs.data(), l) && Lowering::isConstInt(bi->d_rhs.data(), r)
+                        && l >= 0 && r < Literal::SET_BIT_LEN )
+                {
+                    for( qint64 j = l; j <= r; j++ )
+                        mask |= 1u << j;
+                }else
+                    dynamic << bi;
+            }else if( Lowering::isConstInt(me->d_parts[i].data(), l) && l >= 0 && l < Literal::SET_BIT_LEN )
+                mask |= 1u << l;
+            else
+                dynamic << me->d_parts[i].data();
+        }
+        if( dynamic.isEmpty() )
+        {
+            b << "0x" << QByteArray::number(mask,16);
+            return;
+        }
+        b << "(";
+        if( mask )
+            b << "0x" << QByteArray::number(mask,16) << " | ";
+        for( int i = 0; i < dynamic.size(); i++ )
+        {
+            if( i != 0 )
+                b << " | ";
+            BinExpr* bi = dynamic[i]->getTag() == Thing::T_BinExpr ? cast<BinExpr*>( dynamic[i] ) : 0;
             if( bi && bi->d_op == BinExpr::Range )
             {
-                Q_ASSERT( bi->d_lhs );
+                b << "OBX$SetRange(";
                 bi->d_lhs->accept(this);
                 b << ",";
-                Q_ASSERT( bi->d_rhs );
                 bi->d_rhs->accept(this);
+                b << ")";
             }else
             {
-                me->d_parts[i]->accept(this);
-                b << ",-1";
+                b << "((uint32_t)1 << (";
+                dynamic[i]->accept(this);
+                b << "))";
             }
         }
         b << ")";
     }
 
+    static qint64 staticElemCount( Type* t )
+    {
+        // number of elements of a (multi-dim) array if all lengths are known at compile time, else -1
+        Type* td = derefed(t);
+        if( td == 0 || td->getTag() != Thing::T_Array )
+            return -1;
+        QList<Array*> dims = cast<Array*>(td)->getDims();
+        qint64 n = 1;
+        for( int i = 0; i < dims.size(); i++ )
+        {
+            if( dims[i]->d_lenExpr.isNull() || dims[i]->d_vla )
+                return -1;
+            n *= dims[i]->d_len;
+        }
+        return n;
+    }
+
+    void renderArrayData( Expression* e )
+    {
+        // renders a pointer to the first element of the array designated by e
+        Type* td = derefed(e->d_type.data());
+        Named* id = e->getIdent();
+        const int tag = e->getTag();
+        const bool value = ( tag == Thing::T_IdentLeaf || tag == Thing::T_IdentSel ) && id &&
+                ( id->getTag() == Thing::T_Variable || id->getTag() == Thing::T_Field ||
+                  ( id->getTag() == Thing::T_LocalVar && id->d_scope == curProc ) );
+        if( value )
+            e->accept(this); // a plain C array which decays to a pointer
+        else
+        {
+            b << "(";
+            renderDesig(td, e, false);
+            b << ").$a";
+        }
+    }
+
     void visit( Assign* me)
     {
         b << ws();
@@ -3527,16 +4544,30 @@ struct ObxCGenImp : public AstVisitor
                 b << "," << int(rwide) << ")";
             }else
             {
-                b << "OBX$ArrCopy(";
-                renderDesig2(tl, me->d_lhs.data(),true);
-                b << ",";
-                renderDesig2(tl, me->d_rhs.data(),true);
-                b << ",";
                 int dims;
                 Type* at = cast<Array*>(tl)->getTypeDim(dims);
-                b << dims << ",";
-                b << "sizeof(" << formatType(at) << ")";
-                b << ")";
+                const qint64 llen = staticElemCount(tl);
+                const qint64 rlen = staticElemCount(tr);
+                if( llen >= 0 && rlen >= 0 )
+                {
+                    // both shapes are known at compile time; the C compiler inlines a memcpy of fixed size
+                    b << "memcpy(";
+                    renderArrayData(me->d_lhs.data());
+                    b << ",";
+                    renderArrayData(me->d_rhs.data());
+                    b << "," << qMin(llen,rlen) << "*sizeof(" << formatType(at) << "))";
+                }else
+                {
+                    if( dims < 1 || dims > 5 )
+                        arrayType(dims,me->d_loc); // reports the error
+                    b << "OBX$ArrCopy" << dims << "(";
+                    renderDesig2(tl, me->d_lhs.data(),true);
+                    b << ",";
+                    renderDesig2(tl, me->d_rhs.data(),true);
+                    b << ",";
+                    b << "sizeof(" << formatType(at) << ")";
+                    b << ")";
+                }
             }
         }else
         {
@@ -3547,9 +4578,46 @@ struct ObxCGenImp : public AstVisitor
         b << ";" << endl;
     }
 
+    bool emitTailLoop( Statement* s )
+    {
+        ArgExpr* ae = Lowering::callOf(s);
+        if( !tailLoop || Lowering::calledProc(ae) != curProc )
+            return false; // a tail call to another procedure is left to the C compiler
+        // the arguments replace the parameters and the body starts over; the arguments are evaluated
+        // into temps first because they may refer to the parameters
+        ProcType* pt = curProc->getProcType();
+        Q_ASSERT( pt->d_formals.size() == ae->d_args.size() );
+        QList<int> tmps;
+        for( int i = 0; i < pt->d_formals.size(); i++ )
+        {
+            Parameter* p = pt->d_formals[i].data();
+            if( ae->d_args[i]->getIdent() == p )
+            {
+                tmps << -1; // passed on unchanged
+                continue;
+            }
+            const int t = buyTemp(formatType(p->d_type.data()));
+            tmps << t;
+            b << ws() << "$t" << t << " = ";
+            renderActual(pt, p->d_type.data(), ae->d_args[i].data(), false );
+            b << ";" << endl;
+        }
+        for( int i = 0; i < tmps.size(); i++ )
+        {
+            if( tmps[i] < 0 )
+                continue;
+            b << ws() << escape(pt->d_formals[i]->d_name) << " = $t" << tmps[i] << ";" << endl;
+            sellTemp(tmps[i]);
+        }
+        b << ws() << "goto $tail;" << endl;
+        return true;
+    }
+
     void visit( Call* me )
     {
         Q_ASSERT( me->d_what );
+        if( tailCalls.contains(me) && emitTailLoop(me) )
+            return;
         b << ws();
         me->d_what->accept(this);
         b << ";" << endl;
@@ -3563,6 +4631,8 @@ struct ObxCGenImp : public AstVisitor
     void visit( Return* me)
     {
         Q_ASSERT( curProc );
+        if( tailCalls.contains(me) && emitTailLoop(me) )
+            return;
         b << ws() << "return ";
         if( me->d_what )
             renderDesig( curProc->getProcType()->d_return.data(), me->d_what.data(), false );
@@ -3571,170 +4641,84 @@ struct ObxCGenImp : public AstVisitor
 
     void visit( CaseStmt* me)
     {
-        // NOTE: identical with CilGen!
-
-        if( me->d_typeCase )
+        Lowering::Temp tmp;
+        int t = -1;
+        if( Lowering::needsCaseTemp(me) )
         {
-            // first rewrite the AST with 'if' instead of complex 'case'
-
-            if( me->d_cases.isEmpty() )
-                return;
-
-            Ref<IfLoop> ifl = new IfLoop();
-            ifl->d_op = IfLoop::IF;
-            ifl->d_loc = me->d_loc;
-
-            for( int i = 0; i < me->d_cases.size(); i++ )
-            {
-                const CaseStmt::Case& c = me->d_cases[i];
-
-                Q_ASSERT( c.d_labels.size() == 1 );
-                Type* td = derefed(c.d_labels.first()->d_type.data());
-
-                Ref<BinExpr> eq = new BinExpr();
-                if( td && td->getBaseType() == Type::NIL )
-                    eq->d_op = BinExpr::EQ;
-                else
-                    eq->d_op = BinExpr::IS;
-                eq->d_lhs = me->d_exp;
-                eq->d_rhs = c.d_labels.first();
-                eq->d_loc = me->d_exp->d_loc;
-                eq->d_type = new BaseType(Type::BOOLEAN);
-
-                ifl->d_if.append(eq.data());
-                ifl->d_then.append( c.d_block );
-            }
-
-            ifl->d_else = me->d_else;
-
-            // and now generate code for the if
-            ifl->accept(this);
+            // the case expression is evaluated once and each label is compared with the temp
+            Type* td = me->d_exp->d_type.data();
+            t = buyTemp(formatType(td));
+            tmp = Lowering::makeTemp(td, curProc, "$t" + QByteArray::number(t), me->d_exp->d_loc );
+            b << ws() << "$t" << t << " = ";
+            renderDesig(td, me->d_exp.data(), false);
+            b << ";" << endl;
         }
-        else
+        Ref<IfLoop> ifl = Lowering::lowerCase(me, tmp.d_use.data());
+        if( !ifl.isNull() )
         {
-            // first rewrite the AST with 'if' instead of complex 'case'
-
-            Ref<IfLoop> ifl = new IfLoop();
-            ifl->d_op = IfLoop::IF;
-            ifl->d_loc = me->d_loc;
-
-            Ref<BaseType> boolean = new BaseType(Type::BOOLEAN);
-
-            // TODO: consider switch statement
-            for( int i = 0; i < me->d_cases.size(); i++ )
-            {
-                const CaseStmt::Case& c = me->d_cases[i];
-
-                QList< Ref<Expression> > ors;
-                for( int j = 0; j < c.d_labels.size(); j++ )
-                {
-                    Expression* l = c.d_labels[j].data();
-                    // TODO: avoid redundant evaluations using temp vars
-                    bool done = false;
-                    if( l->getTag() == Thing::T_BinExpr )
-                    {
-                        BinExpr* bi = cast<BinExpr*>( l );
-                        if( bi->d_op == BinExpr::Range )
-                        {
-                            // TODO: consider lhs > rhs
-                            Ref<BinExpr> _and = new BinExpr();
-                            _and->d_op = BinExpr::AND;
-                            _and->d_loc = l->d_loc;
-                            _and->d_type = boolean.data();
-
-                            Ref<BinExpr> lhs = new BinExpr();
-                            lhs->d_op = BinExpr::GEQ;
-                            lhs->d_lhs = me->d_exp;
-                            lhs->d_rhs = bi->d_lhs;
-                            lhs->d_loc = l->d_loc;
-                            lhs->d_type = boolean.data();
-
-                            Ref<BinExpr> rhs = new BinExpr();
-                            rhs->d_op = BinExpr::LEQ;
-                            rhs->d_lhs = me->d_exp;
-                            rhs->d_rhs = bi->d_rhs;
-                            rhs->d_loc = l->d_loc;
-                            rhs->d_type = boolean.data();
-
-                            _and->d_lhs = lhs.data();
-                            _and->d_rhs = rhs.data();
-
-                            ors << _and.data();
-                            done = true;
-                        }
-                    }
-                    if( !done )
-                    {
-                        Ref<BinExpr> eq = new BinExpr();
-                        eq->d_op = BinExpr::EQ;
-                        eq->d_lhs = me->d_exp;
-                        eq->d_rhs = l;
-                        eq->d_loc = l->d_loc;
-                        eq->d_type = boolean.data();
-
-                        ors << eq.data();
-                    }
-                }
-                Q_ASSERT( !ors.isEmpty() );
-                if( ors.size() == 1 )
-                    ifl->d_if.append( ors.first() );
-                else
-                {
-                    Q_ASSERT( ors.size() > 1 );
-                    Ref<BinExpr> bi = new BinExpr();
-                    bi->d_op = BinExpr::OR;
-                    bi->d_lhs = ors[0];
-                    bi->d_rhs = ors[1];
-                    bi->d_loc = ors[1]->d_loc;
-                    bi->d_type = boolean.data();
-                    for( int i = 2; i < ors.size(); i++ )
-                    {
-                        Ref<BinExpr> tmp = new BinExpr();
-                        tmp->d_op = BinExpr::OR;
-                        tmp->d_lhs = bi.data();
-                        tmp->d_type = boolean.data();
-                        bi = tmp;
-                        bi->d_rhs = ors[i];
-                        bi->d_loc = ors[i]->d_loc;
-                    }
-                    ifl->d_if.append( bi.data() );
-                }
+            if( me->d_typeCase )
+                emitIf(ifl.data(), profCounters.value(me)); // the type guards are tested in order of declaration
+            else
+                emitIf(ifl.data(), profCounters.value(me), true);
+        }
+        if( t >= 0 )
+            sellTemp(t);
+    }
 
-                ifl->d_then.append( c.d_block );
-            }
+    void renderCondition( Expression* cond, quint64 taken, quint64 total )
+    {
+        // with a profile, conditions which are rarely or almost always true are marked for the C compiler
+        if( profiling == CGen2::UseProfile && total >= 16 && taken * 10 >= total * 9 )
+            b << "OBX_LIKELY(";
+        else if( profiling == CGen2::UseProfile && total >= 16 && taken * 10 <= total )
+            b << "OBX_UNLIKELY(";
+        else
+            total = 0;
+        renderDesig(cond->d_type.data(), cond, false);
+        if( total )
+            b << ")";
+    }
 
-            ifl->d_else = me->d_else;
+    void emitIf( IfLoop* me, int counter, bool disjoint = false )
+    {
+        // each arm and the (possibly implicit) else has a counter, starting with counter
 
-            // and now generate code for the if
-            ifl->accept(this);
+        QList<int> order;
+        for( int i = 0; i < me->d_if.size(); i++ )
+            order << i;
+        if( disjoint && profiling == CGen2::UseProfile )
+        {
+            // the arms of a CASE exclude each other, so the most frequent can be tested first
+            for( int i = 1; i < order.size(); i++ )
+                for( int j = i; j > 0 && profCountOf(counter+order[j]) > profCountOf(counter+order[j-1]); j-- )
+                    order.swap(j,j-1);
         }
-    }
+        quint64 remaining = profCountOf(counter + me->d_if.size());
+        for( int i = 0; i < order.size(); i++ )
+            remaining += profCountOf(counter + order[i]);
 
-    void emitIf( IfLoop* me )
-    {
-        b << ws() << "if( ";
-        renderDesig(me->d_if[0]->d_type.data(), me->d_if[0].data(),false);
-        b << " ) {" << endl;
-        level++;
-        for( int i = 0; i < me->d_then[0].size(); i++ )
-            emitStatement(me->d_then[0][i].data());
-        level--;
-        b << ws() << "} ";
-        for( int i = 1; i < me->d_if.size(); i++ ) // ELSIF
+        for( int k = 0; k < order.size(); k++ )
         {
-            b << "else if( ";
-            renderDesig(me->d_if[i]->d_type.data(), me->d_if[i].data(),false);
+            const int i = order[k];
+            if( k == 0 )
+                b << ws() << "if( ";
+            else
+                b << "else if( "; // ELSIF
+            renderCondition(me->d_if[i].data(), profCountOf(counter + i), remaining);
+            remaining -= profCountOf(counter + i);
             b << " ) {" << endl;
             level++;
+            emitProfCount(counter + i);
             for( int j = 0; j < me->d_then[i].size(); j++ )
                 emitStatement(me->d_then[i][j].data());
             level--;
             b << ws() << "} ";
         }
-        if( !me->d_else.isEmpty() ) // ELSE
+        if( !me->d_else.isEmpty() || profiling == CGen2::Instrument ) // ELSE
         {
             b << "else {" << endl;
             level++;
+            emitProfCount(counter + me->d_if.size());
             for( int j = 0; j < me->d_else.size(); j++ )
                 emitStatement(me->d_else[j].data());
             level--;
@@ -3748,31 +4732,15 @@ struct ObxCGenImp : public AstVisitor
         switch( me->d_op )
         {
         case IfLoop::IF:
-            emitIf(me);
+            emitIf(me, profCounters.value(me));
             break;
         case IfLoop::WHILE:
             {
-                // NOTE: identical with CilGen!
-                // substitute by primitive statements
-                Ref<IfLoop> loop = new IfLoop();
-                loop->d_op = IfLoop::LOOP;
-                loop->d_loc = me->d_loc;
-
-                Ref<IfLoop> conds = new IfLoop();
-                conds->d_op = IfLoop::IF;
-                conds->d_loc = me->d_loc;
-
-                conds->d_if = me->d_if;
-                conds->d_then = me->d_then;
-
-                Q_ASSERT( me->d_else.isEmpty() );
-                Ref<Exit> ex = new Exit();
-                ex->d_loc = me->d_loc;
-                conds->d_else << ex.data();
-
-                loop->d_then << ( StatSeq() << conds.data() );
-
-                loop->accept(this); // now render
+                Ref<IfLoop> loop = Lowering::lowerWhile(me);
+                Statement* conds = loop->d_then.first().first().data();
+                profCounters[conds] = profCounters.value(me); // the lowered IF counts for the WHILE
+                loop->accept(this);
+                profCounters.remove(conds);
             }
             break;
         case IfLoop::REPEAT:
@@ -3791,7 +4759,7 @@ struct ObxCGenImp : public AstVisitor
             {
                 // if guard then statseq elsif guard then statseq else statseq end
                 // guard ::= lhs IS rhs
-                emitIf(me);
+                emitIf(me, profCounters.value(me));
             }
             break;
         case IfLoop::LOOP:
@@ -3809,52 +4777,11 @@ struct ObxCGenImp : public AstVisitor
 
     void visit( ForLoop* me)
     {
-        // NOTE: identical with CilGen!
-
-        // i := from;
-        // WHILE i <= to DO statements; i := i + by END
-        // WHILE i >= to DO statements; i := i + by END
-
-        // TODO: caclulate TO only once!
-
-        Ref<Assign> a = new Assign();
-        a->d_loc = me->d_loc;
-        a->d_lhs = me->d_id;
-        a->d_rhs = me->d_from;
-
-        Ref<IfLoop> loop = new IfLoop();
-        loop->d_loc = me->d_loc;
-        loop->d_op = IfLoop::WHILE;
-
-        Ref<BinExpr> cond = new BinExpr();
-        cond->d_loc = me->d_loc;
-        if( me->d_byVal.toInt() > 0 )
-            cond->d_op = BinExpr::LEQ;
-        else
-            cond->d_op = BinExpr::GEQ;
-        cond->d_lhs = me->d_id;
-        cond->d_rhs = me->d_to;
-        cond->d_type = me->d_id->d_type.data();
-        loop->d_if.append( cond.data() );
-
-        loop->d_then.append( me->d_do );
-
-        Ref<BinExpr> add = new BinExpr();
-        add->d_loc = me->d_loc;
-        add->d_op = BinExpr::ADD;
-        add->d_lhs = me->d_id;
-        add->d_rhs = me->d_by;
-        add->d_type = me->d_id->d_type;
-
-        Ref<Assign> a2 = new Assign();
-        a2->d_loc = me->d_loc;
-        a2->d_lhs = me->d_id;
-        a2->d_rhs = add.data();
-
-        loop->d_then.back().append( a2.data() );
-
-        a->accept(this);
-        loop->accept(this);
+        const StatSeq ss = Lowering::lowerFor(me);
+        profCounters[ss.last().data()] = profCounters.value(me); // the lowered WHILE counts for the FOR
+        for( int i = 0; i < ss.size(); i++ )
+            ss[i]->accept(this);
+        profCounters.remove(ss.last().data());
     }
 
     void visit( LocalVar* ) { Q_ASSERT(false); }
@@ -3891,7 +4818,92 @@ static bool copyFile( const QDir& outDir, const QByteArray& name, QTextStream& l
     return true;
 }
 
-bool Obx::CGen2::translateAll(Obx::Project* pro, bool debug, const QString& where)
+static QByteArray readRuntimeFile( const QByteArray& name )
+{
+    QFile f( QString(":/runtime/%1" ).arg(name.constData() ) );
+    if( !f.open(QIODevice::ReadOnly) )
+    {
+        qCritical() << "unknown lib" << name;
+        return QByteArray();
+    }
+    return f.readAll();
+}
+
+static void writeAmalgamated( QIODevice* out, const QByteArray& src, const QHash<QByteArray,QByteArray>& headers,
+                              QSet<QByteArray>& included )
+{
+    // replaces each #include of a known header by its content, the first time it is seen; this is what the
+    // include guards would do anyway, but it results in a self-contained file
+    const QList<QByteArray> lines = src.split('\n');
+    for( int i = 0; i < lines.size(); i++ )
+    {
+        const QByteArray line = lines[i].trimmed();
+        if( line.startsWith("#include \"") && line.endsWith('"') )
+        {
+            const QByteArray name = line.mid(10, line.size() - 11);
+            if( headers.contains(name) )
+            {
+                if( !included.contains(name) )
+                {
+                    included.insert(name);
+                    writeAmalgamated(out, headers.value(name), headers, included);
+                }
+                continue;
+            }
+        }
+        out->write(lines[i]);
+        if( i < lines.size() - 1 )
+            out->write("\n");
+    }
+}
+
+static const char* s_oakwood[] = { "Input", "Out", "Math", "MathL", "In", "Strings", "Files", "XYplane", 0 };
+
+static QHash<QByteArray,QList<quint64> > readProfile( const QString& path )
+{
+    // each line is "module n c0 c1 ... cn-1" as written by OBX$RegisterProfile
+    QHash<QByteArray,QList<quint64> > res;
+    QFile f(path);
+    if( !f.open(QIODevice::ReadOnly) )
+    {
+        qCritical() << "cannot open profile" << path;
+        return res;
+    }
+    while( !f.atEnd() )
+    {
+        const QList<QByteArray> parts = f.readLine().simplified().split(' ');
+        if( parts.size() < 2 )
+            continue;
+        const int n = parts[1].toInt();
+        QList<quint64>& counts = res[parts[0]];
+        for( int i = 0; i < n && i + 2 < parts.size(); i++ )
+            counts.append(parts[i+2].toULongLong());
+    }
+    return res;
+}
+
+static QByteArray representationOf( Module* inst )
+{
+    // instances of the same generic module get the same key if their actuals only differ in the pointer to record
+    // types, which are all represented by plain C pointers
+    QByteArray res = inst->getFullName() + "(";
+    for( int i = 0; i < inst->d_metaActuals.size() && i < inst->d_metaParams.size(); i++ )
+    {
+        const MetaActual& a = inst->d_metaActuals[i];
+        Type* td = a.d_type.isNull() ? 0 : a.d_type->derefed();
+        Type* to = td && td->getTag() == Thing::T_Pointer ? cast<Pointer*>(td)->d_to->derefed() : 0;
+        if( i != 0 )
+            res += ",";
+        if( inst->d_metaParams[i]->getTag() != Thing::T_Const && to && to->getTag() == Thing::T_Record )
+            res += "^";
+        else
+            res += Module::format(MetaParams() << inst->d_metaParams[i], MetaActuals() << a);
+    }
+    return res + ")";
+}
+
+bool Obx::CGen2::translateAll(Obx::Project* pro, bool debug, const QString& where, bool amalgamate,
+                              Profiling profiling, const QString& profile, const QSet<QByteArray>& upToDate)
 {
     // NOTE: can be built using cc -O2 --std=c99 *.c -lm resulting in a.out
 
@@ -3909,9 +4921,22 @@ bool Obx::CGen2::translateAll(Obx::Project* pro, bool debug, const QString& wher
     QByteArray clearStr;
     QTextStream fout(&clearStr);
 
+    const quint32 errCount = pro->getErrs()->getErrCount(); // also counts the errors of the deferred bodies
     QList<Module*> mods = pro->getModulesToGenerate();
-    const quint32 errCount = pro->getErrs()->getErrCount();
+    if( pro->getErrs()->getErrCount() != errCount )
+        return false;
     QSet<Module*> generated;
+
+    // with amalgamate all generated modules, the main and the runtime end up in a single OBX.Main.c in
+    // dependency order, so the C compiler can optimize across modules without LTO
+    QHash<QByteArray,QByteArray> headers;
+    QByteArrayList bodies;
+
+    QHash<QByteArray,Module*> representatives; // see representationOf
+
+    QHash<QByteArray,QList<quint64> > counts;
+    if( profiling == UseProfile )
+        counts = readProfile(profile.isEmpty() ? outDir.absoluteFilePath("obx.profile") : profile);
     foreach( Module* m, mods )
     {
         if( m->d_synthetic )
@@ -3936,7 +4961,35 @@ bool Obx::CGen2::translateAll(Obx::Project* pro, bool debug, const QString& wher
                 result.append(m);
                 foreach( Module* inst, result )
                 {
-                    if( !generated.contains(inst) )
+                    Module* shareWith = 0;
+                    if( !inst->d_metaActuals.isEmpty() && !generated.contains(inst) )
+                    {
+                        const QByteArray key = representationOf(inst);
+                        shareWith = representatives.value(key);
+                        if( shareWith == 0 )
+                            representatives.insert(key, inst);
+                    }
+                    if( !generated.contains(inst) && amalgamate )
+                    {
+                        generated.insert(inst);
+                        QBuffer h, b;
+                        h.open(QIODevice::WriteOnly);
+                        b.open(QIODevice::WriteOnly);
+                        if( !CGen2::translate(&h, &b, inst,debug,pro->getErrs(), true,
+                                              profiling, counts.value(ObxCGenImp::fileName(inst)), shareWith) )
+                        {
+                            qCritical() << "error generating C for" << inst->getName();
+                            return false;
+                        }
+                        headers.insert(ObxCGenImp::fileName(inst) + ".h", h.data());
+                        bodies.append(b.data());
+                    }else if( !generated.contains(inst) && upToDate.contains(inst->getName()) )
+                    {
+                        // the files of the previous run are still valid (amalgamate always regenerates all)
+                        generated.insert(inst);
+                        fout << ObxCGenImp::fileName(inst) << ".c" << endl;
+                        fout << ObxCGenImp::fileName(inst) << ".h" << endl;
+                    }else if( !generated.contains(inst) )
                     {
                         generated.insert(inst);
                         QFile b(outDir.absoluteFilePath(ObxCGenImp::fileName(inst) + ".c"));
@@ -3946,7 +4999,9 @@ bool Obx::CGen2::translateAll(Obx::Project* pro, bool debug, const QString& wher
                             if( h.open(QIODevice::WriteOnly) )
                             {
                                 //qDebug() << "generating C for" << m->getName() << "to" << f.fileName();
-                                if( !CGen2::translate(&h, &b, inst,debug,pro->getErrs()) )
+                                if( !CGen2::translate(&h, &b, inst,debug,pro->getErrs(), false,
+                                                      profiling, counts.value(ObxCGenImp::fileName(inst)),
+                                                      shareWith) )
                                 {
                                     qCritical() << "error generating C for" << inst->getName();
                                     return false;
@@ -3977,42 +5032,55 @@ bool Obx::CGen2::translateAll(Obx::Project* pro, bool debug, const QString& wher
             roots.append(ObxCGenImp::moduleRef(mods.last())); // shouldn't actually happenk
 
         QFile f(outDir.absoluteFilePath(name + ".c"));
-        if( f.open(QIODevice::WriteOnly) )
+        QBuffer mainBuf;
+        mainBuf.open(QIODevice::WriteOnly);
+        QIODevice* mainOut = amalgamate ? (QIODevice*)&mainBuf : (QIODevice*)&f;
+        if( amalgamate || f.open(QIODevice::WriteOnly) )
         {
             const Project::ModProc& mp = pro->getMain();
             if( mp.first.isEmpty() )
-                CGen2::generateMain(&f,roots, all);
+                CGen2::generateMain(mainOut,roots, all);
             else
-                CGen2::generateMain(&f,mp.first, mp.second, all);
-            fout << name << ".c" << endl;
+                CGen2::generateMain(mainOut,mp.first, mp.second, all);
+            if( !amalgamate )
+                fout << name << ".c" << endl;
         }else
             qCritical() << "could not open for writing" << f.fileName();
+
+        if( amalgamate && f.open(QIODevice::WriteOnly) )
+        {
+            headers.insert("OBX.Runtime.h", readRuntimeFile("OBX.Runtime.h"));
+            if( pro->useBuiltInOakwood() )
+                for( int i = 0; s_oakwood[i]; i++ )
+                    headers.insert(QByteArray(s_oakwood[i]) + ".h", readRuntimeFile(QByteArray(s_oakwood[i]) + ".h"));
+            QSet<QByteArray> included;
+            f.write("#define OBX_AMALGAMATED\n");
+            foreach( const QByteArray& body, bodies )
+                writeAmalgamated(&f, body, headers, included);
+            writeAmalgamated(&f, mainBuf.data(), headers, included);
+            // the runtime comes last so its local macros cannot interfere with generated identifiers
+            writeAmalgamated(&f, readRuntimeFile("OBX.Runtime.c"), headers, included);
+            fout << name << ".c" << endl;
+        }else if( amalgamate )
+            qCritical() << "could not open for writing" << f.fileName();
     }
 
     if( pro->useBuiltInOakwood() )
     {
-        copyFile(outDir,"Input.c",fout);
-        copyFile(outDir,"Input.h",fout);
-        copyFile(outDir,"Out.c",fout);
-        copyFile(outDir,"Out.h",fout);
-        copyFile(outDir,"Math.h",fout);
-        copyFile(outDir,"Math.c",fout);
-        copyFile(outDir,"MathL.h",fout);
-        copyFile(outDir,"MathL.c",fout);
-        copyFile(outDir,"In.c",fout);
-        copyFile(outDir,"In.h",fout);
-        copyFile(outDir,"Strings.h",fout);
-        copyFile(outDir,"Strings.c",fout);
-        copyFile(outDir,"Files.h",fout);
-        copyFile(outDir,"Files.c",fout);
-        copyFile(outDir,"XYplane.c",fout);
-        copyFile(outDir,"XYplane.h",fout);
+        // the Oakwood libraries stay separate translation units even if amalgamated; they have file local
+        // names and macros which would clash, and they are not on the hot paths
+        for( int i = 0; s_oakwood[i]; i++ )
+        {
+            copyFile(outDir,QByteArray(s_oakwood[i]) + ".c",fout);
+            copyFile(outDir,QByteArray(s_oakwood[i]) + ".h",fout);
+        }
 #if 0 // TODO
         copyFile(outDir,"Coroutines",fout);
 #endif
     }
     copyFile(outDir,"OBX.Runtime.h",fout);
-    copyFile(outDir,"OBX.Runtime.c",fout);
+    if( !amalgamate )
+        copyFile(outDir,"OBX.Runtime.c",fout);
 
     bout << "on Linux or Windows with GCC/MinGW or CLANG:" << endl;
     bout << "cc -O2 --std=c99 *.c -lm" << endl;
@@ -4046,7 +5114,9 @@ bool Obx::CGen2::translateAll(Obx::Project* pro, bool debug, const QString& wher
     return ok;
 }
 
-bool Obx::CGen2::translate(QIODevice* header, QIODevice* body, Obx::Module* m, bool debug, Ob::Errors* errs)
+bool Obx::CGen2::translate(QIODevice* header, QIODevice* body, Obx::Module* m, bool debug, Ob::Errors* errs,
+                           bool amalgamated, Profiling profiling, const QList<quint64>& counts,
+                           Module* shareWith)
 {
     Q_ASSERT( m != 0 && header != 0 && body != 0 );
 
@@ -4060,6 +5130,13 @@ bool Obx::CGen2::translate(QIODevice* header, QIODevice* body, Obx::Module* m, b
     imp.thisMod = m;
     //imp.emitter = e;
     imp.debug = debug;
+    imp.amalgamated = amalgamated;
+    imp.profiling = profiling;
+    imp.shareWith = shareWith;
+    imp.profCounts = counts;
+    foreach( quint64 n, counts )
+        imp.profHot = qMax(imp.profHot, n);
+    imp.profHot = qMax(imp.profHot / 10, quint64(1)); // hot if at least a tenth of the most frequent counter
     imp.h.setDevice(header);
     imp.b.setDevice(body);
 
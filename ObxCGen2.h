@@ -22,6 +22,8 @@
 
 #include <QString>
 #include <QByteArrayList>
+#include <QList>
+#include <QSet>
 class QIODevice;
 
 namespace Ob
@@ -38,8 +40,16 @@ namespace Obx
     class CGen2
     {
     public:
-        static bool translateAll(Project*, bool debug, const QString& where );
-        static bool translate(QIODevice* header, QIODevice* body, Module*, bool debug, Ob::Errors* = 0 );
+        enum Profiling { NoProfiling,
+                         Instrument, // count procedure calls and IF/CASE arms, written to a profile on exit
+                         UseProfile // optimize based on the profile written by an instrumented build
+                       };
+        static bool translateAll(Project*, bool debug, const QString& where, bool amalgamate = false,
+                                 Profiling = NoProfiling, const QString& profile = QString(),
+                                 const QSet<QByteArray>& upToDate = QSet<QByteArray>() ); // names of modules not to regenerate
+        static bool translate(QIODevice* header, QIODevice* body, Module*, bool debug, Ob::Errors* = 0,
+                              bool amalgamated = false, Profiling = NoProfiling,
+                              const QList<quint64>& counts = QList<quint64>(), Module* shareWith = 0 );
         static bool generateMain(QIODevice*, const QByteArray& callMod,
                                  const QByteArray& callFunc,
                                  const QByteArrayList& allMods );
@@ -24,11 +24,14 @@
 #include "ObxIlEmitter.h"
 #include "ObxPelibGen.h"
 #include "ObxValidator.h"
+#include "ObxLowering.h"
 #include <MonoTools/MonoMdbGen.h>
 #include <QtDebug>
 #include <QFile>
 #include <QDir>
 #include <QCryptographicHash>
+#include <QStandardPaths>
+#include <QProcess>
 #include <limits>
 using namespace Obx;
 using namespace Ob;
@@ -54,7 +57,13 @@ Q_DECLARE_METATYPE( Obx::Literal::SET )
 #define _CLI_VARARG_SUBST_PROCS_ // generated local substitution methods with the required signature instead of relying on
                                  // CLI pinvoke vararg implementation (which apparently doesn't work on all platforms/architectures).
 
-// #define _CLI_PASS_RAW_FUNCTION_POINTER // TODO
+// NOTE: values of unsafe procedure types are raw native function pointers; calls through them use calli unmanaged cdecl
+// if the signature is blittable, otherwise a delegate from GetDelegateForFunctionPointer which pins the VAR args.
+// Procedures assigned to them still go through GetFunctionPointerForDelegate, since the address of a managed method
+// obtained by ldftn cannot be called from native code.
+
+#define _CLI_CALLI_EXTERN_C_ // calls of external procedures with blittable signatures use calli unmanaged cdecl with
+                             // an entry point resolved by OBX.Runtime::resolveExtern on first use instead of pinvoke
 
 // NOTE: even though CoreCLR replaced mscorlib by System.Private.CoreLib the generated code still runs with "dotnet Main.exe",
 // but the directory with the OBX assemblies requires a Main.runtimeconfig.json file as generated below
@@ -67,6 +76,7 @@ struct ObxCilGenCollector : public AstVisitor
     QList<Record*> allRecords;
     QSet<Module*> allImports;
     QList<ProcType*> allProcTypes;
+    QSet<Record*> allPtrTargets;
     Module* thisMod;
 
     void collect(Type* t)
@@ -89,7 +99,13 @@ struct ObxCilGenCollector : public AstVisitor
             }
             break;
         case Thing::T_Pointer:
-            collect(cast<Pointer*>(t)->d_to.data());
+            {
+                Pointer* p = cast<Pointer*>(t);
+                Type* to = p->d_to.isNull() ? 0 : p->d_to->derefed();
+                if( to && to->getTag() == Thing::T_Record )
+                    allPtrTargets.insert(cast<Record*>(to));
+                collect(p->d_to.data());
+            }
             break;
         case Thing::T_ProcType:
             {
@@ -166,6 +182,87 @@ struct ObxCilGenCollector : public AstVisitor
     }
 };
 
+// A safe record is represented as a CLI value type (like a CSTRUCT) if it is never the base type of a pointer,
+// is not extended and extends nothing, has no type-bound procedures and only scalar fields or fields of such
+// records; zero initialization by initobj and copy by ldobj/stobj then exactly implement the Oberon semantics,
+// and we avoid a heap object and a '#copy' call per instance. Must see all modules of the project, because the
+// representation is also visible to importers.
+static void markValueRecords( const QList<Module*>& mods )
+{
+    QSet<Record*> ptrTargets, excluded;
+    QList<Record*> records;
+    foreach( Module* m, mods )
+    {
+        ObxCilGenCollector co;
+        m->accept(&co);
+        ptrTargets += co.allPtrTargets;
+        const bool generic = !m->d_metaParams.isEmpty();
+        foreach( Record* r, co.allRecords )
+        {
+            r->d_byValue = false;
+            if( generic )
+                excluded.insert(r);
+            else
+                records.append(r);
+        }
+        for( int i = 0; i < m->d_metaActuals.size(); i++ )
+        {
+            Type* at = m->d_metaActuals[i].d_type.isNull() ? 0 : m->d_metaActuals[i].d_type->derefed();
+            if( at && at->getTag() == Thing::T_Record )
+                excluded.insert(cast<Record*>(at));
+        }
+    }
+
+    QSet<Record*> candidates;
+    foreach( Record* r, records )
+    {
+        if( !r->d_unsafe && r->d_base.isNull() && r->d_subRecs.isEmpty() && r->d_methods.isEmpty()
+                && !ptrTargets.contains(r) && !excluded.contains(r) )
+            candidates.insert(r);
+    }
+
+    // a record only qualifies if all its record fields qualify too; iterate until stable
+    bool changed = true;
+    while( changed )
+    {
+        changed = false;
+        foreach( Record* r, candidates )
+        {
+            foreach( const Ref<Field>& f, r->d_fields )
+            {
+                Type* ft = f->d_type.isNull() ? 0 : f->d_type->derefed();
+                bool ok = false;
+                if( ft )
+                {
+                    switch( ft->getTag() )
+                    {
+                    case Thing::T_BaseType:
+                        ok = ft->getBaseType() != Type::ANY;
+                        break;
+                    case Thing::T_Enumeration:
+                    case Thing::T_Pointer:
+                    case Thing::T_ProcType:
+                        ok = true;
+                        break;
+                    case Thing::T_Record:
+                        ok = candidates.contains(cast<Record*>(ft));
+                        break;
+                    }
+                }
+                if( !ok )
+                {
+                    candidates.remove(r);
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    foreach( Record* r, candidates )
+        r->d_byValue = true;
+}
+
 struct CilGenTempPool
 {
     enum { MAX_TEMP = 250 };
@@ -238,11 +335,14 @@ struct ObxCilGenImp : public AstVisitor
     QList<int> exitJump;
     Procedure* scope;
     int suppressLine;
+    QSet<Statement*> tailCalls; // of the current procedure, see Lowering::findTailCalls
+    int tailStart; // label where a self tail call restarts the body, or -1
+    bool tailPrefix; // the next emitCall is a tail call
 
     ObxCilGenImp():ownsErr(false),err(0),thisMod(0),anonymousDeclNr(1),level(0),
         scope(0),forceAssemblyPrefix(false),forceFormalIndex(false),
         suppressLine(0),debug(false),checkPtrSize(false),
-        arrayAsElementType(false),structAsPointer(false)
+        arrayAsElementType(false),structAsPointer(false),tailStart(-1),tailPrefix(false)
     {
     }
 
@@ -582,6 +682,16 @@ struct ObxCilGenImp : public AstVisitor
             switch( et->getTag() )
             {
             case Thing::T_Record:
+                if( et->d_byValue )
+                {
+                    emitter->ldarg_(0);
+                    emitter->ldloc_(idx);
+                    emitter->ldarg_(1);
+                    emitter->ldloc_(idx);
+                    // stack: lhs array, int, rhs array, int
+                    emitter->ldelem_(formatType(et));
+                    emitter->stelem_(formatType(et));
+                }else
                 {
                     emitter->ldarg_(0);
                     emitter->ldloc_(idx);
@@ -596,8 +706,6 @@ struct ObxCilGenImp : public AstVisitor
                     // stack: lhs record, rhs record
                     Record* r2 = cast<Record*>(et);
                     QByteArray type = formatType(r2);
-                    if( r2->d_byValue )
-                        type += "&";
                     emitter->callvirt_("void " + classRef(r2) + formatMetaActuals(r2) +
                                         "::'#copy'(" + type + ")", 1 );
                }
@@ -642,9 +750,6 @@ struct ObxCilGenImp : public AstVisitor
         emitter->endMethod();
     }
 
-//#define _USE_VALUE_RECORDS_
-    // no value records currently because the initialization works completely different; needs extra work
-
     void allocRecordDecl(Record* r)
     {
         if( r->d_slotValid )
@@ -673,18 +778,14 @@ struct ObxCilGenImp : public AstVisitor
         }else
         {
             isPublic = n->d_scope == thisMod && n->d_visibility == Named::ReadWrite;
-#ifdef _USE_VALUE_RECORDS_
-            r->d_byValue = !isPublic && r->d_baseRec == 0 && r->d_subRecs.isEmpty();
-#else
-            r->d_byValue = false;
-#endif
+            // r->d_byValue was already set by markValueRecords
             className = nestedPath(n); // because of records declared in procedures are lifted to module level
             if( !r->d_base.isNull() )
                 superClassName = formatType(r->d_base.data());
-            else if(!r->d_unsafe) // unsafe rec has no basetype
+            else if(!r->d_unsafe && !r->d_byValue) // unsafe and value rec have no basetype
                 superClassName = "[OBX.Runtime]OBX.Anyrec";
         }
-        emitter->beginClass(className, isPublic, r->d_unsafe ? IlEmitter::Value : IlEmitter::Object,
+        emitter->beginClass(className, isPublic, r->d_unsafe || r->d_byValue ? IlEmitter::Value : IlEmitter::Object,
                             superClassName, r->d_unsafe ? r->getByteSize() : -1 );
 
         foreach( const Ref<Field>& f, r->d_fields )
@@ -697,7 +798,7 @@ struct ObxCilGenImp : public AstVisitor
 
         QList<Field*> fields = r->getOrderedFields();
         // default constructor
-        if( !r->d_unsafe ) // unsafe records use initobj; no constructor is called for unsafe records
+        if( !r->d_unsafe && !r->d_byValue ) // unsafe and value records use initobj; no constructor is called for them
         {
             emitter->beginMethod(".ctor",true);
             beginBody();
@@ -707,9 +808,7 @@ struct ObxCilGenImp : public AstVisitor
             {
                 Q_ASSERT( !r->d_unsafe );
                 what = "void class " + classRef(r->d_baseRec) + formatMetaActuals(r->d_baseRec) + "::.ctor()";
-            }else if( r->d_byValue )
-                what = "void [mscorlib]System.ValueType::.ctor()";
-            else
+            }else
                 what = "void [OBX.Runtime]OBX.Anyrec::.ctor()";
             line(r->d_loc).call_(what,1,false,true);
 
@@ -731,12 +830,10 @@ struct ObxCilGenImp : public AstVisitor
         }
 
         // copy
-        if( !r->d_unsafe )
+        if( !r->d_unsafe && !r->d_byValue ) // unsafe and value records are copied with cpblk or ldobj/stobj
         {
             emitter->beginMethod("'#copy'",true, IlEmitter::Virtual);
             QByteArray type = formatType(r);
-            if( r->d_byValue )
-                type += "&";
             emitter->addArgument(type, "rhs");
             beginBody();
             if( r->d_baseRec )
@@ -744,10 +841,7 @@ struct ObxCilGenImp : public AstVisitor
                 line(r->d_loc).ldarg_(0);
                 line(r->d_loc).ldarg_(1);
                 QByteArray what = "void class " + classRef(r->d_baseRec) + formatMetaActuals(r->d_baseRec) + "::'#copy'(";
-                type = formatType(r->d_baseRec);
-                if( r->d_byValue )
-                    type += "&";
-                what += type + ")";
+                what += formatType(r->d_baseRec) + ")";
                 line(r->d_loc).call_(what,1,false,true);
             }
             for( int i = 0; i < fields.size(); i++ )
@@ -756,6 +850,15 @@ struct ObxCilGenImp : public AstVisitor
                 switch( ft->getTag() )
                 {
                 case Thing::T_Record:
+                    if( ft->d_byValue )
+                    {
+                        line(r->d_loc).ldarg_(0);
+                        line(r->d_loc).ldflda_(memberRef(fields[i]));
+                        line(r->d_loc).ldarg_(1);
+                        line(r->d_loc).ldflda_(memberRef(fields[i]));
+                        line(r->d_loc).ldobj_(formatType(ft));
+                        line(r->d_loc).stobj_(formatType(ft));
+                    }else
                     {
                         line(r->d_loc).ldarg_(0);
                         line(r->d_loc).ldfld_(memberRef(fields[i]));
@@ -763,10 +866,7 @@ struct ObxCilGenImp : public AstVisitor
                         line(r->d_loc).ldfld_(memberRef(fields[i]));
                         Record* r2 = cast<Record*>(ft);
                         QByteArray what = "void " + classRef(r2) + formatMetaActuals(r2) + "::'#copy'(";
-                        type = formatType(r2);
-                        if( r2->d_byValue )
-                            type += "&";
-                        what += type + ")";
+                        what += formatType(r2) + ")";
                         line(r->d_loc).callvirt_(what,1);
                     }
                     break;
@@ -920,6 +1020,17 @@ struct ObxCilGenImp : public AstVisitor
         foreach( Procedure* p, co.allProcs )
             p->accept(this);
 
+#ifdef _CLI_CALLI_EXTERN_C_
+        if( me->d_externC )
+        {
+            foreach( Procedure* p, co.allProcs )
+            {
+                if( isBlittable(p) )
+                    emitExternResolver(p);
+            }
+        }
+#endif
+
         if( !me->d_externC )
         {
             // instead of .cctor we now have an ordinary begïn method which is explicitly called via import
@@ -1124,8 +1235,8 @@ struct ObxCilGenImp : public AstVisitor
         case Thing::T_ProcType:
             {
                 ProcType* pt = cast<ProcType*>(t);
-                if( unsafe )
-                    return "native int";
+                if( unsafe || pt->d_unsafe )
+                    return "native int"; // raw function pointer, see prepareRhs
                 else
                     return "class " + delegateRef(pt);
             }
@@ -1159,7 +1270,7 @@ struct ObxCilGenImp : public AstVisitor
             }
             break;
         case Thing::T_Record:
-            return ( t->d_unsafe ? "valuetype " : "class " ) + classRef(cast<Record*>(t))
+            return ( t->d_unsafe || t->d_byValue ? "valuetype " : "class " ) + classRef(cast<Record*>(t))
                     + formatMetaActuals(t)
 #ifdef _CLI_DYN_STRUCT_VARIABLES_
                     + ( t->d_unsafe && structAsPointer ? "*" : "" )
@@ -1332,7 +1443,7 @@ struct ObxCilGenImp : public AstVisitor
                 if( i != 0 )
                     res += ", ";
                 res += formatType( pt->d_nonLocals[i]->d_type.data() );
-                if( !isReferenceType(pt->d_nonLocals[i]->d_type.data()) )
+                if( !isReferenceType(pt->d_nonLocals[i]->d_type.data()) && !pt->d_nonLocals[i]->d_upvalReadOnly )
                     res += "&";
                 if( withName )
                     res += " " + escape(pt->d_nonLocals[i]->d_name);
@@ -1348,6 +1459,132 @@ struct ObxCilGenImp : public AstVisitor
             emitter->addLocal( temps.d_types[i], escape("#temp" + QByteArray::number(i) ) );
     }
 
+    static void externName( Procedure* me, QByteArray& dll, QByteArray& useName )
+    {
+        // useName remains empty if the C name is the name of the procedure
+        Module* mod = me->getModule();
+        QByteArray prefix, alias;
+        SysAttr* a = mod->d_sysAttrs.value("dll").data();
+        if( a && a->d_values.size() == 1 )
+            dll = a->d_values.first().toByteArray() + ".dll";
+        a = mod->d_sysAttrs.value("prefix").data(); // module attr
+        if( a && a->d_values.size() == 1 )
+            prefix = a->d_values.first().toByteArray();
+        a = me->d_sysAttrs.value("dll").data(); // proc attr
+        if( a && a->d_values.size() == 1 )
+            dll = a->d_values.first().toByteArray();
+        a = me->d_sysAttrs.value("prefix").data(); // proc attr
+        if( a && a->d_values.size() == 1 )
+            prefix = a->d_values.first().toByteArray();
+        a = me->d_sysAttrs.value("alias").data(); // proc attr
+        if( a && a->d_values.size() == 1 )
+            alias = a->d_values.first().toByteArray();
+        if( !alias.isEmpty() )
+            useName = alias;
+        else if( !prefix.isEmpty() )
+            useName = prefix + me->d_name;
+    }
+
+    static bool isBlittable( Type* t )
+    {
+        // true if the value has the same representation in CLI and C, so pinvoke would not marshal it
+        Type* td = derefed(t);
+        if( td == 0 )
+            return false;
+        switch( td->getTag() )
+        {
+        case Thing::T_BaseType:
+            switch( td->getBaseType() )
+            {
+            case Type::BOOLEAN:
+            case Type::CHAR: // both uint8 in unsafe signatures
+            case Type::BYTE:
+            case Type::INT8:
+            case Type::INT16:
+            case Type::INT32:
+            case Type::INT64:
+            case Type::REAL:
+            case Type::LONGREAL:
+            case Type::SET:
+                return true;
+            default:
+                return false; // WCHAR is a CLI char which pinvoke marshals to an ANSI char
+            }
+        case Thing::T_Enumeration:
+            return true;
+        case Thing::T_Pointer:
+        case Thing::T_ProcType:
+            return td->d_unsafe; // native pointers; safe ones are object references or delegates
+        default:
+            return false; // records and arrays by value are left to pinvoke
+        }
+    }
+
+    static bool isBlittable( Procedure* p )
+    {
+        // true if the external procedure can be called by calli unmanaged cdecl without any marshalling
+        Module* mod = p->getModule();
+        if( mod == 0 || !mod->d_externC || !p->d_sysAttrs.value("varargs").isNull() )
+            return false;
+        QByteArray dll, useName;
+        externName(p, dll, useName);
+        if( dll.isEmpty() )
+            return false;
+        return isBlittable(p->getProcType());
+    }
+
+    static bool isBlittable( ProcType* pt )
+    {
+        // true if a native procedure of this signature can be called by calli unmanaged cdecl without any marshalling
+        if( !pt->d_unsafe || !pt->d_nonLocals.isEmpty() )
+            return false;
+        if( !pt->d_return.isNull() && !isBlittable(pt->d_return.data()) )
+            return false;
+        foreach( const Ref<Parameter>& f, pt->d_formals )
+        {
+            // VAR parameters are managed references, which the garbage collector could move during the call
+            if( f->d_var || !isBlittable(f->d_type.data()) )
+                return false;
+        }
+        return true;
+    }
+
+    void emitExternResolver( Procedure* me )
+    {
+        // the entry point is looked up on the first call and then cached in a static field of the module class
+        QByteArray dll, useName;
+        externName(me, dll, useName);
+        if( useName.isEmpty() )
+            useName = me->d_name;
+        emitter->addField(escape(me->d_name + "#fn"), "native int", true, true);
+        emitter->beginMethod(escape(me->d_name + "#resolve"), true, IlEmitter::Static );
+        emitter->setReturnType("native int");
+        line(me->d_loc).ldtoken_("class " + moduleRef(thisMod)); // the dllmap is looked up in the config of its assembly
+        line(me->d_loc).call_("class [mscorlib]System.Type [mscorlib]System.Type::GetTypeFromHandle("
+                              "valuetype [mscorlib]System.RuntimeTypeHandle)",1,true);
+        line(me->d_loc).ldstr_("\"" + dll + "\"");
+        line(me->d_loc).ldstr_("\"" + useName + "\"");
+        line(me->d_loc).call_("native int [OBX.Runtime]OBX.Runtime::resolveExtern(class [mscorlib]System.Type,string,string)",
+                              3, true );
+        line(me->d_loc).dup_();
+        line(me->d_loc).stsfld_("native int " + moduleRef(thisMod) + "::" + escape(me->d_name + "#fn"));
+        line(me->d_loc).ret_(true);
+        emitter->endMethod();
+    }
+
+    void emitFetchExternFn( Procedure* p, const RowCol& loc )
+    {
+        // stack: args -> args, fn
+        const QByteArray mod = moduleRef(p->getModule());
+        const int resolved = emitter->newLabel();
+        line(loc).ldsfld_("native int " + mod + "::" + escape(p->d_name + "#fn"));
+        line(loc).dup_();
+        line(loc).brtrue_(resolved);
+        line(loc).pop_();
+        line(loc).call_("native int " + mod + "::" + escape(p->d_name + "#resolve") + "()", 0, true );
+        line(loc).label_(resolved);
+    }
+
     void emitProcedure( Procedure* me, const QByteArray& prefix = QByteArray(),
                         const QList<Type*>& extraArgs = QList<Type*>() )
     {
@@ -1376,30 +1613,11 @@ struct ObxCilGenImp : public AstVisitor
         bool isVararg = false;
         if( mod->d_externC )
         {
-            QByteArray dll, prefix, alias;
-            SysAttr* a = mod->d_sysAttrs.value("dll").data();
-            if( a && a->d_values.size() == 1 )
-                dll = a->d_values.first().toByteArray() + ".dll";
-            a = mod->d_sysAttrs.value("prefix").data(); // module attr
-            if( a && a->d_values.size() == 1 )
-                prefix = a->d_values.first().toByteArray();
-            a = me->d_sysAttrs.value("dll").data(); // proc attr
-            if( a && a->d_values.size() == 1 )
-                dll = a->d_values.first().toByteArray();
-            a = me->d_sysAttrs.value("prefix").data(); // proc attr
-            if( a && a->d_values.size() == 1 )
-                prefix = a->d_values.first().toByteArray();
-            a = me->d_sysAttrs.value("alias").data(); // proc attr
-            if( a && a->d_values.size() == 1 )
-                alias = a->d_values.first().toByteArray();
+            QByteArray dll, useName;
+            externName(me, dll, useName);
             isVararg = !me->d_sysAttrs.value("varargs").isNull(); // proc attr
-            QByteArray useName;
-            if( !extraArgs.isEmpty() )
+            if( !extraArgs.isEmpty() && useName.isEmpty() )
                 useName = me->d_name;
-            if( !alias.isEmpty() )
-                useName = alias;
-            else if( !prefix.isEmpty() )
-                useName = prefix + me->d_name;
             emitter->setPinvoke(dll,useName);
             //qDebug() << "*EXPORT*" << ( useName.isEmpty() ? me->d_name : useName );
         }
@@ -1442,7 +1660,7 @@ struct ObxCilGenImp : public AstVisitor
             for( int i = 0; i < pt->d_nonLocals.size(); i++ )
             {
                 QByteArray type = formatType(pt->d_nonLocals[i]->d_type.data());
-                if( !isReferenceType(pt->d_nonLocals[i]->d_type.data()) )
+                if( !isReferenceType(pt->d_nonLocals[i]->d_type.data()) && !pt->d_nonLocals[i]->d_upvalReadOnly )
                     type += "&";
                 emitter->addArgument(type,escape(pt->d_nonLocals[i]->d_name));
             }
@@ -1460,6 +1678,24 @@ struct ObxCilGenImp : public AstVisitor
 
         beginBody(me->d_varCount);
 
+        tailCalls.clear();
+        tailStart = -1;
+        if( extraArgs.isEmpty() )
+            tailCalls = Lowering::findTailCalls(me);
+        if( Lowering::canLoop(me) )
+        {
+            foreach( Statement* s, tailCalls )
+            {
+                if( Lowering::calledProc(Lowering::callOf(s)) == me )
+                {
+                    // the locals are initialized again when a self tail call restarts the body
+                    tailStart = emitter->newLabel();
+                    line(me->d_loc).label_(tailStart);
+                    break;
+                }
+            }
+        }
+
         foreach( const Ref<Named>& n, me->d_order )
         {
             switch( n->getTag() )
@@ -1486,6 +1722,8 @@ struct ObxCilGenImp : public AstVisitor
         emitLocalVars();
 
         emitter->endMethod();
+        tailCalls.clear();
+        tailStart = -1;
     }
 
     void visit( Procedure* me )
@@ -1665,7 +1903,7 @@ struct ObxCilGenImp : public AstVisitor
             break;
         case Thing::T_Pointer:
         case Thing::T_ProcType:
-            if( unsafe )
+            if( unsafe || ( td->getTag() == Thing::T_ProcType && td->d_unsafe ) )
                 line(loc).ldind_(IlEmitter::IntPtr);
             else
                 line(loc).ldind_(IlEmitter::Ref);
@@ -1750,7 +1988,8 @@ struct ObxCilGenImp : public AstVisitor
                 const int pos = pt->d_nonLocals.indexOf(id);
                 Q_ASSERT(pos >= 0);
                 line(me->d_loc).ldarg_(pt->d_formals.size()+pos);
-                emitValueFromAdrToStack(id->d_type.data(),false,me->d_loc);
+                if( !id->d_upvalReadOnly ) // otherwise we already have the value
+                    emitValueFromAdrToStack(id->d_type.data(),false,me->d_loc);
             }
             return;
         case Thing::T_Parameter:
@@ -1767,7 +2006,8 @@ struct ObxCilGenImp : public AstVisitor
                 const int pos = pt->d_nonLocals.indexOf(id);
                 Q_ASSERT(pos >= 0);
                 line(me->d_loc).ldarg_(pt->d_formals.size()+pos);
-                emitValueFromAdrToStack(id->d_type.data(),false,me->d_loc);
+                if( !id->d_upvalReadOnly ) // otherwise we already have the value
+                    emitValueFromAdrToStack(id->d_type.data(),false,me->d_loc);
             }
             return;
         case Thing::T_NamedType:
@@ -1858,7 +2098,9 @@ struct ObxCilGenImp : public AstVisitor
             }
             line(me->d_loc).add_();
             emitValueFromAdrToStack(et,true,me->d_loc);
-        }else
+        }else if( isValueRecord(et) )
+            line(me->d_loc).ldelema_(formatType(et)); // like all value records, the element is accessed by address
+        else
             line(me->d_loc).ldelem_(formatType(et));
     }
 
@@ -1971,7 +2213,10 @@ struct ObxCilGenImp : public AstVisitor
                     ProcType* pt = scope->getProcType();
                     const int pos = pt->d_nonLocals.indexOf(n);
                     Q_ASSERT(pos >= 0);
-                    line(desig->d_loc).ldarg_(pt->d_formals.size()+pos); // it's already the address
+                    if( n->d_upvalReadOnly )
+                        line(desig->d_loc).ldarga_(pt->d_formals.size()+pos); // the address of the copy
+                    else
+                        line(desig->d_loc).ldarg_(pt->d_formals.size()+pos); // it's already the address
                 }
                 break;
             case Thing::T_LocalVar:
@@ -1988,7 +2233,10 @@ struct ObxCilGenImp : public AstVisitor
                     ProcType* pt = scope->getProcType();
                     const int pos = pt->d_nonLocals.indexOf(n);
                     Q_ASSERT(pos >= 0);
-                    line(desig->d_loc).ldarg_(pt->d_formals.size()+pos);
+                    if( n->d_upvalReadOnly )
+                        line(desig->d_loc).ldarga_(pt->d_formals.size()+pos); // the address of the copy
+                    else
+                        line(desig->d_loc).ldarg_(pt->d_formals.size()+pos);
                     // arg is the address of the original local
                 }
                 break;
@@ -2197,6 +2445,32 @@ struct ObxCilGenImp : public AstVisitor
             break;
         case BuiltIn::INC:
         case BuiltIn::DEC:
+            if( !Lowering::isSimple(ae->d_args.first().data()) &&
+                    derefed(ae->d_args.first()->d_type.data())->isInteger() )
+            {
+                // read-modify-write with the address of the designator evaluated only once
+                Type* td = derefed(ae->d_args.first()->d_type.data());
+                const bool unsafe = emitFetchDesigAddr(ae->d_args.first().data());
+                line(ae->d_loc).dup_();
+                emitValueFromAdrToStack(td, unsafe, ae->d_loc);
+                if( ae->d_args.size() == 1 )
+                {
+                    if( td->getBaseType() == Type::INT64 )
+                        line(ae->d_loc).ldc_i8(1);
+                    else
+                        line(ae->d_loc).ldc_i4(1);
+                }else
+                {
+                    Q_ASSERT( ae->d_args.size() == 2 );
+                    ae->d_args.last()->accept(this);
+                    convertTo(td->getBaseType(), ae->d_args.last()->d_type.data(), ae->d_loc);
+                }
+                if( bi->d_func == BuiltIn::INC )
+                    line(ae->d_loc).add_();
+                else
+                    line(ae->d_loc).sub_();
+                line(ae->d_loc).stind_(toIndType(td));
+            }else
             {
                 Ref<BinExpr> add = new BinExpr();
                 add->d_lhs = ae->d_args.first();
@@ -2360,20 +2634,47 @@ struct ObxCilGenImp : public AstVisitor
                 }
             }else if( ae->d_args.size() == 2 )
             {
-                ae->d_args.first()->accept(this);
-                ae->d_args.last()->accept(this);
-                const int posCase = emitter->newLabel();
-                if( bi->d_func == BuiltIn::MAX )
-                    line(ae->d_loc).bge_(posCase);
-                else
-                    line(ae->d_loc).ble_(posCase); // if
-                ae->d_args.last()->accept(this); // then // TODO: use temps to avoid multiple evaluation
-
-                const int toEnd = emitter->newLabel();
-                line(ae->d_loc).br_(toEnd);
-                line(ae->d_loc).label_(posCase);
-                ae->d_args.first()->accept(this); // else
-                line(ae->d_loc).label_(toEnd);
+                if( Lowering::isSimple(ae->d_args.first().data()) && Lowering::isSimple(ae->d_args.last().data()) )
+                {
+                    ae->d_args.first()->accept(this);
+                    ae->d_args.last()->accept(this);
+                    const int posCase = emitter->newLabel();
+                    if( bi->d_func == BuiltIn::MAX )
+                        line(ae->d_loc).bge_(posCase);
+                    else
+                        line(ae->d_loc).ble_(posCase); // if
+                    ae->d_args.last()->accept(this); // then
+
+                    const int toEnd = emitter->newLabel();
+                    line(ae->d_loc).br_(toEnd);
+                    line(ae->d_loc).label_(posCase);
+                    ae->d_args.first()->accept(this); // else
+                    line(ae->d_loc).label_(toEnd);
+                }else
+                {
+                    // each argument is evaluated only once
+                    const int lhs = temps.buy(formatType(ae->d_args.first()->d_type->derefed()));
+                    const int rhs = temps.buy(formatType(ae->d_args.last()->d_type->derefed()));
+                    ae->d_args.first()->accept(this);
+                    line(ae->d_loc).stloc_(lhs);
+                    ae->d_args.last()->accept(this);
+                    line(ae->d_loc).stloc_(rhs);
+                    line(ae->d_loc).ldloc_(lhs);
+                    line(ae->d_loc).ldloc_(rhs);
+                    const int posCase = emitter->newLabel();
+                    if( bi->d_func == BuiltIn::MAX )
+                        line(ae->d_loc).bge_(posCase);
+                    else
+                        line(ae->d_loc).ble_(posCase); // if
+                    line(ae->d_loc).ldloc_(rhs); // then
+                    const int toEnd = emitter->newLabel();
+                    line(ae->d_loc).br_(toEnd);
+                    line(ae->d_loc).label_(posCase);
+                    line(ae->d_loc).ldloc_(lhs); // else
+                    line(ae->d_loc).label_(toEnd);
+                    temps.sell(lhs);
+                    temps.sell(rhs);
+                }
                 // TODO stackDepth--; // correct for alternative
             }else
                 Q_ASSERT( false );
@@ -2383,7 +2684,7 @@ struct ObxCilGenImp : public AstVisitor
                 Q_ASSERT( !ae->d_args.isEmpty() && !ae->d_args.first()->d_type.isNull() );
                 Expression* e = ae->d_args.first().data();
                 if( !emitInitializer(e->d_type.data(),false,e->d_loc) )
-                    line(ae->d_loc).ldnull_();
+                    emitNil(e->d_type.data(),ae->d_loc);
             }
             break;
         case BuiltIn::LEN:
@@ -2846,16 +3147,52 @@ struct ObxCilGenImp : public AstVisitor
         return !isReferenceType(p->d_type.data());
     }
 
+    static inline bool isValueRecord( Type* t )
+    {
+        // the value of a designator of such a record on the stack is its address
+        Type* td = derefed(t);
+        return td && td->getTag() == Thing::T_Record && ( td->d_unsafe || td->d_byValue );
+    }
+
     static inline bool isReferenceType( Type* t )
     {
         Type* td = derefed(t);
-        if( td && td->isStructured() && !td->d_unsafe )
+        if( td && td->isStructured() && !td->d_unsafe && !td->d_byValue )
             return true;
         else
             return false;
     }
 
-    void preparePinnedArray( Type* t, const RowCol& loc )
+    static inline bool isRawFunctionPointer( Type* t )
+    {
+        Type* td = derefed(t);
+        return td && td->getTag() == Thing::T_ProcType && td->d_unsafe;
+    }
+
+    void emitNil( Type* t, const RowCol& loc )
+    {
+        // NIL is a null object reference, except for raw function pointers which are native ints
+        if( isRawFunctionPointer(t) )
+        {
+            line(loc).ldc_i4(0);
+            line(loc).conv_(IlEmitter::ToI);
+        }else
+            line(loc).ldnull_();
+    }
+
+    void emitRhs( Type* tf, Expression* ea, const RowCol& loc )
+    {
+        Type* ta = derefed(ea->d_type.data());
+        if( ta && ta->getBaseType() == Type::NIL )
+            emitNil(tf, loc);
+        else
+        {
+            ea->accept(this);
+            prepareRhs( tf, ea, loc );
+        }
+    }
+
+    void preparePinnedArray( Type* t, const RowCol& loc, bool readOnly = false )
     {
         // https://docs.microsoft.com/en-us/dotnet/framework/interop/copying-and-pinning
         // https://codereview.stackexchange.com/questions/158035/pin-an-array-in-memory-and-construct-a-bitmap-using-that-buffer
@@ -2880,7 +3217,7 @@ struct ObxCilGenImp : public AstVisitor
         if( td->isText(&wide) && !wide )
         {
             int slot1 = -1;
-            if( !td->isString() )
+            if( !td->isString() && !readOnly ) // IN parameters cannot be changed, so there is nothing to write back
             {
                 slot1 = temps.buy("char[]");
                 line(loc).dup_();
@@ -2937,6 +3274,8 @@ struct ObxCilGenImp : public AstVisitor
     void emitCall( ArgExpr* me )
     {
         Q_ASSERT( me->d_sub );
+        const bool tail = tailPrefix; // not for the calls in the args
+        tailPrefix = false;
         me->d_sub->accept(this);
 
         Named* func = 0;
@@ -2974,6 +3313,28 @@ struct ObxCilGenImp : public AstVisitor
         ProcType* pt = cast<ProcType*>( subT );
         Q_ASSERT( pt->d_formals.size() <= me->d_args.size() );
 
+        int fnPtr = -1;
+        if( func == 0 && pt->d_unsafe )
+        {
+            if( isBlittable(pt) )
+            {
+                // the raw function pointer is called by calli, which expects it after the args
+                fnPtr = temps.buy("native int");
+                line(me->d_loc).stloc_(fnPtr);
+            }else
+            {
+                // calli would pass VAR args as unpinned managed references; the marshalling stub of a delegate
+                // for the raw function pointer pins them during the call and converts the other args
+                const QByteArray deleg = "class " + delegateRef(pt);
+                line(me->d_loc).ldtoken_(deleg);
+                line(me->d_loc).call_("class [mscorlib]System.Type [mscorlib]System.Type::GetTypeFromHandle("
+                                      "valuetype [mscorlib]System.RuntimeTypeHandle)",1,true);
+                line(me->d_loc).call_("class [mscorlib]System.Delegate [mscorlib]System.Runtime.InteropServices."
+                                      "Marshal::GetDelegateForFunctionPointer(native int,class [mscorlib]System.Type)",2,true);
+                line(me->d_loc).castclass_(deleg);
+            }
+        }
+
 #if 0
         if( func == 0 || pt->d_typeBound )
             Q_ASSERT( stackDepth == before + 1 ); // self or delegate instance expected
@@ -3010,11 +3371,10 @@ struct ObxCilGenImp : public AstVisitor
                 // 2) or a structured arg passed to IN, i.e. just pass the reference
                 // 3) or a non-structured arg passed by IN or by val, just pass the value in both cases
                 // NOTE that in case of 1) the copy is done in the body of the called procedure
-                me->d_args[i]->accept(this);
-                prepareRhs( tf, me->d_args[i].data(), me->d_args[i]->d_loc );
+                emitRhs( tf, me->d_args[i].data(), me->d_args[i]->d_loc );
 
                 if( pt->d_unsafe && ftag == Thing::T_Pointer && tf->d_unsafe )
-                    preparePinnedArray(me->d_args[i]->d_type.data(),me->d_args[i]->d_loc);
+                    preparePinnedArray(me->d_args[i]->d_type.data(),me->d_args[i]->d_loc, p->d_const);
             }
         }
 
@@ -3038,7 +3398,7 @@ struct ObxCilGenImp : public AstVisitor
             Q_ASSERT(func && !pt->d_typeBound && scope && varargs.isEmpty());
             foreach( Named* nl, pt->d_nonLocals )
             {
-                // non-local locals/params are passed by var param
+                // non-local locals/params are passed by var param, or by value if nobody modifies them
                 if( nl->d_scope == scope )
                 {
                     // here we are at the source of the local/param
@@ -3049,7 +3409,10 @@ struct ObxCilGenImp : public AstVisitor
                     id.d_type = nl->d_type.data();
                     id.d_loc = me->d_loc;
 
-                    emitFetchDesigAddr(&id);
+                    if( nl->d_upvalReadOnly )
+                        id.accept(this);
+                    else
+                        emitFetchDesigAddr(&id);
                 }else
                 {
                     // here we just pass on the non-local access
@@ -3071,17 +3434,35 @@ struct ObxCilGenImp : public AstVisitor
             }
         }
 
+#ifdef _CLI_CALLI_EXTERN_C_
+        if( func && func->getTag() == Thing::T_Procedure && varargs.isEmpty() && isBlittable(cast<Procedure*>(func)) )
+        {
+            emitFetchExternFn(cast<Procedure*>(func), me->d_loc);
+            if( tail )
+                line(me->d_loc).tail_();
+            line(me->d_loc).calli_(formatType(pt->d_return.data(), true) + formatFormals(pt,false),
+                                   pt->d_formals.size(),!pt->d_return.isNull());
+        }else
+#endif
         if( func )
         {
+            if( tail )
+                line(me->d_loc).tail_();
             if( pt->d_typeBound && !superCall )
                 line(me->d_loc).callvirt_(memberRef(func),pt->d_formals.size(),!pt->d_return.isNull()); // we dont support virtual funcs with varargs
             else
                 line(me->d_loc).call_(memberRef(func,varargs),pt->d_formals.size(),!pt->d_return.isNull());
+        }else if( fnPtr >= 0 )
+        {
+            line(me->d_loc).ldloc_(fnPtr);
+            temps.sell(fnPtr);
+            line(me->d_loc).calli_(formatType(pt->d_return.data(), true) + formatFormals(pt,false),
+                                   pt->d_formals.size(),!pt->d_return.isNull());
         }else
         {
             QByteArray ret = formatType(pt->d_return.data(), pt->d_unsafe);
             if( pt->d_unsafe )
-                ret += " modopt([mscorlib]System.Runtime.CompilerServices.CallConvCdecl)";
+                ret += " modopt([mscorlib]System.Runtime.CompilerServices.CallConvCdecl)"; // see emitDelegDecl
             const QByteArray what = ret + " " + delegateRef(pt) + "::Invoke"
                 + formatFormals(pt,false); // we don't support callbacks with varargs
 
@@ -3091,7 +3472,7 @@ struct ObxCilGenImp : public AstVisitor
         releasePinnedArrays(me->d_loc);
 
         Type* rt = derefed(pt->d_return.data());
-        if( rt && rt->d_unsafe && rt->getTag() == Thing::T_Record )
+        if( isValueRecord(rt) )
         {
             // we need the address of the value so we need to store it in a temp
             const int temp = temps.buy(formatType(pt->d_return.data(),pt->d_unsafe));
@@ -3133,7 +3514,6 @@ struct ObxCilGenImp : public AstVisitor
                     line(loc).dup_(); // stack: this, this
                     line(loc).ldvirtftn_(memberRef(n)); // stack: this, fn
                     line(loc).newobj_("void class " + delegateRef(pt) + "::.ctor(object, native int)", 2 );
-#ifndef _CLI_PASS_RAW_FUNCTION_POINTER
                 }else
                 {
                     // assign a normal procedure to a normal proc type variable
@@ -3141,19 +3521,8 @@ struct ObxCilGenImp : public AstVisitor
                     line(loc).ldftn_(memberRef(n));
                     line(loc).newobj_("void class " + delegateRef(pt) + "::.ctor(object, native int)",2);
                 }
-#else
-                }else if( tfd == 0 || !tfd->d_unsafe )
-                {
-                    // assign a normal procedure to a normal proc type variable
-                    line(loc).ldnull_();
-                    line(loc).ldftn_(memberRef(n));
-                    line(loc).newobj_("void class " + delegateRef(pt) + "::.ctor(object, native int)",2);
-                }else
-                    line(loc).ldftn_(memberRef(n));
-#endif
             }//else: we copy a proc type variable, i.e. delegate already exists
 
-#ifndef _CLI_PASS_RAW_FUNCTION_POINTER
             if( tfd->d_unsafe && ( rhsIsProc && ( !ta->d_unsafe || tfd == ta ) ) )
             {
                 // we assign a newly created or existing deleg to an unsafe proc pointer
@@ -3165,13 +3534,12 @@ struct ObxCilGenImp : public AstVisitor
 
             if( tfd->d_unsafe && ( !ta->d_unsafe || rhsIsProc ) && ta->getBaseType() != Type::NIL )
                 line(loc).call_("native int [mscorlib]System.Runtime.InteropServices.Marshal::GetFunctionPointerForDelegate(class [mscorlib]System.Delegate)",1,true);
-#endif
             if( !tfd->d_unsafe && ta->d_unsafe && !rhsIsProc )
                 // TODO consider Marshal.GetDelegateForFunctionPointer(IntPtr, Type) if rhsIsProc and unsafe
                 err->error(Errors::Generator, Loc(loc,thisMod->d_file), "assignment of unsafe to a safe procedure pointer is not supported");
 
-        }else if( tfd->d_unsafe && tagf == Thing::T_Record )
-            line(loc).ldobj_(formatType(tf)); // the formal requires a cstruct by value, so we fetch it
+        }else if( isValueRecord(tfd) )
+            line(loc).ldobj_(formatType(tf)); // the formal requires a cstruct or value record by value, so we fetch it
         else if( tagf == Thing::T_BaseType )
         {
             convertTo(tfd->getBaseType(), ta, ea->d_loc, debug && tfd->isInteger() ); // with overflow check for ints when debugging
@@ -3404,7 +3772,10 @@ struct ObxCilGenImp : public AstVisitor
         Type* targetT = derefed(me->d_type.data());
         Q_ASSERT( lhsT && rhsT && targetT);
 
-        me->d_lhs->accept(this);
+        if( lhsT->getBaseType() == Type::NIL )
+            emitNil(rhsT, me->d_lhs->d_loc); // compared with a raw function pointer it is a native int
+        else
+            me->d_lhs->accept(this);
         if( me->isRelation() )
             adjustType(me->d_inclType, lhsT->getBaseType(), me->d_lhs->d_loc );
             //convertTo(me->d_inclType, me->d_lhs->d_type.data(), me->d_lhs->d_loc, debug );
@@ -3415,7 +3786,10 @@ struct ObxCilGenImp : public AstVisitor
         if( me->d_op != BinExpr::AND && me->d_op != BinExpr::OR )
         {
             // AND and OR are special in that rhs might not be executed
-            me->d_rhs->accept(this);
+            if( rhsT->getBaseType() == Type::NIL )
+                emitNil(lhsT, me->d_rhs->d_loc);
+            else
+                me->d_rhs->accept(this);
             if( me->isRelation() )
                 adjustType(me->d_inclType, rhsT->getBaseType(), me->d_rhs->d_loc );
                 //convertTo(me->d_inclType, me->d_rhs->d_type.data(), me->d_rhs->d_loc, debug );
@@ -3438,6 +3812,13 @@ struct ObxCilGenImp : public AstVisitor
                 Q_ASSERT(false);
             break;
         case BinExpr::IS:
+            if( lhsT->d_byValue )
+            {
+                // a value record has no extensions, so the dynamic type is always the static type
+                line(me->d_loc).pop_();
+                line(me->d_loc).ldc_i4(1);
+                break;
+            }
             line(me->d_loc).isinst_(formatType(rhsT));// returns object or null
             line(me->d_loc).ldnull_();
             line(me->d_loc).ceq_(); // true if null
@@ -3684,9 +4065,67 @@ struct ObxCilGenImp : public AstVisitor
         }
     }
 
+    bool canTailPrefix( ArgExpr* ae, bool isReturn )
+    {
+        // the callee gets no address into the current frame, the result is returned unchanged, and
+        // the callee has no more arguments than the current procedure so the runtime can reuse the frame
+        ProcType* caller = scope->getProcType();
+        ProcType* pt = ae->getProcType();
+        if( Lowering::calledProc(ae) == 0 || caller->d_unsafe || pt->d_unsafe || !pt->d_nonLocals.isEmpty() ||
+                pt->d_formals.size() != ae->d_args.size() ||
+                pt->d_formals.size() > caller->d_formals.size() + caller->d_nonLocals.size() )
+            return false;
+        for( int i = 0; i < pt->d_formals.size(); i++ )
+        {
+            if( pt->d_formals[i]->isVarParam() )
+                return false;
+        }
+        if( !isReturn )
+            return true;
+        Type* rt = derefed(caller->d_return.data());
+        Type* ct = derefed(pt->d_return.data());
+        if( rt == 0 || ct == 0 || rt->d_unsafe || ct->d_unsafe || isValueRecord(ct) )
+            return false;
+        if( rt == ct )
+            return rt->getTag() == Thing::T_Pointer || rt->getTag() == Thing::T_Enumeration ||
+                    rt->getTag() == Thing::T_BaseType;
+        return rt->getTag() == Thing::T_BaseType && ct->getTag() == Thing::T_BaseType &&
+                rt->getBaseType() == ct->getBaseType();
+    }
+
+    bool emitTailCall( Statement* s )
+    {
+        ArgExpr* ae = Lowering::callOf(s);
+        Q_ASSERT( ae );
+        ProcType* pt = scope->getProcType();
+        if( tailStart >= 0 && Lowering::calledProc(ae) == scope )
+        {
+            // the arguments replace the parameters and the body starts over
+            Q_ASSERT( pt->d_formals.size() == ae->d_args.size() );
+            for( int i = 0; i < ae->d_args.size(); i++ )
+            {
+                emitRhs( pt->d_formals[i]->d_type.data(), ae->d_args[i].data(), ae->d_args[i]->d_loc );
+            }
+            for( int i = pt->d_formals.size() - 1; i >= 0; i-- )
+                line(ae->d_loc).starg_(pt->d_formals[i]->d_slot);
+            line(ae->d_loc).br_(tailStart);
+            return true;
+        }
+        if( canTailPrefix(ae, s->getTag() == Thing::T_Return) )
+        {
+            tailPrefix = true;
+            emitCall(ae);
+            line(ae->d_loc).ret_(!pt->d_return.isNull());
+            return true;
+        }
+        return false;
+    }
+
     void visit( Call* me)
     {
         Q_ASSERT( me->d_what );
+        if( tailCalls.contains(me) && emitTailCall(me) )
+            return;
         me->d_what->accept(this);
         if( !me->d_what->d_type.isNull() )
         {
@@ -3703,68 +4142,12 @@ struct ObxCilGenImp : public AstVisitor
         }
     }
 
-    quint8 inclusiveType1(Type* lhs, Type* rhs) const
-    {
-        if( lhs == 0 || rhs == 0 )
-            return 0;
-        const quint8 l = lhs->getBaseType();
-        const quint8 r = rhs->getBaseType();
-        if( ( l == Type::CHAR && r == Type::STRING ) ||
-            ( l == Type::WCHAR && r == Type::WSTRING ) ||
-            ( l == Type::WCHAR && r == Type::STRING ) )
-            return r;
-        return Validator::inclusiveType( l, r ).first;
-    }
-
-
     void visit( ForLoop* me)
     {
         //const int before = stackDepth;
-        // i := from;
-        // WHILE i <= to DO statements; i := i + by END
-        // WHILE i >= to DO statements; i := i + by END
-
-        // TODO: caclulate TO only once!
-
-        Ref<Assign> a = new Assign();
-        a->d_loc = me->d_loc;
-        a->d_lhs = me->d_id;
-        a->d_rhs = me->d_from;
-
-        Ref<IfLoop> loop = new IfLoop();
-        loop->d_loc = me->d_loc;
-        loop->d_op = IfLoop::WHILE;
-
-        Ref<BinExpr> cond = new BinExpr();
-        cond->d_loc = me->d_loc;
-        if( me->d_byVal.toInt() > 0 )
-            cond->d_op = BinExpr::LEQ;
-        else
-            cond->d_op = BinExpr::GEQ;
-        cond->d_lhs = me->d_id;
-        cond->d_rhs = me->d_to;
-        cond->d_inclType = inclusiveType1(derefed(me->d_id->d_type.data()), derefed(me->d_to->d_type.data()) );
-        cond->d_type = new BaseType(Type::BOOLEAN); // me->d_id->d_type.data();
-        loop->d_if.append( cond.data() );
-
-        loop->d_then.append( me->d_do );
-
-        Ref<BinExpr> add = new BinExpr();
-        add->d_loc = me->d_loc;
-        add->d_op = BinExpr::ADD;
-        add->d_lhs = me->d_id;
-        add->d_rhs = me->d_by;
-        add->d_type = me->d_id->d_type;
-
-        Ref<Assign> a2 = new Assign();
-        a2->d_loc = me->d_loc;
-        a2->d_lhs = me->d_id;
-        a2->d_rhs = add.data();
-
-        loop->d_then.back().append( a2.data() );
-
-        a->accept(this);
-        loop->accept(this);
+        const StatSeq ss = Lowering::lowerFor(me);
+        for( int i = 0; i < ss.size(); i++ )
+            ss[i]->accept(this);
         // TODO Q_ASSERT( before == stackDepth );
     }
 
@@ -3813,28 +4196,7 @@ struct ObxCilGenImp : public AstVisitor
             emitIf(me);
             break;
         case IfLoop::WHILE:
-            {
-                // substitute by primitive statements
-                Ref<IfLoop> loop = new IfLoop();
-                loop->d_op = IfLoop::LOOP;
-                loop->d_loc = me->d_loc;
-
-                Ref<IfLoop> conds = new IfLoop();
-                conds->d_op = IfLoop::IF;
-                conds->d_loc = me->d_loc;
-
-                conds->d_if = me->d_if;
-                conds->d_then = me->d_then;
-
-                Q_ASSERT( me->d_else.isEmpty() );
-                Ref<Exit> ex = new Exit();
-                ex->d_loc = me->d_loc;
-                conds->d_else << ex.data();
-
-                loop->d_then << ( StatSeq() << conds.data() );
-
-                loop->accept(this); // now render
-            }
+            Lowering::lowerWhile(me)->accept(this);
             break;
         case IfLoop::REPEAT:
             {
@@ -3958,6 +4320,13 @@ struct ObxCilGenImp : public AstVisitor
                         line(me->d_loc).ldobj_( formatType(me->d_rhs->d_type.data()) );
                         // TODO emitStackToVar();
 #endif
+                    }else if( r->d_byValue )
+                    {
+                        // no cpblk here since a value record can include object references
+                        emitFetchDesigAddr(me->d_lhs.data());
+                        me->d_rhs->accept(this);
+                        line(me->d_loc).ldobj_(formatType(r));
+                        line(me->d_loc).stobj_(formatType(r));
                     }else
                     {
                         me->d_lhs->accept(this);
@@ -3965,8 +4334,6 @@ struct ObxCilGenImp : public AstVisitor
                         prepareRhs(lhsT, me->d_rhs.data(), me->d_loc );
                         QByteArray what = "void " + classRef(r) + formatMetaActuals(r) + "::'#copy'(";
                         what += formatType(r);
-                        if( r->d_byValue )
-                            what += "&";
                         what += ")";
                         line(me->d_loc).callvirt_(what,1);
                     }
@@ -3987,8 +4354,7 @@ struct ObxCilGenImp : public AstVisitor
         }else
         {
             const bool unsafe = emitFetchDesigAddr(me->d_lhs.data());
-            me->d_rhs->accept(this);
-            prepareRhs(lhsT, me->d_rhs.data(), me->d_loc );
+            emitRhs(lhsT, me->d_rhs.data(), me->d_loc );
             // no longer used, instead in prepareRhs:
             // convertTo(lhsT->getBaseType(),me->d_rhs->d_type.data(), me->d_loc);
 #if _USE_LDSTOBJ
@@ -4051,144 +4417,24 @@ struct ObxCilGenImp : public AstVisitor
 
     void visit( CaseStmt* me)
     {
-        // TODO: if else missing then abort if no case hit
-        if( me->d_typeCase )
+        Lowering::Temp tmp;
+        int t = -1;
+        if( Lowering::needsCaseTemp(me) )
         {
-            // first rewrite the AST with 'if' instead of complex 'case'
-
-            if( me->d_cases.isEmpty() )
-                return;
-
-            Ref<IfLoop> ifl = new IfLoop();
-            ifl->d_op = IfLoop::IF;
-            ifl->d_loc = me->d_loc;
-
-            for( int i = 0; i < me->d_cases.size(); i++ )
-            {
-                const CaseStmt::Case& c = me->d_cases[i];
-
-                Q_ASSERT( c.d_labels.size() == 1 );
-                Type* td = derefed(c.d_labels.first()->d_type.data());
-
-                Ref<BinExpr> eq = new BinExpr();
-                if( td && td->getBaseType() == Type::NIL )
-                    eq->d_op = BinExpr::EQ;
-                else
-                    eq->d_op = BinExpr::IS;
-                eq->d_lhs = me->d_exp;
-                eq->d_rhs = c.d_labels.first();
-                eq->d_loc = me->d_exp->d_loc;
-                eq->d_type = new BaseType(Type::BOOLEAN);
-
-                ifl->d_if.append(eq.data());
-                ifl->d_then.append( c.d_block );
-            }
-
-            ifl->d_else = me->d_else;
-
-            // and now generate code for the if
-            ifl->accept(this);
+            // the case expression is evaluated once and each label is compared with the temp
+            Type* td = me->d_exp->d_type->derefed();
+            t = temps.buy(formatType(td));
+            tmp = Lowering::makeTemp(td, scope, "#temp", me->d_exp->d_loc );
+            tmp.d_var->d_slot = t;
+            tmp.d_var->d_slotValid = true;
+            me->d_exp->accept(this);
+            line(me->d_exp->d_loc).stloc_(t);
         }
-        else
-        {
-            // first rewrite the AST with 'if' instead of complex 'case'
-
-            Ref<IfLoop> ifl = new IfLoop();
-            ifl->d_op = IfLoop::IF;
-            ifl->d_loc = me->d_loc;
-
-            Ref<BaseType> boolean = new BaseType(Type::BOOLEAN);
-
-            for( int i = 0; i < me->d_cases.size(); i++ )
-            {
-                const CaseStmt::Case& c = me->d_cases[i];
-
-                QList< Ref<Expression> > ors;
-                for( int j = 0; j < c.d_labels.size(); j++ )
-                {
-                    Expression* l = c.d_labels[j].data();
-                    // TODO: avoid redundant evaluations using temp vars
-                    bool done = false;
-                    if( l->getTag() == Thing::T_BinExpr )
-                    {
-                        BinExpr* bi = cast<BinExpr*>( l );
-                        if( bi->d_op == BinExpr::Range )
-                        {
-                            // TODO: consider lhs > rhs
-                            Ref<BinExpr> _and = new BinExpr();
-                            _and->d_op = BinExpr::AND;
-                            _and->d_loc = l->d_loc;
-                            _and->d_type = boolean.data();
-
-                            Ref<BinExpr> lhs = new BinExpr();
-                            lhs->d_op = BinExpr::GEQ;
-                            lhs->d_lhs = me->d_exp;
-                            lhs->d_rhs = bi->d_lhs;
-                            lhs->d_loc = l->d_loc;
-                            lhs->d_inclType = inclusiveType1(derefed(me->d_exp->d_type.data()), derefed(bi->d_lhs->d_type.data()) );
-                            lhs->d_type = boolean.data();
-
-                            Ref<BinExpr> rhs = new BinExpr();
-                            rhs->d_op = BinExpr::LEQ;
-                            rhs->d_lhs = me->d_exp;
-                            rhs->d_rhs = bi->d_rhs;
-                            rhs->d_loc = l->d_loc;
-                            rhs->d_inclType = inclusiveType1(derefed(me->d_exp->d_type.data()), derefed(bi->d_rhs->d_type.data()) );
-                            rhs->d_type = boolean.data();
-
-                            _and->d_lhs = lhs.data();
-                            _and->d_rhs = rhs.data();
-
-                            ors << _and.data();
-                            done = true;
-                        }
-                    }
-                    if( !done )
-                    {
-                        Ref<BinExpr> eq = new BinExpr();
-                        eq->d_op = BinExpr::EQ;
-                        eq->d_lhs = me->d_exp;
-                        eq->d_rhs = l;
-                        eq->d_inclType = inclusiveType1(derefed(me->d_exp->d_type.data()), derefed(l->d_type.data()) );
-                        eq->d_loc = l->d_loc;
-                        eq->d_type = boolean.data();
-
-                        ors << eq.data();
-                    }
-                }
-                Q_ASSERT( !ors.isEmpty() );
-                if( ors.size() == 1 )
-                    ifl->d_if.append( ors.first() );
-                else
-                {
-                    Q_ASSERT( ors.size() > 1 );
-                    Ref<BinExpr> bi = new BinExpr();
-                    bi->d_op = BinExpr::OR;
-                    bi->d_lhs = ors[0];
-                    bi->d_rhs = ors[1];
-                    bi->d_loc = ors[1]->d_loc;
-                    bi->d_type = boolean.data();
-                    for( int i = 2; i < ors.size(); i++ )
-                    {
-                        Ref<BinExpr> tmp = new BinExpr();
-                        tmp->d_op = BinExpr::OR;
-                        tmp->d_lhs = bi.data();
-                        tmp->d_type = boolean.data();
-                        bi = tmp;
-                        bi->d_rhs = ors[i];
-                        bi->d_loc = ors[i]->d_loc;
-                    }
-                    ifl->d_if.append( bi.data() );
-                }
-
-                ifl->d_then.append( c.d_block );
-            }
-
-            ifl->d_else = me->d_else;
-
-            // and now generate code for the if
+        Ref<IfLoop> ifl = Lowering::lowerCase(me, tmp.d_use.data());
+        if( !ifl.isNull() )
             ifl->accept(this);
-        }
+        if( t >= 0 )
+            temps.sell(t);
     }
 
     void visit( Exit* me)
@@ -4216,10 +4462,10 @@ struct ObxCilGenImp : public AstVisitor
                 case Thing::T_Record:
                     {
                         Record* r = cast<Record*>(ltd);
-                        if( r->d_unsafe )
+                        if( r->d_unsafe || r->d_byValue )
                         {
                             what->accept(this);
-                            line(loc).ldobj_(formatType(r)); // return type requires a cstruct by value
+                            line(loc).ldobj_(formatType(r)); // return type requires a cstruct or value record by value
                         }else
                         {
                             emitInitializer(lt,false,loc); // create new record or array
@@ -4228,8 +4474,6 @@ struct ObxCilGenImp : public AstVisitor
                             // stack: new record, new record, rhs record
                             QByteArray what = "void " + classRef(r) + formatMetaActuals(r) + "::'#copy'(";
                             what += formatType(r);
-                            if( r->d_byValue )
-                                what += "&";
                             what += ")";
                             line(loc).callvirt_(what,1);
                         }
@@ -4253,17 +4497,14 @@ struct ObxCilGenImp : public AstVisitor
                     Q_ASSERT(false);
                 }
             }else
-            {
-                what->accept(this);
-                prepareRhs( ltd, what, loc );
-            }
+                emitRhs( ltd, what, loc );
             line(loc).ret_(true);
         }else if( !pt->d_return.isNull() )
         {
             // a function with no body; return default value
             //suppressLine++;
             if( !emitInitializer(pt->d_return.data(),false,loc) )
-                line(loc).ldnull_(); // only happens for pointer and proctype
+                emitNil(pt->d_return.data(),loc); // only happens for pointer and proctype
             //suppressLine--;
             line(loc).ret_(true);
         }else
@@ -4275,6 +4516,8 @@ struct ObxCilGenImp : public AstVisitor
     void visit( Return* me )
     {
         Q_ASSERT( scope != 0 );
+        if( tailCalls.contains(me) && emitTailCall(me) )
+            return;
         emitReturn( scope->getProcType(), me->d_what.data(), me->d_loc );
     }
 
@@ -4366,10 +4609,9 @@ struct ObxCilGenImp : public AstVisitor
             break;
 #endif
         case Thing::T_Record:
-            if( !td->d_unsafe )
+            if( !td->d_unsafe && !td->d_byValue ) // the others are initialized with initobj
             {
                 Record* r = cast<Record*>(td);
-                Q_ASSERT( !r->d_byValue );
 
                 line(loc).newobj_("void class " + classRef(r) + formatMetaActuals(r)
                     + "::.ctor()"); // initializes fields incl. superclasses
@@ -4418,6 +4660,8 @@ struct ObxCilGenImp : public AstVisitor
             {
                 Array* a = cast<Array*>(td);
                 Type* td = derefed(a->d_type.data());
+                // newarr already zeroes value record elements
+                const bool initElems = td->isStructured() && !isValueRecord(td);
 
                 int len = -1;
                 if( !lengths.isEmpty() )
@@ -4432,7 +4676,7 @@ struct ObxCilGenImp : public AstVisitor
                         a->d_lenExpr->accept(this);
                     else
                         line(loc).ldc_i4(a->d_len);
-                    if( td->isStructured() )
+                    if( initElems )
                     {
                         len = temps.buy("int32");
                         convertTo(Type::INT32,a->d_lenExpr->d_type.data(),loc,debug);
@@ -4443,7 +4687,7 @@ struct ObxCilGenImp : public AstVisitor
                 // here the len is on the stack, either from constant or
                 line(loc).newarr_(formatType(a->d_type.data())); // must be a->d_type, not td!
 
-                if( td->isStructured() )
+                if( initElems )
                 {
                     const int i = temps.buy("int32");
                     Q_ASSERT( i >= 0 );
@@ -4544,7 +4788,7 @@ struct ObxCilGenImp : public AstVisitor
     void emitVarToStack( Named* me, const RowCol& loc )
     {
         Type* td = derefed(me->d_type.data());
-        const bool getAddr = td && td->getTag() == Thing::T_Record && td->d_unsafe;
+        const bool getAddr = isValueRecord(td);
         switch( me->getTag() )
         {
         case Thing::T_Field:
@@ -4595,7 +4839,7 @@ struct ObxCilGenImp : public AstVisitor
                 line(loc).ldloc_(me->d_slot);
             break;
         case Thing::T_Parameter:
-            if( getAddr )
+            if( getAddr && !requiresRefOp(cast<Parameter*>(me)) ) // a VAR param is already the address
                 line(loc).ldarga_(me->d_slot);
             else
                 line(loc).ldarg_(me->d_slot);
@@ -4650,7 +4894,7 @@ struct ObxCilGenImp : public AstVisitor
         case Thing::T_LocalVar:
             {
                 Type* t = derefed(me->d_type.data());
-                if( t && t->d_unsafe && t->getTag() == Thing::T_Record )
+                if( isValueRecord(t) )
                 {
                     if( tag == Thing::T_LocalVar )
                     {
@@ -4667,7 +4911,7 @@ struct ObxCilGenImp : public AstVisitor
             {
                 Parameter* p = cast<Parameter*>(me);
                 Type* t = derefed(p->d_type.data());
-                if( !p->d_var && t && t->isStructured() && !t->d_unsafe ) // TODO: unsafe arrays
+                if( !p->d_var && t && t->isStructured() && !t->d_unsafe && !t->d_byValue ) // TODO: unsafe arrays
                 {
                     // make a copy if a structured value is not passed by VAR or IN
                     const int tag = t->getTag();
@@ -4690,8 +4934,6 @@ struct ObxCilGenImp : public AstVisitor
                             Record* r = cast<Record*>(t);
                             QByteArray what = "void " + classRef(r) + formatMetaActuals(r) + "::'#copy'(";
                             what += formatType(r);
-                            if( r->d_byValue )
-                                what += "&";
                             what += ")";
                             line(me->d_loc).callvirt_(what,1);
                             // stack: lhs record
@@ -4864,7 +5106,184 @@ static bool copyLib( const QDir& outDir, const QByteArray& name, QTextStream* co
     return true;
 }
 
-bool CilGen::translateAll(Project* pro, How how, bool debug, const QString& where)
+static QByteArray readMvid( const QString& path, QByteArray* strings = 0 )
+{
+    // returns the module version id of the assembly as hex string, or empty if not a CLI assembly;
+    // the MVID is the first entry of the #GUID heap, since the single Module table row refers to index 1;
+    // optionally also returns the #Strings heap, which includes the names of the referenced assemblies
+    QFile f(path);
+    if( !f.open(QIODevice::ReadOnly) )
+        return QByteArray();
+    const QByteArray pe = f.readAll();
+    const uchar* d = (const uchar*)pe.constData();
+    const int size = pe.size();
+#define OBX_RD16(o) ( (o) + 2 <= size ? quint32(d[o] | (d[(o)+1] << 8)) : 0 )
+#define OBX_RD32(o) ( (o) + 4 <= size ? quint32(d[o] | (d[(o)+1] << 8) | (d[(o)+2] << 16) | (quint32(d[(o)+3]) << 24)) : 0 )
+    const quint32 peOff = OBX_RD32(0x3c);
+    if( OBX_RD32(peOff) != 0x4550 ) // "PE\0\0"
+        return QByteArray();
+    const quint32 coff = peOff + 4;
+    const quint32 sectionCount = OBX_RD16(coff + 2);
+    const quint32 optSize = OBX_RD16(coff + 16);
+    const quint32 opt = coff + 20;
+    const quint32 dirs = opt + ( OBX_RD16(opt) == 0x20b ? 112 : 96 );
+    const quint32 cliRva = OBX_RD32(dirs + 14 * 8);
+    const quint32 sections = opt + optSize;
+    struct Rva
+    {
+        static quint32 toOffset( const uchar* d, int size, quint32 sections, quint32 count, quint32 rva )
+        {
+            for( quint32 i = 0; i < count; i++ )
+            {
+                const quint32 s = sections + i * 40;
+                const quint32 va = OBX_RD32(s + 12);
+                if( rva >= va && rva < va + OBX_RD32(s + 16) )
+                    return rva - va + OBX_RD32(s + 20);
+            }
+            return 0;
+        }
+    };
+    const quint32 cli = Rva::toOffset(d, size, sections, sectionCount, cliRva);
+    const quint32 meta = Rva::toOffset(d, size, sections, sectionCount, OBX_RD32(cli + 8));
+    if( cli == 0 || meta == 0 || OBX_RD32(meta) != 0x424A5342 ) // "BSJB"
+        return QByteArray();
+    quint32 pos = meta + 16 + OBX_RD32(meta + 12);
+    const quint32 streamCount = OBX_RD16(pos + 2);
+    pos += 4;
+    QByteArray mvid;
+    for( quint32 i = 0; i < streamCount && pos + 8 < quint32(size); i++ )
+    {
+        const quint32 off = OBX_RD32(pos);
+        const QByteArray name(pe.constData() + pos + 8);
+        if( name == "#GUID" && meta + off + 16 <= quint32(size) )
+            mvid = pe.mid(meta + off, 16).toHex();
+        else if( name == "#Strings" && strings )
+            *strings = pe.mid(meta + off, OBX_RD32(pos + 4));
+        pos += 8 + ( ( name.size() + 4 ) & ~3 );
+    }
+#undef OBX_RD16
+#undef OBX_RD32
+    return mvid;
+}
+
+static QByteArray monoVersion( const QString& mono )
+{
+    QProcess proc;
+    proc.start(mono, QStringList() << "--version");
+    if( !proc.waitForFinished(-1) || proc.exitCode() != 0 )
+        return QByteArray();
+    return proc.readAllStandardOutput();
+}
+
+bool CilGen::compileAot(const QString& where, Aot mode)
+{
+#ifndef QT_NO_PROCESS
+    if( mode == NoAot )
+        return true;
+    QDir outDir(where);
+    const QString mono = outDir.exists("mono") ? outDir.absoluteFilePath("mono") : QString("mono");
+    QString option = "--aot";
+    QString runOption;
+    if( mode == AotHybrid )
+    {
+        option = "--aot=hybrid";
+        runOption = "--hybrid-aot ";
+    }else if( mode == AotFull )
+    {
+        option = "--aot=full";
+        runOption = "--full-aot ";
+    }
+
+    // The native images are cached, so unchanged assemblies like OBX.Runtime.dll are compiled only once. An image
+    // also depends on the assemblies it references (e.g. their field layouts) and on the Mono version, so the key
+    // is a hash of the MVID of the assembly, the MVIDs of all assemblies it references directly or indirectly,
+    // and the output of mono --version. A reference is assumed if the name of another assembly in where appears
+    // in the #Strings heap; a type with the same name only causes an unnecessary recompilation.
+    QDir cache(QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation));
+    const QString sub = "obx-aot/" + option.mid(2).replace('=','-');
+    cache.mkpath(sub);
+    cache.cd(sub);
+
+    const QByteArray version = monoVersion(mono);
+    const QStringList files = outDir.entryList(QStringList() << "*.dll" << "*.exe", QDir::Files);
+    QHash<QString,QByteArray> mvids, strings; // assembly name -> MVID, #Strings heap
+    foreach( const QString& file, files )
+    {
+        QByteArray heap;
+        const QByteArray mvid = readMvid(outDir.absoluteFilePath(file), &heap);
+        if( mvid.isEmpty() )
+            continue;
+        const QString name = QFileInfo(file).completeBaseName();
+        mvids.insert(name, mvid);
+        strings.insert(name, heap);
+    }
+
+    bool ok = true;
+    foreach( const QString& file, files )
+    {
+        const QString path = outDir.absoluteFilePath(file);
+        const QString name = QFileInfo(file).completeBaseName();
+        if( !mvids.contains(name) )
+            continue;
+        QStringList refs;
+        QStringList todo;
+        todo << name;
+        while( !todo.isEmpty() )
+        {
+            const QByteArray heap = strings.value(todo.takeFirst());
+            QHash<QString,QByteArray>::const_iterator i;
+            for( i = mvids.begin(); i != mvids.end(); ++i )
+            {
+                if( i.key() == name || refs.contains(i.key()) )
+                    continue;
+                if( heap.contains( '\0' + i.key().toUtf8() + '\0' ) )
+                {
+                    refs << i.key();
+                    todo << i.key();
+                }
+            }
+        }
+        refs.sort();
+        QCryptographicHash key(QCryptographicHash::Sha1);
+        key.addData(mvids.value(name));
+        foreach( const QString& ref, refs )
+            key.addData(mvids.value(ref));
+        key.addData(version);
+        const QString image = path + ".so";
+        const QString cached = cache.absoluteFilePath(QString::fromUtf8(key.result().toHex()) + ".so");
+        QFile::remove(image);
+        if( QFile::exists(cached) && QFile::copy(cached, image) )
+            continue;
+        QProcess proc;
+        proc.setWorkingDirectory(where);
+        proc.setProcessEnvironment(QProcessEnvironment::systemEnvironment());
+        proc.start(mono, QStringList() << option << file);
+        if( !proc.waitForFinished(-1) || proc.exitCode() != 0 )
+        {
+            qCritical() << "AOT compilation failed for" << file << proc.readAllStandardError().constData();
+            ok = false;
+            continue;
+        }
+        QFile::copy(image, cached);
+    }
+
+    QFile run( outDir.absoluteFilePath("run.sh") );
+    if( !run.open(QIODevice::WriteOnly) )
+    {
+        qCritical() << "could not open for writing" << run.fileName();
+        return false;
+    }
+    run.write("export MONO_PATH=.\n");
+    run.write(QString("./mono %1Main#.exe\n").arg(runOption).toUtf8());
+    return ok;
+#else
+    qCritical() << "AOT compilation requires QProcess";
+    return false;
+#endif
+}
+
+bool CilGen::translateAll(Project* pro, How how, bool debug, const QString& where,
+                          const QSet<QByteArray>& upToDate)
 {
     Q_ASSERT( pro );
     if( where.isEmpty() )
@@ -4884,12 +5303,28 @@ bool CilGen::translateAll(Project* pro, How how, bool debug, const QString& wher
     QByteArray clearStr;
     QTextStream cout(&clearStr);
 
+    const quint32 errCount = pro->getErrs()->getErrCount(); // also counts the errors of the deferred bodies
 #ifdef _MY_GENERICS_
     QList<Module*> mods = pro->getModulesToGenerate();
 #else
     QList<Module*> mods = pro->getModulesToGenerate(true);
 #endif
-    const quint32 errCount = pro->getErrs()->getErrCount();
+    if( pro->getErrs()->getErrCount() != errCount )
+        return false;
+
+#ifdef _MY_GENERICS_
+    QList<Module*> allMods;
+    foreach( Module* m, mods )
+    {
+        if( m->d_metaParams.isEmpty() )
+            m->findAllInstances(allMods);
+        allMods.append(m);
+    }
+    markValueRecords(allMods);
+#else
+    markValueRecords(mods);
+#endif
+
     QSet<Module*> generated;
     foreach( Module* m, mods )
     {
@@ -4919,18 +5354,22 @@ bool CilGen::translateAll(Project* pro, How how, bool debug, const QString& wher
                     if( !generated.contains(inst) )
                     {
                         generated.insert(inst);
+                        const bool skip = upToDate.contains(inst->getName()); // output of previous run still valid
                         if( how == Ilasm || how == Fastasm || how == IlOnly )
                         {
                             QFile f(outDir.absoluteFilePath(inst->getName() + ".il"));
-                            if( f.open(QIODevice::WriteOnly) )
+                            if( skip || f.open(QIODevice::WriteOnly) )
                             {
                                 //qDebug() << "generating IL for" << m->getName() << "to" << f.fileName();
-                                IlAsmRenderer r(&f);
-                                IlEmitter e(&r);
-                                if( !CilGen::translate(inst,&e, debug, pro->getErrs()) )
+                                if( !skip )
                                 {
-                                    qCritical() << "error generating IL for" << inst->getName();
-                                    return false;
+                                    IlAsmRenderer r(&f);
+                                    IlEmitter e(&r);
+                                    if( !CilGen::translate(inst,&e, debug, pro->getErrs()) )
+                                    {
+                                        qCritical() << "error generating IL for" << inst->getName();
+                                        return false;
+                                    }
                                 }
                                 if( how == Ilasm )
                                     bout << "./ilasm /dll " << ( debug ? "/debug ": "" ) << "\"" << inst->getName() << ".il\"" << endl;
@@ -4944,7 +5383,7 @@ bool CilGen::translateAll(Project* pro, How how, bool debug, const QString& wher
                                     cout << inst->getName() << endl;
                             }else
                                 qCritical() << "could not open for writing" << f.fileName();
-                        }else
+                        }else if( !skip )
                         {
                             PelibGen r;
                             IlEmitter e(&r);
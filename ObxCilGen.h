@@ -21,6 +21,7 @@
 */
 
 #include <QString>
+#include <QSet>
 #include <QByteArrayList>
 class QIODevice;
 
@@ -40,11 +41,15 @@ namespace Obx
     public:
         enum How { Ilasm, Fastasm, IlOnly, Pelib };
         // all true on success, false on error
-        static bool translateAll(Project*, How how, bool debug, const QString& where );
+        static bool translateAll(Project*, How how, bool debug, const QString& where,
+                                 const QSet<QByteArray>& upToDate = QSet<QByteArray>() ); // names of modules not to regenerate
         static bool translate(Module*, IlEmitter* out, bool debug, Ob::Errors* = 0 );
         static bool generateMain(IlEmitter* out, const QByteArray& thisMod,
                                  const QByteArray& callMod = QByteArray(), const QByteArray& callFunc = QByteArray());
         static bool generateMain(IlEmitter* out, const QByteArray& thisMod, const QByteArrayList& callMods );
+        enum Aot { NoAot, AotDefault, AotHybrid, AotFull }; // --aot, --aot=hybrid, --aot=full
+        // precompiles the assemblies in where with the Mono AOT compiler and adapts run.sh
+        static bool compileAot(const QString& where, Aot mode );
     private:
         CilGen();
     };
@@ -785,6 +785,7 @@ void Ide::createMenu()
     pop->addCommand( "Compile", this, SLOT(onCompile()), tr("CTRL+T"), false );
     pop->addCommand( "Compile && Generate", this, SLOT(onGenerate()), tr("CTRL+SHIFT+T"), false );
     pop->addCommand( "JIT Enabled", this, SLOT(onJitEnabled()) );
+    pop->addCommand( "JIT Trace Diagnostics", this, SLOT(onTraceDiag()) );
     pop->addCommand( "Restart LuaJIT", this, SLOT(onRestartLua()), tr("CTRL+SHIFT+R"), false );
     pop->addCommand( "Set Command...", this, SLOT(onRunCommand()) );
     pop->addCommand( "Run on LuaJIT", this, SLOT(onRun()), tr("CTRL+R"), false );
@@ -858,12 +859,14 @@ void Ide::createMenuBar()
     pop->addCommand( "Compile", this, SLOT(onCompile()), tr("CTRL+T"), false );
     pop->addCommand( "Compile && Generate", this, SLOT(onGenerate()), tr("CTRL+SHIFT+T"), false );
     pop->addCommand( "JIT Enabled", this, SLOT(onJitEnabled()) );
+    pop->addCommand( "JIT Trace Diagnostics", this, SLOT(onTraceDiag()) );
     pop->addCommand( "Restart LuaJIT", this, SLOT(onRestartLua()), tr("CTRL+SHIFT+R"), false );
     pop->addCommand( "Set Command...", this, SLOT(onRunCommand()) );
     pop->addCommand( "Run on LuaJIT", this, SLOT(onRun()), tr("CTRL+R"), false );
 
     pop = new Gui::AutoMenu( tr("Debug"), this );
     pop->addCommand( "Enable Debugging", this, SLOT(onEnableDebug()),tr(OBN_ENDBG_SC), false );
+    pop->addCommand( "Low-Overhead Breakpoints", this, SLOT(onBreakTraps()) );
     pop->addCommand( "Row/Column mode", this, SLOT(onRowColMode()) );
     pop->addCommand( "Bytecode mode", this, SLOT(onBcDebug()) );
     pop->addCommand( "Toggle Breakpoint", this, SLOT(onToggleBreakPt()), tr(OBN_TOGBP_SC), false);
@@ -909,6 +912,12 @@ void Ide::onRun()
     removePosMarkers();
     if( !res )
         onErrors();
+    if( d_rt->traceDiag() )
+    {
+        logMessage("aborted traces:");
+        foreach( const QString& line, d_rt->renderTraceAborts() )
+            logMessage("  " + line);
+    }
 }
 
 void Ide::onAbort()
@@ -1486,6 +1495,8 @@ void Ide::onBreak()
 {
     // normal call because called during processEvent which doesn't seem to enable
     // the functions: ENABLED_IF( d_rt->getLua()->isExecuting() );
+    if( d_rt->isDebugArmed() && !d_rt->getLua()->isDebug() )
+        d_rt->getLua()->setDebug(true);
     d_rt->getLua()->runToNextLine();
 }
 
@@ -1742,6 +1753,7 @@ void Ide::addDebugMenu(Gui::AutoMenu* pop)
     Gui::AutoMenu* sub = new Gui::AutoMenu(tr("Debugger"), this, false );
     pop->addMenu(sub);
     sub->addCommand( "Enable Debugging", this, SLOT(onEnableDebug()),tr(OBN_ENDBG_SC), false );
+    sub->addCommand( "Low-Overhead Breakpoints", this, SLOT(onBreakTraps()) );
     sub->addCommand( "Toggle Breakpoint", this, SLOT(onToggleBreakPt()), tr(OBN_TOGBP_SC), false);
     sub->addAction( d_dbgStepIn );
     sub->addAction( d_dbgStepOver );
@@ -2830,7 +2842,8 @@ void Ide::removePosMarkers()
 
 void Ide::enableDbgMenu()
 {
-    d_dbgBreak->setEnabled(!d_rt->getLua()->isWaiting() && d_rt->getLua()->isExecuting() && d_rt->getLua()->isDebug() );
+    d_dbgBreak->setEnabled(!d_rt->getLua()->isWaiting() && d_rt->getLua()->isExecuting() &&
+                           ( d_rt->getLua()->isDebug() || d_rt->isDebugArmed() ) );
     d_dbgAbort->setEnabled(d_rt->getLua()->isWaiting());
     d_dbgContinue->setEnabled(d_rt->getLua()->isWaiting());
     d_dbgStepIn->setEnabled(d_rt->getLua()->isWaiting() && d_rt->getLua()->isDebug() );
@@ -2888,9 +2901,14 @@ void Ide::onToggleBreakPt()
     Project::FileMod fm = d_rt->getPro()->findFile(edit->getPath());
     Q_ASSERT( fm.first && fm.first->d_mod );
     if( on )
+    {
         d_rt->getLua()->addBreak( fm.first->d_mod->getName(), line + 1 );
-    else
+        d_rt->addBreak( fm.first->d_mod->getName(), line + 1 );
+    }else
+    {
         d_rt->getLua()->removeBreak( fm.first->d_mod->getName(), line + 1 );
+        d_rt->removeBreak( fm.first->d_mod->getName(), line + 1 );
+    }
 }
 
 void Ide::onSingleStep()
@@ -2915,6 +2933,8 @@ void Ide::onContinue()
     // ENABLED_IF( d_rt->getLua()->isWaiting() );
 
     d_rt->getLua()->runToBreakPoint();
+    if( d_rt->isDebugArmed() )
+        d_rt->getLua()->setDebug(false); // continue at full speed up to the next break trap
 }
 
 void Ide::onShowLlBc()
@@ -3084,6 +3104,20 @@ void Ide::onJitEnabled()
     d_rt->setJitEnabled( !d_rt->jitEnabled() );
 }
 
+void Ide::onTraceDiag()
+{
+    CHECKED_IF(true,d_rt->traceDiag());
+
+    d_rt->setTraceDiag( !d_rt->traceDiag() );
+}
+
+void Ide::onBreakTraps()
+{
+    CHECKED_IF(true,d_rt->breakTraps());
+
+    d_rt->setBreakTraps( !d_rt->breakTraps() );
+}
+
 void Ide::onRestartLua()
 {
     ENABLED_IF( !d_rt->getLua()->isExecuting() );
@@ -161,6 +161,8 @@ namespace Obx
         void onRowColMode();
         void onShowBcFile();
         void onJitEnabled();
+        void onTraceDiag();
+        void onBreakTraps();
         void onRestartLua();
         void onRunCommand();
     private:
@@ -448,6 +448,8 @@ Ide::Ide(QWidget *parent)
     if( !state.isNull() )
         restoreState( state.toByteArray() );
 
+    d_pro->getMdl()->setLazyBodies( s.value("LazyBodies").toBool() );
+
 
     connect( d_pro,SIGNAL(sigRenamed()),this,SLOT(onCaption()) );
     connect( d_pro,SIGNAL(sigModified(bool)),this,SLOT(onCaption()) );
@@ -723,6 +725,7 @@ void Ide::createModsMenu()
     pop->addSeparator();
     pop->addCommand( "Set Build Directory...", this, SLOT( onBuildDir() ) );
     pop->addCommand( "Built-in Oakwood", this, SLOT(onOakwood()) );
+    pop->addCommand( "Validate imported Bodies on Demand", this, SLOT(onLazyBodies()) );
     pop->addCommand( "Set Oberon File System Root...", this, SLOT( onWorkingDir() ) );
     pop->addSeparator();
     pop->addCommand( "Check Syntax", this, SLOT(onParse()), tr("CTRL+T"), false );
@@ -800,6 +803,7 @@ void Ide::createMenuBar()
     pop->addSeparator();
     pop->addCommand( "Set Build Directory...", this, SLOT( onBuildDir() ) );
     pop->addCommand( "Built-in Oakwood", this, SLOT(onOakwood()) );
+    pop->addCommand( "Validate imported Bodies on Demand", this, SLOT(onLazyBodies()) );
     pop->addCommand( "INTEGER is INT16", this, SLOT(onSetInt16()) );
     pop->addCommand( "Set Configuration Variables...", this, SLOT( onSetOptions()) );
     pop->addCommand( "Set Oberon File System Root...", this, SLOT( onWorkingDir() ) );
@@ -1515,6 +1519,15 @@ void Ide::onOakwood()
         d_pro->setUseBuiltInObSysInner(false);
 }
 
+void Ide::onLazyBodies()
+{
+    CHECKED_IF( true, d_pro->getMdl()->getLazyBodies() );
+
+    d_pro->getMdl()->setLazyBodies( !d_pro->getMdl()->getLazyBodies() );
+    QSettings s;
+    s.setValue( "LazyBodies", d_pro->getMdl()->getLazyBodies() );
+}
+
 void Ide::onAddFiles()
 {
     ENABLED_IF(true);
@@ -1776,6 +1789,8 @@ bool Ide::compile(bool doGenerate )
     const QTime start = QTime::currentTime();
     d_status = Compiling;
     const bool res = d_pro->reparse();
+    for( int i = 0; i < d_tab->count(); i++ )
+        d_pro->validateBodies( static_cast<Editor*>( d_tab->widget(i) )->getPath() );
     d_status = Idle;
     qDebug() << "recompiled in" << start.msecsTo(QTime::currentTime()) << "[ms]";
     if( res && doGenerate )
@@ -1984,6 +1999,10 @@ Ide::Editor* Ide::showEditor(const QString& path, int row, int col, bool setMark
         edit = static_cast<Editor*>( d_tab->widget(i) );
     }else
     {
+        const quint32 errCount = d_pro->getErrs()->getErrCount();
+        d_pro->validateBodies(filePath);
+        if( errCount != d_pro->getErrs()->getErrCount() )
+            onErrors();
         edit = new Editor(this,d_pro);
         createModsMenu(edit);
 
@@ -140,6 +140,7 @@ namespace Obx
         void onErrors();
         void onOpenFile();
         void onOakwood();
+        void onLazyBodies();
         void onAddFiles();
         void onNewModule();
         void onAddDir();
@@ -328,6 +328,13 @@ void IlEmitter::callvirt_(const QByteArray& methodRef, int argCount, bool hasRet
     delta(-argCount + (hasRet?1:0) );
 }
 
+void IlEmitter::calli_(const QByteArray& callSiteSig, int argCount, bool hasRet)
+{
+    Q_ASSERT( !d_method.isEmpty() );
+    d_body.append(IlOperation(IL_calli,callSiteSig) );
+    delta(-argCount - 1 + (hasRet?1:0) ); // function pointer plus args
+}
+
 void IlEmitter::castclass_(const QByteArray& typeRef)
 {
     Q_ASSERT( !d_method.isEmpty() );
@@ -784,6 +791,13 @@ void IlEmitter::ldstr_(const QByteArray& utf8)
     delta(+1);
 }
 
+void IlEmitter::ldtoken_(const QByteArray& typeRef)
+{
+    Q_ASSERT( !d_method.isEmpty() );
+    d_body.append(IlOperation(IL_ldtoken,typeRef));
+    delta(+1);
+}
+
 void IlEmitter::ldvirtftn_(const QByteArray& methodRef)
 {
     Q_ASSERT( !d_method.isEmpty() );
@@ -1026,6 +1040,12 @@ void IlEmitter::sub_(bool withOverflow, bool withUnsignedOverflow)
     delta(-2+1);
 }
 
+void IlEmitter::tail_()
+{
+    Q_ASSERT( !d_method.isEmpty() );
+    d_body.append(IlOperation(IL_tail_) );
+}
+
 void IlEmitter::throw_()
 {
     Q_ASSERT( !d_method.isEmpty() );
@@ -1292,6 +1312,9 @@ void IlAsmRenderer::addMethod(const IlMethod& m)
         case IL_newobj:
             out << ws() << s_opName[op.d_ilop] << " instance " << op.d_arg << endl;
             break;
+        case IL_calli:
+            out << ws() << s_opName[op.d_ilop] << " unmanaged cdecl " << op.d_arg << endl;
+            break;
         case IL_try:
             out << ws() << ".try {" << endl;
             level++;
@@ -1329,7 +1352,7 @@ void IlAsmRenderer::beginClass(const QByteArray& className, bool isPublic, quint
         out << "assembly ";
 
     if( classKind == IlEmitter::Value )
-        out << "sealed explicit ansi ";
+        out << "sealed " << ( byteSize >= 0 ? "explicit" : "sequential" ) << " ansi ";
     else if( classKind == IlEmitter::Delegate )
         out << "sealed ";
 
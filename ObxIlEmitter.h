@@ -149,6 +149,7 @@ namespace Obx
         void brinst_( quint32 label );
         void call_( const QByteArray& methodRef, int argCount = 0, bool hasRet = false, bool isInstance = false );
         void callvirt_( const QByteArray& methodRef, int argCount, bool hasRet = false );
+        void calli_( const QByteArray& callSiteSig, int argCount, bool hasRet = false ); // unmanaged cdecl
         void castclass_(const QByteArray& typeRef);
         void ceq_();
         void cgt_(bool withUnsigned = false);
@@ -182,6 +183,7 @@ namespace Obx
         void ldsfld_(const QByteArray& fieldRef);
         void ldsflda_(const QByteArray& fieldRef);
         void ldstr_(const QByteArray& utf8);
+        void ldtoken_(const QByteArray& typeRef);
         void ldvirtftn_(const QByteArray& methodRef);
         void leave_(quint32 label );
         void localloc_();
@@ -205,6 +207,7 @@ namespace Obx
         void stobj_(const QByteArray& typeRef);
         void stsfld_(const QByteArray& fieldRef);
         void sub_( bool withOverflow = false, bool withUnsignedOverflow = false );
+        void tail_(); // prefix of a call, callvirt or calli immediately followed by ret
         void throw_();
         void unbox_(const QByteArray& typeRef);
         void xor_();
@@ -106,6 +106,19 @@ extern "C" {
         return 0;
     }
 
+    static int OBX_DBGBREAK(lua_State* L)
+    {
+        // called by the code generated for a statement with a breakpoint; the line hook is only installed here
+        // so that code without breakpoints still runs with the JIT
+        Lua::Engine2* e = Lua::Engine2::getInst();
+        if( e == 0 )
+            return 0;
+        if( !e->isDebug() )
+            e->setDebug(true);
+        e->runToNextLine();
+        return 0;
+    }
+
     static int OBX_ADDRESSOF(lua_State* L)
     {
         const void* ptr = lua_topointer(L, 1);
@@ -129,20 +142,71 @@ void LibFfi::install(lua_State* L)
     lua_setglobal( L, "DBGTRACE" );
     lua_pushcfunction( L, OBX_ADDRESSOF );
     lua_setglobal( L, "ADDRESSOF" );
+    lua_pushcfunction( L, OBX_DBGBREAK );
+    lua_setglobal( L, "DBGBREAK" );
+}
+
+static inline quint32 nextUtf8( const uchar*& str )
+{
+    // decodes one code point; invalid sequences result in the replacement character like QString::fromUtf8
+    const uchar ch = *str++;
+    if( ch < 0x80 )
+        return ch;
+    int n;
+    quint32 cp;
+    if( ( ch & 0xe0 ) == 0xc0 )
+    {
+        n = 1;
+        cp = ch & 0x1f;
+    }else if( ( ch & 0xf0 ) == 0xe0 )
+    {
+        n = 2;
+        cp = ch & 0x0f;
+    }else if( ( ch & 0xf8 ) == 0xf0 )
+    {
+        n = 3;
+        cp = ch & 0x07;
+    }else
+        return 0xfffd;
+    for( int i = 0; i < n; i++ )
+    {
+        if( ( *str & 0xc0 ) != 0x80 )
+            return 0xfffd;
+        cp = ( cp << 6 ) | ( *str++ & 0x3f );
+    }
+    return cp;
 }
 
 static void copystr( char* to, int len, const char* from )
 {
-    QByteArray tmp = QString::fromUtf8(from).toLatin1();
-    memcpy(to,tmp.constData(),qMin(len-1,tmp.size()));
+    // same as QString::fromUtf8(from).toLatin1(), but without temporary strings
+    const uchar* str = (const uchar*)from;
+    int i = 0;
+    while( i < len - 1 && *str )
+    {
+        const quint32 cp = nextUtf8(str);
+        to[i++] = cp > 0xff ? '?' : char(cp);
+    }
+    to[i] = 0;
     to[len-1] = 0;
 }
 
 static void copywstr( uint16_t* to, int len, const char* from )
 {
-    QString tmp = QString::fromUtf8(from);
-    for( int i = 0; i < qMin(len-1,tmp.size()); i++ )
-        to[i] = tmp[i].unicode();
+    const uchar* str = (const uchar*)from;
+    int i = 0;
+    while( i < len - 1 && *str )
+    {
+        const quint32 cp = nextUtf8(str);
+        if( cp > 0xffff )
+        {
+            to[i++] = QChar::highSurrogate(cp);
+            if( i < len - 1 )
+                to[i++] = QChar::lowSurrogate(cp);
+        }else
+            to[i++] = cp;
+    }
+    to[i] = 0;
     to[len-1] = 0;
 }
 
@@ -162,38 +226,51 @@ static void printwstring( const uint16_t* str, int len )
         s_sendToLog(tmp);
 }
 
-static int relOp( const QString& l, const QString& r, int op )
+static inline int relOp( int res, int op )
 {
     switch( op )
     {
     case 1: // EQ
-        return l.compare(r) == 0;
+        return res == 0;
     case 2: // NEQ
-        return l.compare(r) != 0;
+        return res != 0;
     case 3: // LT
-        return l.compare(r) < 0;
+        return res < 0;
     case 4: // LEQ
-        return l.compare(r) <= 0;
+        return res <= 0;
     case 5: // GT
-        return l.compare(r) > 0;
+        return res > 0;
     case 6: // GEQ
-        return l.compare(r) >= 0;
+        return res >= 0;
     }
     return 0;
 }
 
 static int strRelOp( const char* lhs, const char* rhs, int op )
 {
-    const QString l = QString::fromLatin1(lhs);
-    const QString r = QString::fromLatin1(rhs);
-    return relOp(l,r,op);
+    // Latin-1 maps to the first 256 code points, so unsigned byte order is the same as QString::compare
+    const uchar* l = (const uchar*)lhs;
+    const uchar* r = (const uchar*)rhs;
+    while( *l && *l == *r )
+    {
+        l++;
+        r++;
+    }
+    return relOp( int(*l) - int(*r), op );
 }
 
 static int wstrRelOp( const uint16_t* lhs, int lcount, const uint16_t* rhs, int rcount, int op )
 {
-    const QString l = QString::fromRawData((QChar*)lhs, lcount);
-    const QString r = QString::fromRawData((QChar*)rhs, rcount);
-    return relOp(l,r,op);
+    // the arrays are compared up to the terminating zero, or up to their length if there is none
+    int i = 0;
+    while( true )
+    {
+        const int l = i < lcount ? lhs[i] : 0;
+        const int r = i < rcount ? rhs[i] : 0;
+        if( l != r || l == 0 )
+            return relOp( l - r, op );
+        i++;
+    }
 }
 
 extern "C"
@@ -21,6 +21,7 @@
 #include "ObxAst.h"
 #include "ObxProject.h"
 #include "ObxLibFfi.h"
+#include "ObxBuildServer.h"
 #include <LjTools/Engine2.h>
 #include <QDir>
 #include <QStringList>
@@ -83,6 +84,24 @@ static void log( const QString& msg )
     out << msg << endl;
 }
 
+class LjBuildServer : public Obx::BuildServer
+{
+public:
+    Obx::LjRuntime* d_rt;
+    QString d_outPath;
+    LjBuildServer(Obx::LjRuntime* rt):BuildServer(rt->getPro()),d_rt(rt){}
+protected:
+    bool reparse( const QStringList* changed )
+    {
+        return d_rt->compile(false, changed);
+    }
+    bool generate( const QSet<QByteArray>& upToDate )
+    {
+        // the slots of all modules are allocated, but only the changed ones are translated and written
+        return d_rt->generateBytecode(upToDate) && d_rt->saveBytecode(d_outPath, ".lua", upToDate);
+    }
+};
+
 int main(int argc, char *argv[])
 {
 #ifdef QT_GUI_LIB
@@ -113,6 +132,8 @@ int main(int argc, char *argv[])
     QString outPath;
     bool doRun = false;
     bool fromBc = false;
+    bool watch = false;
+    QString listen;
     QStringList args = QCoreApplication::arguments();
     if( args.size() <= 1 )
     {
@@ -134,8 +155,11 @@ int main(int argc, char *argv[])
             out << "  reads Oberon+ source or project files and runs them." << endl;
             out << "options:" << endl;
             out << "  -nojit        disable JIT" << endl;
+            out << "  -tracediag    report aborted JIT traces with their reasons after the run" << endl;
             out << "  -out=path     path where to save generated files (default don't generate)" << endl;
             out << "  -run          run the project if a project file is loaded" << endl;
+            out << "  -watch        keep running and rewrite the bytecode of modules affected by changed files (with -out)" << endl;
+            out << "  -listen[=name] keep running and build on requests sent to local socket name (default obxlj, with -out)" << endl;
             out << "  the following options are overridden if a project file is loaded" << endl;
             out << "  -run=A[.B]    run module A or procedure B in module A and quit" << endl;
             out << "  -oak          use built-in oakwood definitions" << endl;
@@ -180,11 +204,18 @@ int main(int argc, char *argv[])
         {
             rt.setJitEnabled(false);
             doRun = true;
-        }else if( args[i].startsWith("-fsroot=") )
+        }else if( args[i] == "-tracediag" )
+            rt.setTraceDiag(true);else if( args[i].startsWith("-fsroot=") )
         {
             rt.getPro()->setWorkingDir(args[i].mid(8));
         }else if( args[i] == "-frombc" )
             fromBc = true;
+        else if( args[i] == "-watch" )
+            watch = true;
+        else if( args[i] == "-listen" )
+            listen = "obxlj";
+        else if( args[i].startsWith("-listen=") )
+            listen = args[i].mid(8);
         else if( !args[ i ].startsWith( '-' ) )
         {
             dirOrFilePaths += args[ i ];
@@ -277,6 +308,23 @@ int main(int argc, char *argv[])
             qDebug() << Obx::Thing::s_tagName[i.key()] << i.value();
 #endif
 
+    if( watch || !listen.isEmpty() )
+    {
+        if( outPath.isEmpty() || fromBc || doRun )
+        {
+            err << "-watch and -listen require -out and cannot be combined with -run or -frombc" << endl;
+            return -1;
+        }
+        LjBuildServer server(&rt);
+        server.d_outPath = outPath;
+        server.build();
+        if( watch && !server.watch() )
+            return -1;
+        if( !listen.isEmpty() && !server.listen(listen) )
+            return -1;
+        return a.exec();
+    }
+
     if( !fromBc && !rt.compile(!outPath.isEmpty() || doRun) )
         return -1;
 
@@ -302,14 +350,18 @@ int main(int argc, char *argv[])
             err << rt.getLua()->getLastError() << endl;
             return -1;
         }
+        int res = 0;
 #ifdef QT_GUI_LIB
         if( Obs::Display::isOpen() )
-            return a.exec();
-        else
-            return 0;
-#else
-        return 0;
+            res = a.exec();
 #endif
+        if( rt.traceDiag() )
+        {
+            out << "aborted traces:" << endl;
+            foreach( const QString& line, rt.renderTraceAborts() )
+                out << "  " << line << endl;
+        }
+        return res;
     }else
     {
         if( outPath.isEmpty() )
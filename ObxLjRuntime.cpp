@@ -29,11 +29,13 @@
 #include "ObxLjbcGen.h"
 #include "ObxCGen.h"
 #include <LjTools/Engine2.h>
+#include <lua.hpp>
 #include <QFile>
 #include <QDir>
 #include <QBuffer>
 #include <QtDebug>
 #include <QTime>
+#include <algorithm>
 using namespace Obx;
 
 static void printLoadError(Lua::Engine2* lua, const QByteArray& what)
@@ -73,7 +75,8 @@ static bool preloadLib( Project* pro, const QByteArray& name )
     return true;
 }
 
-LjRuntime::LjRuntime(QObject*p):QObject(p), d_jitEnabled(true),d_buildErrors(false)
+LjRuntime::LjRuntime(QObject*p):QObject(p), d_jitEnabled(true),d_buildErrors(false),d_traceDiag(false),
+    d_breakTraps(false),d_dbgArmed(false)
 {
     d_pro = new Project(this);
 
@@ -82,7 +85,7 @@ LjRuntime::LjRuntime(QObject*p):QObject(p), d_jitEnabled(true),d_buildErrors(fal
     prepareEngine();
 }
 
-bool LjRuntime::compile(bool doGenerate)
+bool LjRuntime::compile(bool doGenerate, const QStringList* changed)
 {
     if( d_pro->useBuiltInOakwood() )
     {
@@ -98,7 +101,7 @@ bool LjRuntime::compile(bool doGenerate)
     }
     const quint32 errCount = d_pro->getErrs()->getErrCount();
     const QTime start = QTime::currentTime();
-    if( !d_pro->reparse() )
+    if( !( changed ? d_pro->reparse(*changed) : d_pro->reparse() ) )
         return false;
     qDebug() << "recompiled in" << start.msecsTo(QTime::currentTime()) << "[ms]";
     if( doGenerate )
@@ -111,13 +114,25 @@ bool LjRuntime::run()
     if( !compile(true) )
         return false;
 
-    if( !loadLibraries() )
-        return false;
+    const bool armed = d_breakTraps && d_lua->isDebug();
+    if( armed )
+    {
+        d_lua->setDebug(false); // the break traps reinstall the line hook on demand
+        QHash<QByteArray,QSet<quint32> >::const_iterator i;
+        for( i = d_breaks.begin(); i != d_breaks.end(); ++i )
+        {
+            foreach( quint32 row, i.value() )
+                setBreakFlag(i.key(), row, true);
+        }
+    }
+    d_dbgArmed = armed;
 
-    if( !loadBytecode() )
-        return false;
+    const bool res = loadLibraries() && loadBytecode() && executeMain();
 
-    return executeMain();
+    d_dbgArmed = false;
+    if( armed )
+        d_lua->setDebug(true);
+    return res;
 }
 
 bool LjRuntime::loadLibraries()
@@ -239,7 +254,13 @@ LjRuntime::BytecodeList LjRuntime::findByteCode(const QString& filePath) const
     return res;
 }
 
-bool LjRuntime::saveBytecode(const QString& outPath, const QString& suffix) const
+bool LjRuntime::generateBytecode(const QSet<QByteArray>& upToDate)
+{
+    generate(upToDate);
+    return !d_buildErrors;
+}
+
+bool LjRuntime::saveBytecode(const QString& outPath, const QString& suffix, const QSet<QByteArray>& upToDate) const
 {
     QDir dir(outPath);
     if( !dir.exists() && !dir.mkpath(outPath) )
@@ -249,6 +270,8 @@ bool LjRuntime::saveBytecode(const QString& outPath, const QString& suffix) cons
     }
     for( int i = 0; i < d_byteCode.size(); i++ )
     {
+        if( upToDate.contains(d_byteCode[i].first->getName()) )
+            continue;
 #if 0
         if( d_byteCode[i].first->d_fullName.size() > 1 )
         {
@@ -282,13 +305,143 @@ void LjRuntime::setJitEnabled(bool on)
     d_lua->setJit(on);
 }
 
-void LjRuntime::generate()
+void LjRuntime::addBreak(const QByteArray& module, quint32 row)
+{
+    d_breaks[module].insert(row);
+    setBreakFlag(module, row, true);
+}
+
+void LjRuntime::removeBreak(const QByteArray& module, quint32 row)
+{
+    d_breaks[module].remove(row);
+    setBreakFlag(module, row, false);
+}
+
+void LjRuntime::setBreakFlag(const QByteArray& module, quint32 row, bool on)
+{
+    // obxlj.breakTable(module)[row] = on or nil; the generated code reads the same table on each row
+    lua_State* L = d_lua->getCtx();
+    lua_getglobal(L, "obxlj");
+    if( !lua_istable(L, -1) )
+    {
+        lua_pop(L, 1);
+        return;
+    }
+    lua_getfield(L, -1, "breakTable");
+    lua_pushstring(L, module.constData());
+    lua_call(L, 1, 1);
+    if( on )
+        lua_pushboolean(L, 1);
+    else
+        lua_pushnil(L);
+    lua_rawseti(L, -2, row);
+    lua_pop(L, 2);
+}
+
+void LjRuntime::setTraceDiag(bool on)
+{
+    d_traceDiag = on;
+    d_lua->executeCmd( on ? "obxlj.startTraceDiag()" : "obxlj.stopTraceDiag()" );
+}
+
+static QByteArray findProc( Scope* s, quint32 defined )
+{
+    foreach( const Ref<Named>& n, s->d_order )
+    {
+        if( n->getTag() != Thing::T_Procedure )
+            continue;
+        Procedure* p = cast<Procedure*>(n.data());
+        if( p->d_loc.packed() == defined )
+            return p->d_name;
+        const QByteArray name = findProc(p, defined);
+        if( !name.isEmpty() )
+            return p->d_name + "." + name;
+    }
+    return QByteArray();
+}
+
+static bool traceAbortLessThan( const LjRuntime::TraceAbort& lhs, const LjRuntime::TraceAbort& rhs )
+{
+    return lhs.d_count > rhs.d_count;
+}
+
+QList<LjRuntime::TraceAbort> LjRuntime::getTraceAborts() const
+{
+    QList<TraceAbort> res;
+    lua_State* L = d_lua->getCtx();
+    lua_getglobal(L, "obxlj");
+    lua_getfield(L, -1, "traceAborts");
+    if( !lua_istable(L, -1) )
+    {
+        lua_pop(L, 2);
+        return res;
+    }
+    QHash<QString,Module*> mods;
+    foreach( Module* m, d_pro->getModulesToGenerate() )
+    {
+        mods.insert(m->d_file, m);
+        mods.insert(m->getName(), m);
+    }
+    lua_pushnil(L);
+    while( lua_next(L, -2) != 0 )
+    {
+        TraceAbort a;
+        lua_getfield(L, -1, "source");
+        QString source = QString::fromUtf8(lua_tostring(L, -1));
+        if( source.startsWith('@') )
+            source = source.mid(1);
+        a.d_mod = mods.value(source);
+        lua_getfield(L, -2, "line");
+        a.d_line = lua_tointeger(L, -1);
+        lua_getfield(L, -3, "start");
+        a.d_start = lua_tointeger(L, -1);
+        lua_getfield(L, -4, "count");
+        a.d_count = lua_tointeger(L, -1);
+        lua_getfield(L, -5, "reason");
+        a.d_reason = lua_tostring(L, -1);
+        lua_getfield(L, -6, "defined");
+        const quint32 defined = lua_tointeger(L, -1);
+        lua_pop(L, 7); // the six fields and the value
+        if( a.d_mod )
+        {
+            if( a.d_mod->d_loc.packed() == defined )
+                a.d_proc = "begin";
+            else
+                a.d_proc = findProc(a.d_mod, defined);
+        }
+        res.append(a);
+    }
+    lua_pop(L, 2);
+    std::sort( res.begin(), res.end(), traceAbortLessThan );
+    return res;
+}
+
+QStringList LjRuntime::renderTraceAborts() const
 {
+    // LuaJIT blacklists a trace start after about ten aborts with exponentially growing penalties
+    const quint32 blacklistThreshold = 10;
+    QStringList res;
+    foreach( const TraceAbort& a, getTraceAborts() )
+    {
+        QString what = a.d_mod ? QString::fromUtf8(a.d_mod->getName()) : QString("?");
+        if( !a.d_proc.isEmpty() )
+            what += "." + QString::fromUtf8(a.d_proc);
+        res << QString("%1x %2 %3:%4 (trace from %5:%6): %7%8").arg(a.d_count).arg(what)
+               .arg(Ob::RowCol::unpackRow2(a.d_line)).arg(Ob::RowCol::unpackCol2(a.d_line))
+               .arg(Ob::RowCol::unpackRow2(a.d_start)).arg(Ob::RowCol::unpackCol2(a.d_start))
+               .arg(QString::fromUtf8(a.d_reason))
+               .arg( a.d_count >= blacklistThreshold ? " [likely blacklisted]" : "" );
+    }
+    return res;
+}
+
+void LjRuntime::generate(const QSet<QByteArray>& upToDate)
+{
+    const quint32 errCount = d_pro->getErrs()->getErrCount(); // also counts the errors of the deferred bodies
     QList<Module*> mods = d_pro->getModulesToGenerate();
     d_byteCode.clear();
     d_buildErrors = false;
 
-    const quint32 errCount = d_pro->getErrs()->getErrCount();
     QSet<Module*> generated;
     foreach( Module* m, mods )
     {
@@ -305,6 +458,8 @@ void LjRuntime::generate()
             if( m->d_externC )
             {
                 LjbcGen::allocateSlots(m);
+                if( upToDate.contains(m->getName()) )
+                    continue;
                 qDebug() << "generating binding for" << m->getName();
                 QBuffer buf;
                 buf.open(QIODevice::WriteOnly);
@@ -351,11 +506,13 @@ void LjRuntime::generate()
                     {
                         generated.insert(inst);
                         LjbcGen::allocateSlots(inst);
-                        generate(inst);
+                        if( !upToDate.contains(inst->getName()) )
+                            generate(inst);
                     }
                 }
                 // module is generated after the generic instances it depends on because there are required slots
-                generate(m);
+                if( !upToDate.contains(m->getName()) )
+                    generate(m);
             }
         }
     }
@@ -369,7 +526,7 @@ void LjRuntime::generate(Module* m)
     //qDebug() << "generating" << m->getName();
     QBuffer buf;
     buf.open(QIODevice::WriteOnly);
-    LjbcGen::translate(m, &buf, false, d_pro->getErrs() );
+    LjbcGen::translate(m, &buf, false, d_pro->getErrs(), d_breakTraps && d_lua->isDebug() );
     buf.close();
     d_byteCode << qMakePair(m,buf.buffer());
 }
@@ -389,5 +546,7 @@ void LjRuntime::prepareEngine()
     d_lua->addLibrary(Lua::Engine2::OS);
     // d_lua->setJit(false); // must be called after addLibrary! doesn't have any effect otherwise
     loadLuaLib( d_lua, "obxlj" );
+    if( d_traceDiag )
+        d_lua->executeCmd("obxlj.startTraceDiag()");
 }
 
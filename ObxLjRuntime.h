@@ -22,6 +22,9 @@
 
 #include <QObject>
 #include <QPair>
+#include <QStringList>
+#include <QHash>
+#include <QSet>
 
 namespace Lua
 {
@@ -44,7 +47,7 @@ namespace Obx
         Project* getPro() const { return d_pro; }
         Lua::Engine2* getLua() const { return d_lua; }
 
-        bool compile(bool doGenerate );
+        bool compile(bool doGenerate, const QStringList* changed = 0 ); // changed: see Project::reparse
         bool run();
         bool loadLibraries();
         bool loadBytecode();
@@ -53,14 +56,40 @@ namespace Obx
 
         QByteArray findByteCode(Module*)const;
         BytecodeList findByteCode( const QString& filePath ) const;
-        bool saveBytecode(const QString& outPath, const QString& suffix = ".lua") const;
+        bool saveBytecode(const QString& outPath, const QString& suffix = ".lua",
+                          const QSet<QByteArray>& upToDate = QSet<QByteArray>() ) const; // names not to write
+        bool generateBytecode( const QSet<QByteArray>& upToDate ); // translates all but the named modules
         bool hasBytecode() const { return !d_byteCode.isEmpty(); }
         bool hasBuildErrors() const { return d_buildErrors; }
 
         void setJitEnabled(bool);
         bool jitEnabled() const { return d_jitEnabled; }
+
+        struct TraceAbort
+        {
+            Module* d_mod;
+            QByteArray d_proc, d_reason;
+            quint32 d_line, d_start, d_count; // packed row/col of abort and trace start
+            TraceAbort():d_mod(0),d_line(0),d_start(0),d_count(0){}
+        };
+        void setTraceDiag(bool);
+        bool traceDiag() const { return d_traceDiag; }
+        QList<TraceAbort> getTraceAborts() const; // ordered by decreasing frequency
+        QStringList renderTraceAborts() const;
+
+        // with break traps enabled the generator emits a check of the row flag in the module break table
+        // (obxlj.breakTable) on each row instead of running the whole program with the line hook; only rows with
+        // a set flag call the debugger, which installs the hook until the user continues. The check is a plain
+        // table load, so LuaJIT keeps tracing through it, and add/removeBreak update the flags while the program
+        // runs. Stepping still uses the line hook of Engine2, which switches the JIT off while stepping.
+        void setBreakTraps(bool on) { d_breakTraps = on; }
+        bool breakTraps() const { return d_breakTraps; }
+        bool isDebugArmed() const { return d_dbgArmed; } // true while running hookless with break traps
+        void addBreak( const QByteArray& module, quint32 row );
+        void removeBreak( const QByteArray& module, quint32 row );
     protected:
-        void generate();
+        void setBreakFlag( const QByteArray& module, quint32 row, bool on );
+        void generate(const QSet<QByteArray>& upToDate = QSet<QByteArray>()); // slots of all modules are allocated
         void generate(Module* m);
         void prepareEngine();
 
@@ -70,6 +99,10 @@ namespace Obx
         BytecodeList d_byteCode;
         bool d_jitEnabled;
         bool d_buildErrors;
+        bool d_traceDiag;
+        bool d_breakTraps;
+        bool d_dbgArmed;
+        QHash<QByteArray,QSet<quint32> > d_breaks;
     };
 }
 
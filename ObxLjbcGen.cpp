@@ -23,6 +23,7 @@
 #include "ObxModel.h"
 #include "ObxEvaluator.h"
 #include "ObxCGen.h"
+#include "ObxLowering.h"
 #include <LjTools/LuaJitComposer.h>
 #include <QDir>
 #include <QtDebug>
@@ -142,7 +143,9 @@ struct ObxLjbcGenImp : public AstVisitor
         // module is the top level proc and each other proc is a sub-proc of module; there are no sub-sub-procs
         typedef QHash<quint8,QPair<quint16,QByteArray> > Upvals; // slot -> upval; only for sub-procs; slot is in module and read-only
         Upvals upvals;
-        Ctx(Scope* s = 0):scope(s) { }
+        QSet<Statement*> tailCalls; // see Lowering::findTailCalls
+        int tailStart; // pc of the LOOP where a self tail call restarts the body, or -1
+        Ctx(Scope* s = 0):scope(s),tailStart(-1) { }
 
         int usedCount() const { return pool.d_slots.count(); }
 
@@ -193,8 +196,11 @@ struct ObxLjbcGenImp : public AstVisitor
     QList <quint32> exitJumps; // TODO: must be a separate list for each (nested) LOOP
     QByteArray system;
     bool passingThis;
+    bool breakTraps; // each row checks its flag in the module break table, see emitBreakTrap
+    quint32 lastTrapRow;
 
-    ObxLjbcGenImp():err(0),thisMod(0),ownsErr(false),modSlot(0),obxlj(0),curClass(0),stripped(0),passingThis(false){}
+    ObxLjbcGenImp():err(0),thisMod(0),ownsErr(false),modSlot(0),obxlj(0),curClass(0),stripped(0),passingThis(false),
+        breakTraps(false),lastTrapRow(0){}
 
     struct Accessor
     {
@@ -260,6 +266,8 @@ struct ObxLjbcGenImp : public AstVisitor
         bc.TNEW( modSlot, ctx.back().pool.d_frameSize, 0, me->d_loc.packed() );
 
         emitImport( "obxlj", obxlj, me->d_loc );
+        if( breakTraps )
+            emitBreakTable( me->d_loc );
 
         foreach( Import* imp, me->d_imports )
             imp->accept(this);
@@ -409,6 +417,22 @@ struct ObxLjbcGenImp : public AstVisitor
                 ctx.back().buySlots(1); // reserve slot for outer frame at the end of param list
 #endif
 
+            ctx.back().tailCalls = Lowering::findTailCalls(me);
+            if( Lowering::canLoop(me) && !me->d_upvalSource ) // closures would keep the old parameter values
+            {
+                foreach( Statement* s, ctx.back().tailCalls )
+                {
+                    if( Lowering::calledProc(Lowering::callOf(s)) == me )
+                    {
+                        // the locals are initialized again when a self tail call restarts the body; the body
+                        // is a loop like any other, so the JIT can record it as a loop
+                        bc.LOOP( ctx.back().pool.d_frameSize, 0, me->d_loc.packed() ); // tail loop
+                        ctx.back().tailStart = bc.getCurPc();
+                        break;
+                    }
+                }
+            }
+
             foreach( const Ref<Named>& n, me->d_order )
             {
                 const int tag = n->getTag();
@@ -435,6 +459,9 @@ struct ObxLjbcGenImp : public AstVisitor
         foreach( const Ref<Statement>& s, me->d_body )
             s->accept(this);
 
+        if( ctx.back().tailStart >= 0 )
+            bc.patch(ctx.back().tailStart); // the loop is left by the return
+
         if( me->d_body.isEmpty() || me->d_body.last()->getTag() != Thing::T_Return )
             emitReturn( pt, 0, me->d_end );
             // we need the full emitReturn here instead of only bc.RET(me->d_end.packed()), because there
@@ -521,10 +548,37 @@ struct ObxLjbcGenImp : public AstVisitor
         CHECK_SLOTS_COUNT(0);
     }
 
+    bool emitTailLoop( Statement* s )
+    {
+        ArgExpr* ae = Lowering::callOf(s);
+        if( ctx.back().tailStart < 0 || Lowering::calledProc(ae) != ctx.back().scope )
+            return false; // LuaJIT has no tail calls to other procedures here since RET follows each CALL
+        // the arguments replace the parameters and the body starts over
+        ProcType* pt = cast<Procedure*>(ctx.back().scope)->getProcType();
+        Q_ASSERT( pt->d_formals.size() == ae->d_args.size() );
+        const int n = ae->d_args.size();
+        for( int i = 0; i < n; i++ )
+            ae->d_args[i]->accept(this);
+        if( slotStack.size() < n )
+            return true; // error already reported
+        for( int i = 0; i < n; i++ )
+            bc.MOV(pt->d_formals[i]->d_slot, slotStack[slotStack.size() - n + i], ae->d_loc.packed() );
+        for( int i = 0; i < n; i++ )
+            releaseSlot();
+        emitJMP( ctx.back().tailStart - bc.getCurPc() - 2, ae->d_loc.packed() ); // jump to the LOOP
+        return true;
+    }
+
     void visit( Call* me)
     {
+        emitBreakTrap(me->d_loc);
         CHECK_SLOTS_START();
         Q_ASSERT( me->d_what );
+        if( ctx.back().tailCalls.contains(me) && emitTailLoop(me) )
+        {
+            CHECK_SLOTS_COUNT(0);
+            return;
+        }
         me->d_what->accept(this);
         releaseSlot();
         CHECK_SLOTS_COUNT(0);
@@ -532,14 +586,21 @@ struct ObxLjbcGenImp : public AstVisitor
 
     void visit( Return* me )
     {
+        emitBreakTrap(me->d_loc);
         CHECK_SLOTS_START();
         Q_ASSERT( ctx.back().scope->getTag() == Thing::T_Procedure );
+        if( ctx.back().tailCalls.contains(me) && emitTailLoop(me) )
+        {
+            CHECK_SLOTS_COUNT(0);
+            return;
+        }
         emitReturn( cast<Procedure*>(ctx.back().scope)->getProcType(), me->d_what.data(), me->d_loc );
         CHECK_SLOTS_COUNT(0);
     }
 
     void visit( Assign* me )
     {
+        emitBreakTrap(me->d_loc);
         CHECK_SLOTS_START();
         Q_ASSERT( me->d_rhs );
         me->d_rhs->accept(this);
@@ -575,54 +636,17 @@ struct ObxLjbcGenImp : public AstVisitor
 
     void visit( ForLoop* me)
     {
+        emitBreakTrap(me->d_loc);
         CHECK_SLOTS_START();
-        // i := from;
-        // WHILE i <= to DO statements; i := i + by END
-        // WHILE i >= to DO statements; i := i + by END
-
-        Ref<Assign> a = new Assign();
-        a->d_loc = me->d_loc;
-        a->d_lhs = me->d_id;
-        a->d_rhs = me->d_from;
-
-        Ref<IfLoop> loop = new IfLoop();
-        loop->d_loc = me->d_loc;
-        loop->d_op = IfLoop::WHILE;
-
-        Ref<BinExpr> cond = new BinExpr();
-        cond->d_loc = me->d_loc;
-        if( me->d_byVal.toInt() > 0 )
-            cond->d_op = BinExpr::LEQ;
-        else
-            cond->d_op = BinExpr::GEQ;
-        cond->d_lhs = me->d_id;
-        cond->d_rhs = me->d_to;
-        cond->d_type = me->d_id->d_type.data();
-        loop->d_if.append( cond.data() );
-
-        loop->d_then.append( me->d_do );
-
-        Ref<BinExpr> add = new BinExpr();
-        add->d_loc = me->d_loc;
-        add->d_op = BinExpr::ADD;
-        add->d_lhs = me->d_id;
-        add->d_rhs = me->d_by;
-        add->d_type = me->d_by->d_type;
-
-        Ref<Assign> a2 = new Assign();
-        a2->d_loc = me->d_loc;
-        a2->d_lhs = me->d_id;
-        a2->d_rhs = add.data();
-
-        loop->d_then.back().append( a2.data() );
-
-        a->accept(this);
-        loop->accept(this);
+        const StatSeq ss = Lowering::lowerFor(me);
+        for( int i = 0; i < ss.size(); i++ )
+            ss[i]->accept(this);
         CHECK_SLOTS_COUNT(0);
     }
 
     void visit( IfLoop* me)
     {
+        emitBreakTrap(me->d_loc);
         CHECK_SLOTS_START();
         switch( me->d_op )
         {
@@ -647,6 +671,7 @@ struct ObxLjbcGenImp : public AstVisitor
 
     void visit( Exit* me)
     {
+        emitBreakTrap(me->d_loc);
         CHECK_SLOTS_START();
         emitJMP( 0, me->d_loc.packed() );
         exitJumps << bc.getCurPc();
@@ -655,6 +680,7 @@ struct ObxLjbcGenImp : public AstVisitor
 
     void visit( CaseStmt* me)
     {
+        emitBreakTrap(me->d_loc);
         CHECK_SLOTS_START();
         if( me->d_typeCase )
             emitTypeCase(me);
@@ -677,51 +703,76 @@ struct ObxLjbcGenImp : public AstVisitor
         CHECK_SLOTS_START();
         const int res = ctx.back().buySlots(1);
 
-        bc.KSET(res, 0, me->d_loc.packed() );
-
-        const quint8 addElemToSet = ctx.back().buySlots(1);
-        fetchObxlibMember(addElemToSet,9,me->d_loc); // addElemToSet
-        const quint8 addRangeToSet = ctx.back().buySlots(1);
-        fetchObxlibMember(addRangeToSet,10,me->d_loc); // module.addRangeToSet
-
+        // constant elements and ranges are folded; the remaining elements are or'ed in with a single bit.bor call
+        quint32 mask = 0;
+        QList<BinExpr*> ranges;
+        QList<Expression*> elems;
         for( int i = 0; i < me->d_parts.size(); i++ )
         {
             BinExpr* bi = me->d_parts[i]->getTag() == Thing::T_BinExpr ? cast<BinExpr*>( me->d_parts[i].data() ) : 0;
+            qint64 l, r;
             if( bi && bi->d_op == BinExpr::Range )
             {
-                const int tmp = ctx.back().buySlots(4,true);
-                bc.MOV(tmp, addRangeToSet, me->d_loc.packed() );
-                bc.MOV(tmp+1, res, me->d_loc.packed() );
-                if( bi->d_lhs )
-                {
-                    bi->d_lhs->accept(this);
-                    bc.MOV(tmp+2, slotStack.back(), me->d_loc.packed() );
-                    releaseSlot();
-                }
-                if( bi->d_rhs )
+                if( Lowering::isConstInt(bi->d_lhs.data(), l) && Lowering::isConstInt(bi->d_rhs.data(), r)
+                        && l >= 0 && r < Literal::SET_BIT_LEN )
                 {
-                    bi->d_rhs->accept(this);
-                    bc.MOV(tmp+3, slotStack.back(), me->d_loc.packed() );
-                    releaseSlot();
-                }
-                bc.CALL(tmp,1,3, me->d_loc.packed() );
-                bc.MOV(res, tmp, me->d_loc.packed() );
-                ctx.back().sellSlots(tmp,4);
-            }else
+                    for( qint64 j = l; j <= r; j++ )
+                        mask |= 1u << j;
+                }else
+                    ranges << bi;
+            }else if( Lowering::isConstInt(me->d_parts[i].data(), l) && l >= 0 && l < Literal::SET_BIT_LEN )
+                mask |= 1u << l;
+            else
+                elems << me->d_parts[i].data();
+        }
+
+        // same representation as the result of the bit operations
+        bc.KSET(res, qint32(mask), me->d_loc.packed() );
+
+        if( !elems.isEmpty() )
+        {
+            const int tmp = ctx.back().buySlots(2 + elems.size(),true);
+            fetchObxlibMember(tmp,12,me->d_loc); // bit.bor
+            bc.MOV(tmp+1, res, me->d_loc.packed() );
+            for( int i = 0; i < elems.size(); i++ )
             {
-                const int tmp = ctx.back().buySlots(3,true);
-                bc.MOV(tmp, addElemToSet, me->d_loc.packed() );
-                bc.MOV(tmp+1, res, me->d_loc.packed() );
-                me->d_parts[i]->accept(this);
+                const int sh = ctx.back().buySlots(3,true);
+                fetchObxlibMember(sh,35,me->d_loc); // bit.lshift
+                bc.KSET(sh+1, 1, me->d_loc.packed() );
+                elems[i]->accept(this);
+                bc.MOV(sh+2, slotStack.back(), me->d_loc.packed() );
+                releaseSlot();
+                bc.CALL(sh,1,2, me->d_loc.packed() );
+                bc.MOV(tmp+2+i, sh, me->d_loc.packed() );
+                ctx.back().sellSlots(sh,3);
+            }
+            bc.CALL(tmp,1,1 + elems.size(), me->d_loc.packed() );
+            bc.MOV(res, tmp, me->d_loc.packed() );
+            ctx.back().sellSlots(tmp,2 + elems.size());
+        }
+
+        for( int i = 0; i < ranges.size(); i++ )
+        {
+            BinExpr* bi = ranges[i];
+            const int tmp = ctx.back().buySlots(4,true);
+            fetchObxlibMember(tmp,10,me->d_loc); // module.addRangeToSet
+            bc.MOV(tmp+1, res, me->d_loc.packed() );
+            if( bi->d_lhs )
+            {
+                bi->d_lhs->accept(this);
                 bc.MOV(tmp+2, slotStack.back(), me->d_loc.packed() );
                 releaseSlot();
-                bc.CALL(tmp,1,2, me->d_loc.packed() );
-                bc.MOV(res, tmp, me->d_loc.packed() );
-                ctx.back().sellSlots(tmp,3);
             }
+            if( bi->d_rhs )
+            {
+                bi->d_rhs->accept(this);
+                bc.MOV(tmp+3, slotStack.back(), me->d_loc.packed() );
+                releaseSlot();
+            }
+            bc.CALL(tmp,1,3, me->d_loc.packed() );
+            bc.MOV(res, tmp, me->d_loc.packed() );
+            ctx.back().sellSlots(tmp,4);
         }
-        ctx.back().sellSlots(addElemToSet);
-        ctx.back().sellSlots(addRangeToSet);
         slotStack.push_back(res);
         CHECK_SLOTS_COUNT(1);
     }
@@ -1346,6 +1397,17 @@ struct ObxLjbcGenImp : public AstVisitor
         ctx.back().sellSlots(tmp,2);
     }
 
+    void emitBreakTable( const RowCol& loc )
+    {
+        // mod["@dbg"] = obxlj.breakTable(modname), shared with LjRuntime which sets the row flags
+        const int tmp = ctx.back().buySlots(2,true);
+        bc.TGETi(tmp,obxlj,56,loc.packed());
+        bc.KSET(tmp+1,thisMod->getName(),loc.packed());
+        bc.CALL(tmp,1,1,loc.packed());
+        bc.TSET(tmp,modSlot,"@dbg",loc.packed());
+        ctx.back().sellSlots(tmp,2);
+    }
+
     void fetchObxlib( quint8 to, const RowCol& loc )
     {
         if( ctx.back().scope == thisMod )
@@ -1354,6 +1416,30 @@ struct ObxLjbcGenImp : public AstVisitor
             bc.UGET(to, ctx.back().resolveUpval(obxlj,"@obxlj"), loc.packed() );
     }
 
+    void emitBreakTrap( const RowCol& loc )
+    {
+        // Instead of a line hook which runs on every line (and keeps the JIT from compiling anything) the first
+        // statement of each row checks the row flag in the module break table and only calls the debugger if it is
+        // set; the check is an ordinary table load, so traces run through rows without a breakpoint, and the flags
+        // can be changed while the program runs. The CALL deliberately carries the unpacked row so the hook sees a
+        // line change on return.
+        if( !breakTraps || loc.d_row == lastTrapRow )
+            return;
+        lastTrapRow = loc.d_row;
+        const int tmp = ctx.back().buySlots(2,true);
+        fetchModule(tmp,loc);
+        bc.TGET(tmp,tmp,"@dbg",loc.packed());
+        bc.KSET(tmp+1,qint32(loc.d_row),loc.packed());
+        bc.TGET(tmp,tmp,tmp+1,loc.packed());
+        bc.ISF(tmp,loc.packed());
+        emitJMP(0,loc.packed());
+        const quint32 pc = bc.getCurPc();
+        fetchObxlibMember(tmp,55,loc); // DBGBREAK
+        bc.CALL(tmp,0,0,loc.d_row);
+        bc.patch(pc);
+        ctx.back().sellSlots(tmp,2);
+    }
+
     void fetchObxlibMember( quint8 to, quint8 what, const RowCol& loc )
     {
         if( ctx.back().scope == thisMod )
@@ -1902,6 +1988,31 @@ struct ObxLjbcGenImp : public AstVisitor
             break;
         case BuiltIn::INC:
         case BuiltIn::DEC:
+            if( !Lowering::isSimple(ae->d_args.first().data()) )
+            {
+                // read-modify-write with the table and key of the designator evaluated only once
+                Accessor acc;
+                accessor( ae->d_args.first().data(), acc );
+                const quint8 tmp = ctx.back().buySlots(2);
+                emitAccToSlot( tmp, acc, ae->d_loc );
+                if( ae->d_args.size() == 1 )
+                    bc.KSET(tmp+1, 1, ae->d_loc.packed() );
+                else
+                {
+                    Q_ASSERT( ae->d_args.size() == 2 );
+                    ae->d_args.last()->accept(this);
+                    Q_ASSERT( !slotStack.isEmpty() );
+                    bc.MOV(tmp+1, slotStack.back(), ae->d_loc.packed() );
+                    releaseSlot();
+                }
+                if( bi->d_func == BuiltIn::INC )
+                    bc.ADD(tmp, tmp, tmp+1, ae->d_loc.packed() );
+                else
+                    bc.SUB(tmp, tmp, tmp+1, ae->d_loc.packed() );
+                emitSlotToAcc(acc, tmp, ae->d_loc);
+                ctx.back().sellSlots(tmp,2);
+                releaseAcc(acc);
+            }else
             {
                 Ref<BinExpr> add = new BinExpr();
                 add->d_lhs = ae->d_args.first();
@@ -3092,97 +3203,27 @@ struct ObxLjbcGenImp : public AstVisitor
 
     void emitPlainCase( CaseStmt* me )
     {
-        // first rewrite the AST with 'if' instead of complex 'case'
-
-        Ref<IfLoop> ifl = new IfLoop();
-        ifl->d_op = IfLoop::IF;
-        ifl->d_loc = me->d_loc;
-
-        Ref<BaseType> boolean = new BaseType(Type::BOOLEAN);
-
-        for( int i = 0; i < me->d_cases.size(); i++ )
+        Lowering::Temp tmp;
+        int slot = -1;
+        if( Lowering::needsCaseTemp(me) )
         {
-            const CaseStmt::Case& c = me->d_cases[i];
-
-            QList< Ref<Expression> > ors;
-            for( int j = 0; j < c.d_labels.size(); j++ )
-            {
-                Expression* l = c.d_labels[j].data();
-                // TODO: avoid redundant evaluations using temp vars
-                bool done = false;
-                if( l->getTag() == Thing::T_BinExpr )
-                {
-                    BinExpr* bi = cast<BinExpr*>( l );
-                    if( bi->d_op == BinExpr::Range )
-                    {
-                        Ref<BinExpr> _and = new BinExpr();
-                        _and->d_op = BinExpr::AND;
-                        _and->d_loc = l->d_loc;
-                        _and->d_type = boolean.data();
-
-                        Ref<BinExpr> lhs = new BinExpr();
-                        lhs->d_op = BinExpr::GEQ;
-                        lhs->d_lhs = me->d_exp;
-                        lhs->d_rhs = bi->d_lhs;
-                        lhs->d_loc = l->d_loc;
-                        lhs->d_type = boolean.data();
-
-                        Ref<BinExpr> rhs = new BinExpr();
-                        rhs->d_op = BinExpr::LEQ;
-                        rhs->d_lhs = me->d_exp;
-                        rhs->d_rhs = bi->d_rhs;
-                        rhs->d_loc = l->d_loc;
-                        rhs->d_type = boolean.data();
-
-                        _and->d_lhs = lhs.data();
-                        _and->d_rhs = rhs.data();
-
-                        ors << _and.data();
-                        done = true;
-                    }
-                }
-                if( !done )
-                {
-                    Ref<BinExpr> eq = new BinExpr();
-                    eq->d_op = BinExpr::EQ;
-                    eq->d_lhs = me->d_exp;
-                    eq->d_rhs = l;
-                    eq->d_loc = l->d_loc;
-                    eq->d_type = boolean.data();
-
-                    ors << eq.data();
-                }
-            }
-            Q_ASSERT( !ors.isEmpty() );
-            if( ors.size() == 1 )
-                ifl->d_if.append( ors.first() );
-            else
-            {
-                Q_ASSERT( ors.size() > 1 );
-                Ref<BinExpr> bi = new BinExpr();
-                bi->d_op = BinExpr::OR;
-                bi->d_lhs = ors[0];
-                bi->d_rhs = ors[1];
-                bi->d_loc = ors[1]->d_loc;
-                bi->d_type = boolean.data();
-                for( int i = 2; i < ors.size(); i++ )
-                {
-                    Ref<BinExpr> tmp = new BinExpr();
-                    tmp->d_op = BinExpr::OR;
-                    tmp->d_lhs = bi.data();
-                    tmp->d_type = boolean.data();
-                    bi = tmp;
-                    bi->d_rhs = ors[i];
-                    bi->d_loc = ors[i]->d_loc;
-                }
-                ifl->d_if.append( bi.data() );
-            }
-
-            ifl->d_then.append( c.d_block );
+            // the case expression is evaluated once and each label is compared with the temp
+            me->d_exp->accept(this);
+            if( slotStack.isEmpty() )
+                return; // already reported
+            slot = ctx.back().buySlots(1);
+            bc.MOV(slot, slotStack.back(), me->d_exp->d_loc.packed() );
+            releaseSlot();
+            tmp = Lowering::makeTemp(me->d_exp->d_type.data(), ctx.back().scope, "#temp", me->d_exp->d_loc );
+            tmp.d_var->d_slot = slot;
+            tmp.d_var->d_slotValid = true;
         }
 
-        // and now generate code for the if
+        Ref<IfLoop> ifl = Lowering::lowerCase(me, tmp.d_use.data());
         ifl->accept(this);
+
+        if( slot >= 0 )
+            ctx.back().sellSlots(slot);
     }
 
     void accessor(Expression* desig, Accessor& acc )
@@ -3805,7 +3846,7 @@ bool LjbcGen::allocateSlots(Module* me, QIODevice* out)
     return true;
 }
 
-bool LjbcGen::translate(Module* m, QIODevice* out, bool strip, Ob::Errors* errs)
+bool LjbcGen::translate(Module* m, QIODevice* out, bool strip, Ob::Errors* errs, bool breakTraps)
 {
     Q_ASSERT( m != 0 && out != 0 );
 
@@ -3827,6 +3868,7 @@ bool LjbcGen::translate(Module* m, QIODevice* out, bool strip, Ob::Errors* errs)
     imp.thisMod = m;
     imp.stripped = strip;
     imp.system = Lexer::getSymbol("SYSTEM");
+    imp.breakTraps = breakTraps;
 
     if( errs == 0 )
     {
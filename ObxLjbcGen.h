@@ -38,7 +38,7 @@ namespace Obx
     public:
         // static bool translate(Model*,const QString& outdir, const QString& mod, bool strip = false, Ob::Errors* = 0 );
         static bool allocateSlots(Module*me, QIODevice* out = 0);
-        static bool translate(Module*, QIODevice* out, bool strip = false, Ob::Errors* = 0 );
+        static bool translate(Module*, QIODevice* out, bool strip = false, Ob::Errors* = 0, bool breakTraps = false );
         // static bool allocateDef(Module*, QIODevice* out,Ob::Errors* = 0);
     private:
         LjbcGen();
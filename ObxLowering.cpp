@@ -0,0 +1,558 @@
+/*
+* Copyright 2021 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Oberon+ parser/compiler library.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include "ObxLowering.h"
+#include "ObxValidator.h"
+using namespace Obx;
+
+static inline Type* derefed( Type* t )
+{
+    if( t )
+        return t->derefed();
+    else
+        return 0;
+}
+
+StatSeq Lowering::lowerFor(ForLoop* me)
+{
+    // TODO: caclulate TO only once!
+
+    Ref<Assign> a = new Assign();
+    a->d_loc = me->d_loc;
+    a->d_lhs = me->d_id;
+    a->d_rhs = me->d_from;
+
+    Ref<IfLoop> loop = new IfLoop();
+    loop->d_loc = me->d_loc;
+    loop->d_op = IfLoop::WHILE;
+
+    Ref<BinExpr> cond = compare( me->d_byVal.toInt() > 0 ? BinExpr::LEQ : BinExpr::GEQ,
+                                 me->d_id.data(), me->d_to.data(), me->d_loc );
+    loop->d_if.append( cond.data() );
+
+    loop->d_then.append( me->d_do );
+
+    Ref<BinExpr> add = new BinExpr();
+    add->d_loc = me->d_loc;
+    add->d_op = BinExpr::ADD;
+    add->d_lhs = me->d_id;
+    add->d_rhs = me->d_by;
+    add->d_type = me->d_id->d_type;
+
+    Ref<Assign> a2 = new Assign();
+    a2->d_loc = me->d_loc;
+    a2->d_lhs = me->d_id;
+    a2->d_rhs = add.data();
+
+    loop->d_then.back().append( a2.data() );
+
+    return StatSeq() << a.data() << loop.data();
+}
+
+Ref<IfLoop> Lowering::lowerWhile(IfLoop* me)
+{
+    Q_ASSERT( me->d_op == IfLoop::WHILE );
+
+    Ref<IfLoop> loop = new IfLoop();
+    loop->d_op = IfLoop::LOOP;
+    loop->d_loc = me->d_loc;
+
+    Ref<IfLoop> conds = new IfLoop();
+    conds->d_op = IfLoop::IF;
+    conds->d_loc = me->d_loc;
+
+    conds->d_if = me->d_if;
+    conds->d_then = me->d_then;
+
+    Q_ASSERT( me->d_else.isEmpty() );
+    Ref<Exit> ex = new Exit();
+    ex->d_loc = me->d_loc;
+    conds->d_else << ex.data();
+
+    loop->d_then << ( StatSeq() << conds.data() );
+    return loop;
+}
+
+Ref<IfLoop> Lowering::lowerCase(CaseStmt* me, Expression* subject)
+{
+    // TODO: if else missing then abort if no case hit
+    if( me->d_cases.isEmpty() && me->d_typeCase )
+        return Ref<IfLoop>();
+
+    Ref<IfLoop> ifl = new IfLoop();
+    ifl->d_op = IfLoop::IF;
+    ifl->d_loc = me->d_loc;
+
+    Ref<BaseType> boolean = new BaseType(Type::BOOLEAN);
+    Ref<Expression> exp = subject ? subject : me->d_exp.data();
+
+    for( int i = 0; i < me->d_cases.size(); i++ )
+    {
+        const CaseStmt::Case& c = me->d_cases[i];
+
+        if( me->d_typeCase )
+        {
+            Q_ASSERT( c.d_labels.size() == 1 );
+            Type* td = derefed(c.d_labels.first()->d_type.data());
+
+            Ref<BinExpr> eq = new BinExpr();
+            if( td && td->getBaseType() == Type::NIL )
+                eq->d_op = BinExpr::EQ;
+            else
+                eq->d_op = BinExpr::IS;
+            eq->d_lhs = exp;
+            eq->d_rhs = c.d_labels.first();
+            eq->d_loc = me->d_exp->d_loc;
+            eq->d_type = boolean.data();
+
+            ifl->d_if.append(eq.data());
+            ifl->d_then.append( c.d_block );
+            continue;
+        }
+
+        QList< Ref<Expression> > ors;
+        for( int j = 0; j < c.d_labels.size(); j++ )
+        {
+            Expression* l = c.d_labels[j].data();
+            BinExpr* bi = l->getTag() == Thing::T_BinExpr ? cast<BinExpr*>( l ) : 0;
+            if( bi && bi->d_op == BinExpr::Range )
+            {
+                // TODO: consider lhs > rhs
+                Ref<BinExpr> _and = new BinExpr();
+                _and->d_op = BinExpr::AND;
+                _and->d_loc = l->d_loc;
+                _and->d_type = boolean.data();
+                _and->d_lhs = compare( BinExpr::GEQ, exp.data(), bi->d_lhs.data(), l->d_loc ).data();
+                _and->d_rhs = compare( BinExpr::LEQ, exp.data(), bi->d_rhs.data(), l->d_loc ).data();
+                ors << _and.data();
+            }else
+                ors << compare( BinExpr::EQ, exp.data(), l, l->d_loc ).data();
+        }
+        Q_ASSERT( !ors.isEmpty() );
+        Ref<Expression> cond = ors.first();
+        for( int j = 1; j < ors.size(); j++ )
+        {
+            Ref<BinExpr> tmp = new BinExpr();
+            tmp->d_op = BinExpr::OR;
+            tmp->d_lhs = cond;
+            tmp->d_rhs = ors[j];
+            tmp->d_loc = ors[j]->d_loc;
+            tmp->d_type = boolean.data();
+            cond = tmp.data();
+        }
+        ifl->d_if.append( cond );
+        ifl->d_then.append( c.d_block );
+    }
+
+    ifl->d_else = me->d_else;
+    return ifl;
+}
+
+bool Lowering::isSimple(Expression* e)
+{
+    if( e == 0 )
+        return true;
+    switch( e->getTag() )
+    {
+    case Thing::T_Literal:
+        return true;
+    case Thing::T_IdentLeaf:
+    case Thing::T_IdentSel:
+        {
+            if( e->getTag() == Thing::T_IdentSel )
+            {
+                // only qualified idents, i.e. M.x, not field selections
+                Named* mod = cast<IdentSel*>(e)->d_sub->getIdent();
+                if( mod == 0 || mod->getTag() != Thing::T_Import )
+                    return false;
+            }
+            Named* id = e->getIdent();
+            if( id == 0 )
+                return false;
+            switch( id->getTag() )
+            {
+            case Thing::T_Const:
+            case Thing::T_Variable:
+            case Thing::T_LocalVar:
+            case Thing::T_Parameter:
+                return true;
+            default:
+                return false;
+            }
+        }
+    default:
+        return false;
+    }
+}
+
+bool Lowering::isConstInt(Expression* e, qint64& val)
+{
+    if( e == 0 )
+        return false;
+    if( e->getTag() == Thing::T_Literal )
+    {
+        Literal* l = cast<Literal*>(e);
+        if( l->d_vtype != Literal::Integer )
+            return false;
+        val = l->d_val.toLongLong();
+        return true;
+    }
+    if( e->getTag() == Thing::T_IdentLeaf || e->getTag() == Thing::T_IdentSel )
+    {
+        Named* id = e->getIdent();
+        if( id == 0 || id->getTag() != Thing::T_Const )
+            return false;
+        Const* c = cast<Const*>(id);
+        if( c->d_vtype != Literal::Integer )
+            return false;
+        val = c->d_val.toLongLong();
+        return true;
+    }
+    return false;
+}
+
+bool Lowering::needsCaseTemp(CaseStmt* me)
+{
+    if( me->d_typeCase || isSimple(me->d_exp.data()) )
+        return false;
+    int count = 0;
+    for( int i = 0; i < me->d_cases.size(); i++ )
+        count += me->d_cases[i].d_labels.size();
+    if( count < 2 )
+        return false;
+    Type* t = derefed(me->d_exp->d_type.data());
+    // the case expression is an integer, a character or an enumeration; strings are not supported
+    return t && ( t->getTag() == Thing::T_Enumeration || ( t->getTag() == Thing::T_BaseType && !t->isString() ) );
+}
+
+Lowering::Temp Lowering::makeTemp(Type* t, Scope* s, const QByteArray& name, const Ob::RowCol& loc)
+{
+    Temp res;
+    res.d_var = new LocalVar();
+    res.d_var->d_name = name;
+    res.d_var->d_type = t;
+    res.d_var->d_scope = s;
+    res.d_var->d_loc = loc;
+    res.d_use = new IdentLeaf( res.d_var.data(), loc, 0, t, RhsRole );
+    return res;
+}
+
+QSet<Statement*> Lowering::findTailCalls(Procedure* p)
+{
+    QSet<Statement*> res;
+    findTailCalls( p->d_body, p->getProcType()->d_return.isNull(), res );
+    return res;
+}
+
+void Lowering::findTailCalls(const StatSeq& ss, bool trailing, QSet<Statement*>& res)
+{
+    // a RETURN with a call is a tail call wherever it is; a call statement only if it is the last statement
+    // on each path through the body of a proper procedure
+    for( int i = 0; i < ss.size(); i++ )
+    {
+        Statement* s = ss[i].data();
+        const bool last = trailing && i == ss.size() - 1;
+        switch( s->getTag() )
+        {
+        case Thing::T_Return:
+            if( callOf(s) )
+                res.insert(s);
+            break;
+        case Thing::T_Call:
+            if( last && callOf(s) )
+            {
+                ArgExpr* ae = callOf(s);
+                Type* t = ae->d_sub->d_type.data() ? ae->d_sub->d_type->derefed() : 0;
+                if( t && t->getTag() == Thing::T_ProcType && cast<ProcType*>(t)->d_return.isNull() )
+                    res.insert(s);
+            }
+            break;
+        case Thing::T_IfLoop:
+            {
+                IfLoop* l = cast<IfLoop*>(s);
+                const bool branch = last && ( l->d_op == IfLoop::IF || l->d_op == IfLoop::WITH );
+                for( int j = 0; j < l->d_then.size(); j++ )
+                    findTailCalls( l->d_then[j], branch, res );
+                findTailCalls( l->d_else, branch, res );
+            }
+            break;
+        case Thing::T_ForLoop:
+            findTailCalls( cast<ForLoop*>(s)->d_do, false, res );
+            break;
+        case Thing::T_CaseStmt:
+            {
+                CaseStmt* c = cast<CaseStmt*>(s);
+                for( int j = 0; j < c->d_cases.size(); j++ )
+                    findTailCalls( c->d_cases[j].d_block, last, res );
+                findTailCalls( c->d_else, last, res );
+            }
+            break;
+        }
+    }
+}
+
+ArgExpr* Lowering::callOf(Statement* s)
+{
+    Expression* e = 0;
+    if( s->getTag() == Thing::T_Return )
+        e = cast<Return*>(s)->d_what.data();
+    else if( s->getTag() == Thing::T_Call )
+        e = cast<Call*>(s)->d_what.data();
+    if( e && e->getTag() == Thing::T_ArgExpr && e->getUnOp() == UnExpr::CALL )
+    {
+        ArgExpr* ae = cast<ArgExpr*>(e);
+        Named* id = ae->d_sub->getIdent();
+        if( id && id->getTag() == Thing::T_BuiltIn )
+            return 0;
+        return ae;
+    }
+    return 0;
+}
+
+Procedure* Lowering::calledProc(ArgExpr* ae)
+{
+    if( ae == 0 || ae->d_sub.isNull() || ae->d_sub->getUnOp() == UnExpr::DEREF )
+        return 0; // super call
+    Named* id = ae->d_sub->getIdent();
+    if( id == 0 || id->getTag() != Thing::T_Procedure )
+        return 0;
+    Procedure* p = cast<Procedure*>(id);
+    if( !p->d_receiver.isNull() )
+        return 0; // dispatched dynamically
+    return p;
+}
+
+bool Lowering::canLoop(Procedure* p)
+{
+    if( !p->d_receiver.isNull() )
+        return false;
+    ProcType* pt = p->getProcType();
+    if( pt->d_unsafe )
+        return false;
+    for( int i = 0; i < pt->d_formals.size(); i++ )
+    {
+        Parameter* f = pt->d_formals[i].data();
+        Type* t = derefed(f->d_type.data());
+        if( f->isVarParam() || t == 0 || t->isStructured() )
+            return false;
+    }
+    return true;
+}
+
+void Lowering::markReadOnlyUpvals(Procedure* p)
+{
+    QSet<Named*> candidates;
+    foreach( const Ref<Named>& n, p->d_order )
+    {
+        const int tag = n->getTag();
+        if( tag != Thing::T_LocalVar && tag != Thing::T_Parameter )
+            continue;
+        n->d_upvalReadOnly = false;
+        Type* td = derefed(n->d_type.data());
+        if( n->d_upvalSource && !n->isVarParam() && td && !td->isStructured() )
+            candidates.insert(n.data());
+    }
+    if( candidates.isEmpty() )
+        return;
+    findWrites( p, true, candidates );
+    foreach( Named* n, candidates )
+        n->d_upvalReadOnly = true;
+}
+
+void Lowering::findWrites(Procedure* p, bool own, QSet<Named*>& res)
+{
+    // own is true for the body of the procedure declaring the candidates; there they can be modified
+    // directly since no nested procedure runs at the same time, but no alias must escape
+    findWrites( p->d_body, own, res );
+    foreach( const Ref<Named>& n, p->d_order )
+    {
+        if( n->getTag() == Thing::T_Procedure )
+            findWrites( cast<Procedure*>(n.data()), false, res );
+    }
+}
+
+void Lowering::findWrites(const StatSeq& ss, bool own, QSet<Named*>& res)
+{
+    for( int i = 0; i < ss.size() && !res.isEmpty(); i++ )
+    {
+        Statement* s = ss[i].data();
+        switch( s->getTag() )
+        {
+        case Thing::T_Assign:
+            {
+                Assign* a = cast<Assign*>(s);
+                if( !own )
+                    removeWritten( a->d_lhs.data(), res );
+                findWrites( a->d_lhs.data(), own, res );
+                findWrites( a->d_rhs.data(), own, res );
+            }
+            break;
+        case Thing::T_Call:
+            findWrites( cast<Call*>(s)->d_what.data(), own, res );
+            break;
+        case Thing::T_Return:
+            findWrites( cast<Return*>(s)->d_what.data(), own, res );
+            break;
+        case Thing::T_IfLoop:
+            {
+                IfLoop* l = cast<IfLoop*>(s);
+                foreach( const Ref<Expression>& e, l->d_if )
+                    findWrites( e.data(), own, res );
+                for( int j = 0; j < l->d_then.size(); j++ )
+                    findWrites( l->d_then[j], own, res );
+                findWrites( l->d_else, own, res );
+            }
+            break;
+        case Thing::T_ForLoop:
+            {
+                ForLoop* l = cast<ForLoop*>(s);
+                if( !own )
+                    removeWritten( l->d_id.data(), res );
+                findWrites( l->d_from.data(), own, res );
+                findWrites( l->d_to.data(), own, res );
+                findWrites( l->d_by.data(), own, res );
+                findWrites( l->d_do, own, res );
+            }
+            break;
+        case Thing::T_CaseStmt:
+            {
+                CaseStmt* c = cast<CaseStmt*>(s);
+                findWrites( c->d_exp.data(), own, res );
+                for( int j = 0; j < c->d_cases.size(); j++ )
+                {
+                    foreach( const Ref<Expression>& e, c->d_cases[j].d_labels )
+                        findWrites( e.data(), own, res );
+                    findWrites( c->d_cases[j].d_block, own, res );
+                }
+                findWrites( c->d_else, own, res );
+            }
+            break;
+        }
+    }
+}
+
+void Lowering::findWrites(Expression* e, bool own, QSet<Named*>& res)
+{
+    if( e == 0 || res.isEmpty() )
+        return;
+    switch( e->getTag() )
+    {
+    case Thing::T_UnExpr:
+    case Thing::T_IdentSel:
+        {
+            UnExpr* ue = cast<UnExpr*>(e);
+            if( ue->d_op == UnExpr::ADDROF )
+                removeWritten( ue->d_sub.data(), res );
+            findWrites( ue->d_sub.data(), own, res );
+        }
+        break;
+    case Thing::T_ArgExpr:
+        {
+            ArgExpr* ae = cast<ArgExpr*>(e);
+            findWrites( ae->d_sub.data(), own, res );
+            if( ae->d_op == UnExpr::CALL && !ae->d_sub.isNull() )
+            {
+                Named* id = ae->d_sub->getIdent();
+                if( id && id->getTag() == Thing::T_BuiltIn )
+                {
+                    switch( cast<BuiltIn*>(id)->d_func )
+                    {
+                    case BuiltIn::ABS: case BuiltIn::ODD: case BuiltIn::LEN: case BuiltIn::LSL: case BuiltIn::ASR:
+                    case BuiltIn::ROR: case BuiltIn::FLOOR: case BuiltIn::FLT: case BuiltIn::ORD: case BuiltIn::CHR:
+                    case BuiltIn::ASSERT: case BuiltIn::MAX: case BuiltIn::MIN: case BuiltIn::CAP:
+                    case BuiltIn::LONG: case BuiltIn::SHORT: case BuiltIn::ASH: case BuiltIn::ENTIER:
+                    case BuiltIn::BITS: case BuiltIn::CAST: case BuiltIn::STRLEN: case BuiltIn::WCHR:
+                    case BuiltIn::PRINTLN: case BuiltIn::BITAND: case BuiltIn::BITNOT: case BuiltIn::BITOR:
+                    case BuiltIn::BITXOR: case BuiltIn::BITSHL: case BuiltIn::BITSHR: case BuiltIn::BITASR:
+                    case BuiltIn::SYS_VAL: case BuiltIn::SYS_ROT: case BuiltIn::SYS_LSH:
+                        break; // only read their arguments
+                    case BuiltIn::SYS_ADR:
+                    case BuiltIn::ADR:
+                        foreach( const Ref<Expression>& a, ae->d_args )
+                            removeWritten( a.data(), res );
+                        break;
+                    default:
+                        // INC, DEC, NEW, COPY, GET etc. modify their argument in place
+                        if( !own )
+                        {
+                            foreach( const Ref<Expression>& a, ae->d_args )
+                                removeWritten( a.data(), res );
+                        }
+                        break;
+                    }
+                }else
+                {
+                    Type* t = derefed(ae->d_sub->d_type.data());
+                    if( t && t->getTag() == Thing::T_ProcType )
+                    {
+                        ProcType* pt = cast<ProcType*>(t);
+                        for( int i = 0; i < pt->d_formals.size() && i < ae->d_args.size(); i++ )
+                        {
+                            if( pt->d_formals[i]->d_var && !pt->d_formals[i]->d_const )
+                                removeWritten( ae->d_args[i].data(), res );
+                        }
+                    }
+                }
+            }
+            foreach( const Ref<Expression>& a, ae->d_args )
+                findWrites( a.data(), own, res );
+        }
+        break;
+    case Thing::T_BinExpr:
+        findWrites( cast<BinExpr*>(e)->d_lhs.data(), own, res );
+        findWrites( cast<BinExpr*>(e)->d_rhs.data(), own, res );
+        break;
+    case Thing::T_SetExpr:
+        foreach( const Ref<Expression>& p, cast<SetExpr*>(e)->d_parts )
+            findWrites( p.data(), own, res );
+        break;
+    }
+}
+
+void Lowering::removeWritten(Expression* e, QSet<Named*>& res)
+{
+    // only the whole variable is of interest, since the candidates are not structured
+    if( e && e->getTag() == Thing::T_IdentLeaf )
+        res.remove( e->getIdent() );
+}
+
+quint8 Lowering::inclusiveType(Type* lhs, Type* rhs)
+{
+    if( lhs == 0 || rhs == 0 )
+        return 0;
+    const quint8 l = lhs->getBaseType();
+    const quint8 r = rhs->getBaseType();
+    if( ( l == Type::CHAR && r == Type::STRING ) ||
+        ( l == Type::WCHAR && r == Type::WSTRING ) ||
+        ( l == Type::WCHAR && r == Type::STRING ) )
+        return r;
+    return Validator::inclusiveType( l, r ).first;
+}
+
+Ref<BinExpr> Lowering::compare(quint8 op, Expression* lhs, Expression* rhs, const Ob::RowCol& loc)
+{
+    Ref<BinExpr> res = new BinExpr();
+    res->d_op = op;
+    res->d_lhs = lhs;
+    res->d_rhs = rhs;
+    res->d_loc = loc;
+    res->d_inclType = inclusiveType(derefed(lhs->d_type.data()), derefed(rhs->d_type.data()) );
+    res->d_type = new BaseType(Type::BOOLEAN);
+    return res;
+}
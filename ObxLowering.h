@@ -0,0 +1,98 @@
+#ifndef OBXLOWERING_H
+#define OBXLOWERING_H
+
+/*
+* Copyright 2021 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Oberon+ parser/compiler library.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <Oberon/ObxAst.h>
+
+namespace Obx
+{
+    // Rewrites the compound statements into the primitive forms the code generators understand, i.e.
+    // IF, LOOP, EXIT and assignments. The results are typed like the validator would have done it, so
+    // the generators can render them as if they came from the parser. The original nodes are not modified.
+    // CGen2 and CilGen lower FOR, WHILE and CASE with these, LjbcGen FOR and CASE.
+    // These are helpers each generator calls where it sees fit on the AST, not passes over an IR of their
+    // own; there is no pass manager, so the analyses below are run by the generators on their own.
+    class Lowering
+    {
+    public:
+        // i := from; WHILE i <= to DO statements; i := i + by END (or >= if by is negative)
+        static StatSeq lowerFor( ForLoop* );
+        // LOOP IF cond THEN statements ELSIF ... ELSE EXIT END END
+        static Ref<IfLoop> lowerWhile( IfLoop* );
+        // IF exp IS T1 THEN ... or IF exp = l1 OR exp >= l2 AND exp <= l3 THEN ...; the arms exclude each other;
+        // returns null if there is nothing to do; if subject is set it replaces exp in the generated conditions
+        static Ref<IfLoop> lowerCase( CaseStmt*, Expression* subject = 0 );
+
+        // true if e can be evaluated more than once without side effects and at the cost of a load,
+        // i.e. literals, constants and whole variables; everything else is worth a temporary
+        static bool isSimple( Expression* e );
+        // true if e is an integer literal or refers to an integer constant; val is set to its value
+        static bool isConstInt( Expression* e, qint64& val );
+        // true if the value of the case expression should be stored in a temporary before comparing it
+        static bool needsCaseTemp( CaseStmt* );
+        // There is no general CSE pass; the CASE subject, INC/DEC designators and the arguments of MIN/MAX use
+        // isSimple to avoid repeated evaluation. These sites still evaluate a non-simple expression repeatedly:
+        // - the TO expression of a FOR lowered by lowerFor, once per iteration (LjbcGen's FORI evaluates it once);
+        // - the subject of a type CASE, e.g. a[f(i)].p, once per label in the IS tests;
+        // - the designator of a type-bound procedure assigned to a procedure variable in CGen2, twice;
+        // - the designator of a WITH with several guards, once per guard.
+
+        // a local variable of the given scope which is not declared in the source, and a use of it;
+        // the code generator has to allocate its storage and set the slot if required
+        struct Temp
+        {
+            Ref<LocalVar> d_var;
+            Ref<IdentLeaf> d_use;
+        };
+        static Temp makeTemp( Type*, Scope*, const QByteArray& name, const Ob::RowCol& loc );
+
+        // the RETURN f(...) and the call statements of a proper procedure after which nothing but the
+        // return from the procedure happens
+        static QSet<Statement*> findTailCalls( Procedure* );
+        // the call expression of a statement found by findTailCalls
+        static ArgExpr* callOf( Statement* );
+        // the procedure statically called, or null for calls of type-bound procedures, super calls, procedure
+        // variables and built-ins
+        static Procedure* calledProc( ArgExpr* );
+        // true if a call of the procedure to itself can be replaced by assigning the arguments to the
+        // parameters and restarting the body, i.e. all parameters are non-structured value parameters
+        static bool canLoop( Procedure* );
+
+        // sets d_upvalReadOnly of the locals and value parameters of the procedure used by nested procedures which
+        // are neither modified by a nested procedure nor passed to a VAR parameter or to ADR; for these the
+        // nested procedures can receive a copy of the value instead of its address. There is no lifting step:
+        // the generators already emit nested procedures at module level (C functions, static CIL methods, LuaJIT
+        // sub-functions of the module), and one which captures nothing gets no extra arguments.
+        static void markReadOnlyUpvals( Procedure* );
+
+        static quint8 inclusiveType(Type* lhs, Type* rhs);
+        static Ref<BinExpr> compare( quint8 op, Expression* lhs, Expression* rhs, const Ob::RowCol& loc );
+    private:
+        static void findTailCalls( const StatSeq&, bool trailing, QSet<Statement*>& );
+        static void findWrites( Procedure*, bool own, QSet<Named*>& );
+        static void findWrites( const StatSeq&, bool own, QSet<Named*>& );
+        static void findWrites( Expression*, bool own, QSet<Named*>& );
+        static void removeWritten( Expression*, QSet<Named*>& );
+        Lowering() {}
+    };
+}
+
+#endif // OBXLOWERING_H
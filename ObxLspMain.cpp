@@ -0,0 +1,258 @@
+/*
+* Copyright 2021 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Oberon+ parser/compiler library.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include "ObxLspServer.h"
+#include "ObxProject.h"
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QDir>
+#include <QUrl>
+#include <QtDebug>
+#include <algorithm>
+#include <stdio.h>
+#include <ctype.h>
+
+static void sendToStdout( const QByteArray& msg, void* )
+{
+    fwrite( msg.constData(), 1, msg.size(), stdout );
+    fflush( stdout );
+}
+
+static void collect( const QByteArray& msg, void* data )
+{
+    static_cast<QByteArrayList*>(data)->append(msg);
+}
+
+static int s_id = 0;
+static qint64 request( Obx::LspServer& server, const QString& method, const QJsonObject& params )
+{
+    QJsonObject msg;
+    msg["jsonrpc"] = QString("2.0");
+    msg["id"] = ++s_id;
+    msg["method"] = method;
+    msg["params"] = params;
+    const QByteArray json = QJsonDocument(msg).toJson(QJsonDocument::Compact);
+    QElapsedTimer t;
+    t.start();
+    server.onMessage(json);
+    return t.nsecsElapsed();
+}
+
+static void notify( Obx::LspServer& server, const QString& method, const QJsonObject& params )
+{
+    QJsonObject msg;
+    msg["jsonrpc"] = QString("2.0");
+    msg["method"] = method;
+    msg["params"] = params;
+    server.onMessage(QJsonDocument(msg).toJson(QJsonDocument::Compact));
+}
+
+static void report( QTextStream& out, const char* what, QList<qint64> ns )
+{
+    if( ns.isEmpty() )
+        return;
+    std::sort( ns.begin(), ns.end() );
+    qint64 sum = 0;
+    foreach( qint64 n, ns )
+        sum += n;
+    out << qSetFieldWidth(16) << left << what << reset
+        << " n=" << ns.size()
+        << " mean=" << double(sum) / ns.size() / 1e6
+        << " median=" << ns[ns.size() / 2] / 1e6
+        << " p95=" << ns[ns.size() * 95 / 100] / 1e6
+        << " max=" << ns.last() / 1e6 << " [ms]" << endl;
+}
+
+static int bench( Obx::LspServer& server, Obx::Project* pro, const QString& file, int maxPos )
+{
+    // scripted client: opens the file, then asks for definition, hover and references at each identifier
+    // and finally simulates edits which each require a reparse, asking for a hover while the reparse runs
+    QTextStream out(stdout);
+    QFile f(file);
+    if( !f.open(QIODevice::ReadOnly) )
+    {
+        qCritical() << "cannot open file" << file;
+        return -1;
+    }
+    const QByteArray text = f.readAll();
+    const QString uri = QUrl::fromLocalFile(QFileInfo(file).absoluteFilePath()).toString();
+
+    QByteArrayList responses;
+    server.setSend(collect, &responses);
+
+    QJsonObject params;
+    if( pro->getFiles().isEmpty() )
+        params["rootUri"] = QUrl::fromLocalFile(QFileInfo(file).absolutePath()).toString();
+    QList<qint64> init;
+    QElapsedTimer t;
+    t.start();
+    request(server, "initialize", params);
+    server.waitForReparse();
+    init << t.nsecsElapsed();
+    notify(server, "initialized", QJsonObject());
+
+    QJsonObject doc;
+    doc["uri"] = uri;
+    doc["languageId"] = QString("obx");
+    doc["version"] = 1;
+    doc["text"] = QString::fromUtf8(text);
+    params = QJsonObject();
+    params["textDocument"] = doc;
+    notify(server, "textDocument/didOpen", params);
+
+    QList<qint64> defs, hovers, refs, edits, during;
+    QJsonObject first; // the position of the first identifier, hovered while reparsing
+    const QByteArrayList lines = text.split('\n');
+    int count = 0;
+    for( int l = 0; l < lines.size() && count < maxPos; l++ )
+    {
+        const QByteArray& line = lines[l];
+        for( int c = 0; c < line.size() && count < maxPos; c++ )
+        {
+            const char ch = line[c];
+            const bool start = ( ::isalpha(ch) || ch == '_' ) &&
+                    ( c == 0 || !( ::isalnum(line[c-1]) || line[c-1] == '_' ) );
+            if( !start )
+                continue;
+            count++;
+            QJsonObject td;
+            td["uri"] = uri;
+            QJsonObject pos;
+            pos["line"] = l;
+            pos["character"] = c;
+            params = QJsonObject();
+            params["textDocument"] = td;
+            params["position"] = pos;
+            if( first.isEmpty() )
+                first = params;
+            defs << request(server, "textDocument/definition", params);
+            hovers << request(server, "textDocument/hover", params);
+            QJsonObject ctx;
+            ctx["includeDeclaration"] = true;
+            params["context"] = ctx;
+            refs << request(server, "textDocument/references", params);
+        }
+    }
+
+    for( int i = 0; i < 5; i++ )
+    {
+        QJsonObject td;
+        td["uri"] = uri;
+        td["version"] = i + 2;
+        QJsonObject change;
+        change["text"] = QString::fromUtf8(text);
+        params = QJsonObject();
+        params["textDocument"] = td;
+        params["contentChanges"] = QJsonArray() << change;
+        t.restart();
+        notify(server, "textDocument/didChange", params);
+        server.reparse(); // what the server does when the delay elapses
+        if( !first.isEmpty() )
+            during << request(server, "textDocument/hover", first); // answered from the previous model
+        server.waitForReparse(); // includes publishing the diagnostics
+        edits << t.nsecsElapsed();
+    }
+
+    out << "files: " << pro->getFiles().size() << " positions: " << count
+        << " messages sent: " << responses.size() << endl;
+    out.setRealNumberNotation(QTextStream::FixedNotation);
+    out.setRealNumberPrecision(3);
+    report(out, "initialize", init);
+    report(out, "definition", defs);
+    report(out, "hover", hovers);
+    report(out, "references", refs);
+    report(out, "edit+reparse", edits);
+    report(out, "hover in reparse", during);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    a.setOrganizationName("Rochus Keller");
+    a.setOrganizationDomain("https://github.com/rochus-keller/Oberon");
+    a.setApplicationName("OBXLSP");
+    a.setApplicationVersion("2023-10-14");
+
+    // stdout is reserved for the protocol; all logging goes to stderr
+    QTextStream err(stderr);
+
+    Obx::Project pro;
+    QString path, benchFile;
+    int maxPos = 1000;
+    QStringList args = QCoreApplication::arguments();
+    for( int i = 1; i < args.size(); i++ ) // arg 0 enthaelt Anwendungspfad
+    {
+        if(  args[i] == "-h" )
+        {
+            err << "OBXLSP version: " << a.applicationVersion() <<
+                         " author: me@rochus-keller.ch  license: GPL" << endl;
+            err << "usage: OBXLSP [options] [project file or directory]" << endl;
+            err << "  language server for Oberon+ communicating over stdin/stdout; without a project the" << endl;
+            err << "  root of the workspace sent with the initialize request is used." << endl;
+            err << "options:" << endl;
+            err << "  -bench=file   run a scripted client on file and report the latencies" << endl;
+            err << "  -n=x          maximum number of positions queried by -bench (default 1000)" << endl;
+            err << "  -h            display this information" << endl;
+            return 0;
+        }else if( args[i].startsWith("-bench=") )
+            benchFile = args[i].mid(7);
+        else if( args[i].startsWith("-n=") )
+            maxPos = args[i].mid(3).toInt();
+        else if( !args[ i ].startsWith( '-' ) )
+            path = args[i];
+        else
+        {
+            err << "error: invalid command line option " << args[i] << endl;
+            return -1;
+        }
+    }
+
+    if( !path.isEmpty() )
+    {
+        QFileInfo info(path);
+        if( info.isDir() )
+            pro.initializeFromDir( QDir(info.absoluteFilePath()), true );
+        else if( !pro.loadFrom(info.absoluteFilePath()) )
+        {
+            err << "cannot load project " << path << endl;
+            return -1;
+        }
+    }
+
+    Obx::LspServer server(&pro);
+    if( !benchFile.isEmpty() )
+        return bench(server, &pro, benchFile, maxPos);
+
+    server.setSend(sendToStdout, 0);
+    Obx::LspReader reader;
+    QObject::connect( &reader, SIGNAL(sigMessage(QByteArray)), &server, SLOT(onMessage(QByteArray)),
+                      Qt::QueuedConnection );
+    QObject::connect( &reader, SIGNAL(sigClosed()), &a, SLOT(quit()), Qt::QueuedConnection );
+    reader.start();
+    const int res = a.exec();
+    reader.terminate(); // blocked in reading stdin
+    reader.wait();
+    return res;
+}
@@ -0,0 +1,487 @@
+/*
+* Copyright 2021 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Oberon+ parser/compiler library.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include "ObxLspServer.h"
+#include "ObxProject.h"
+#include "ObxAst.h"
+#include "ObErrors.h"
+#include "ObFileCache.h"
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QCoreApplication>
+#include <QFileInfo>
+#include <QFile>
+#include <QDir>
+#include <QUrl>
+#include <QTimer>
+#include <QtDebug>
+#include <stdio.h>
+using namespace Obx;
+
+enum { MethodNotFound = -32601 }; // JSON-RPC error code
+
+static bool preloadLib( Project* pro, const QByteArray& name )
+{
+    QFile f( QString(":/oakwood/%1.Def" ).arg(name.constData() ) );
+    if( !f.open(QIODevice::ReadOnly) )
+    {
+        qCritical() << "unknown preload" << name;
+        return false;
+    }
+    pro->getFc()->addFile( name, f.readAll(), true );
+    return true;
+}
+
+static QJsonObject position( quint32 row, quint32 col )
+{
+    // Oberon+ rows and columns start with 1, LSP lines and characters with 0
+    QJsonObject res;
+    res["line"] = int(row > 0 ? row - 1 : 0);
+    res["character"] = int(col > 0 ? col - 1 : 0);
+    return res;
+}
+
+static QJsonObject range( quint32 row, quint32 col, int len )
+{
+    QJsonObject res;
+    res["start"] = position(row, col);
+    res["end"] = position(row, col + len);
+    return res;
+}
+
+static void configure( Project* to, const Project* from )
+{
+    PackageList pl;
+    foreach( const Project::FileGroup& g, from->getFileGroups() )
+    {
+        Package p;
+        p.d_path = g.d_package;
+        foreach( Project::File* f, g.d_files )
+            p.d_files << f->d_filePath;
+        pl << p;
+    }
+    to->initializeFromPackageList(pl);
+    to->setOptions(from->getOptions());
+    to->setUseBuiltInOakwood(from->useBuiltInOakwood());
+    to->setUseBuiltInObSysInner(from->useBuiltInObSysInner());
+    to->setInt16(from->getInt16());
+}
+
+LspServer::LspServer(Project* pro, QObject* p):QObject(p),d_pro(pro),d_send(0),d_data(0),d_shutdown(false),
+    d_again(false)
+{
+    Q_ASSERT( pro );
+    d_next = new Project(this); // created here because the model constructor uses the lexer symbols
+    d_pro->getErrs()->setReportToConsole(false); // stdout is the protocol channel
+    d_pro->getErrs()->setRecord(true);
+    d_next->getErrs()->setReportToConsole(false);
+    d_next->getErrs()->setRecord(true);
+    d_worker = new LspParser(this);
+    connect( d_worker, SIGNAL(finished()), this, SLOT(onReparsed()) ); // queued, emitted by the worker
+    d_delay = new QTimer(this);
+    d_delay->setSingleShot(true);
+    d_delay->setInterval(200);
+    connect( d_delay, SIGNAL(timeout()), this, SLOT(onReparse()) );
+}
+
+LspServer::~LspServer()
+{
+    d_worker->wait();
+}
+
+void LspServer::setSend(LspServer::Send s, void* data)
+{
+    d_send = s;
+    d_data = data;
+}
+
+void LspServer::setReparseDelay(int ms)
+{
+    d_delay->setInterval(ms);
+}
+
+void LspServer::reparse()
+{
+    d_delay->stop();
+    if( d_worker->d_pro )
+    {
+        d_again = true; // the worker parses outdated documents
+        return;
+    }
+    if( d_next->getFiles().keys().toSet() != d_pro->getFiles().keys().toSet() )
+        configure(d_next, d_pro);
+    if( d_next->useBuiltInOakwood() )
+    {
+        preloadLib(d_next,"In");
+        preloadLib(d_next,"Out");
+        preloadLib(d_next,"Files");
+        preloadLib(d_next,"Input");
+        preloadLib(d_next,"Math");
+        preloadLib(d_next,"MathL");
+        preloadLib(d_next,"Strings");
+        preloadLib(d_next,"Coroutines");
+        preloadLib(d_next,"XYplane");
+    }
+    foreach( const QString& path, d_known )
+    {
+        QHash<QString,QByteArray>::const_iterator i = d_docs.find(path);
+        if( i != d_docs.end() )
+            d_next->getFc()->addFile( path, i.value() );
+        else
+            d_next->getFc()->removeFile( path );
+    }
+    d_again = false;
+    d_worker->d_pro = d_next;
+    d_worker->start();
+}
+
+void LspServer::onReparsed()
+{
+    if( d_worker->d_pro == 0 || d_worker->isRunning() )
+        return; // already taken by waitForReparse, or the signal of an earlier run
+    d_worker->d_pro = 0;
+    qSwap(d_pro, d_next);
+    publishDiagnostics();
+    if( d_again )
+        reparse();
+}
+
+bool LspServer::waitForReparse()
+{
+    if( d_delay->isActive() )
+        reparse();
+    bool res = true;
+    while( d_worker->d_pro )
+    {
+        d_worker->wait();
+        res = d_worker->d_res;
+        onReparsed();
+    }
+    return res;
+}
+
+bool LspServer::hasPendingReparse() const
+{
+    return d_delay->isActive() || d_worker->d_pro != 0;
+}
+
+QByteArray LspServer::frame(const QByteArray& json)
+{
+    return "Content-Length: " + QByteArray::number(json.size()) + "\r\n\r\n" + json;
+}
+
+void LspServer::onMessage(const QByteArray& json)
+{
+    const QJsonObject msg = QJsonDocument::fromJson(json).object();
+    const QString method = msg.value("method").toString();
+    const QJsonValue id = msg.value("id");
+    const QJsonObject params = msg.value("params").toObject();
+    const bool isRequest = msg.contains("id");
+
+    if( method == "initialize" )
+    {
+        initialize(params);
+        QJsonObject caps;
+        caps["textDocumentSync"] = 1; // full document on each change
+        caps["definitionProvider"] = true;
+        caps["referencesProvider"] = true;
+        caps["hoverProvider"] = true;
+        QJsonObject info;
+        info["name"] = QCoreApplication::applicationName();
+        info["version"] = QCoreApplication::applicationVersion();
+        QJsonObject res;
+        res["capabilities"] = caps;
+        res["serverInfo"] = info;
+        reply(id, res);
+        reparse();
+    }else if( method == "initialized" )
+        ; // NOP
+    else if( method == "shutdown" )
+    {
+        d_shutdown = true;
+        reply(id, QJsonValue());
+    }else if( method == "exit" )
+        QCoreApplication::exit( d_shutdown ? 0 : 1 );
+    else if( method == "textDocument/didOpen" || method == "textDocument/didChange" )
+    {
+        const QJsonObject doc = params.value("textDocument").toObject();
+        QString text;
+        if( method == "textDocument/didOpen" )
+            text = doc.value("text").toString();
+        else
+        {
+            const QJsonArray changes = params.value("contentChanges").toArray();
+            if( changes.isEmpty() )
+                return;
+            text = changes.last().toObject().value("text").toString();
+        }
+        const QString path = toPath(doc.value("uri").toString());
+        d_docs[path] = text.toUtf8();
+        d_known.insert(path);
+        d_delay->start(); // requests are answered from the current model until the reparse is done
+    }else if( method == "textDocument/didClose" )
+    {
+        d_docs.remove( toPath(params.value("textDocument").toObject().value("uri").toString()) );
+        d_delay->start();
+    }else if( method == "textDocument/didSave" )
+        ; // NOP, the content is already known from didChange
+    else if( method == "textDocument/definition" )
+        reply(id, definition(params));
+    else if( method == "textDocument/references" )
+        reply(id, references(params));
+    else if( method == "textDocument/hover" )
+        reply(id, hover(params));
+    else if( isRequest )
+        replyError(id, MethodNotFound, QString("method not supported: %1").arg(method));
+    // unknown notifications are ignored as required by the protocol
+}
+
+void LspServer::onReparse()
+{
+    reparse();
+}
+
+void LspServer::send(const QJsonObject& msg)
+{
+    if( d_send )
+        d_send( frame(QJsonDocument(msg).toJson(QJsonDocument::Compact)), d_data );
+}
+
+void LspServer::reply(const QJsonValue& id, const QJsonValue& result)
+{
+    QJsonObject msg;
+    msg["jsonrpc"] = QString("2.0");
+    msg["id"] = id;
+    msg["result"] = result;
+    send(msg);
+}
+
+void LspServer::replyError(const QJsonValue& id, int code, const QString& message)
+{
+    QJsonObject err;
+    err["code"] = code;
+    err["message"] = message;
+    QJsonObject msg;
+    msg["jsonrpc"] = QString("2.0");
+    msg["id"] = id;
+    msg["error"] = err;
+    send(msg);
+}
+
+void LspServer::initialize(const QJsonObject& params)
+{
+    if( !d_pro->getFiles().isEmpty() )
+        return; // project already loaded from the command line
+
+    QString root = toPath(params.value("rootUri").toString());
+    if( root.isEmpty() )
+        root = params.value("rootPath").toString();
+    if( root.isEmpty() )
+        return;
+    QDir dir(root);
+    const QStringList pros = dir.entryList( QStringList() << "*.obxpro", QDir::Files, QDir::Name );
+    if( !pros.isEmpty() )
+        d_pro->loadFrom( dir.absoluteFilePath(pros.first()) );
+    else
+        d_pro->initializeFromDir( dir, true );
+}
+
+void LspServer::publishDiagnostics()
+{
+    QHash<QString,QJsonArray> diags;
+    foreach( const Ob::Errors::Entry& e, d_pro->getErrs()->getErrors() )
+    {
+        QJsonObject d;
+        d["range"] = range(e.d_line, e.d_col, 0);
+        d["severity"] = e.d_isErr ? 1 : 2;
+        d["source"] = QString("obx");
+        d["message"] = e.d_msg;
+        diags[e.d_file].append(d);
+    }
+    // files without diagnostics anymore get an empty list so the client clears them
+    foreach( const QString& file, d_diagFiles )
+    {
+        if( !diags.contains(file) )
+            diags.insert(file, QJsonArray());
+    }
+    d_diagFiles.clear();
+    QHash<QString,QJsonArray>::const_iterator i;
+    for( i = diags.begin(); i != diags.end(); ++i )
+    {
+        if( !i.value().isEmpty() )
+            d_diagFiles.insert(i.key());
+        QJsonObject params;
+        params["uri"] = toUri(i.key());
+        params["diagnostics"] = i.value();
+        QJsonObject msg;
+        msg["jsonrpc"] = QString("2.0");
+        msg["method"] = QString("textDocument/publishDiagnostics");
+        msg["params"] = params;
+        send(msg);
+    }
+}
+
+Expression* LspServer::findSymbol(const QJsonObject& params, Named** sym) const
+{
+    const QString path = toPath(params.value("textDocument").toObject().value("uri").toString());
+    const QJsonObject pos = params.value("position").toObject();
+    Expression* e = d_pro->findSymbolBySourcePos(path, pos.value("line").toInt() + 1,
+                                                  pos.value("character").toInt() + 1 );
+    if( e == 0 )
+        return 0;
+    Named* n = e->getIdent();
+    if( n == 0 )
+        return 0;
+    if( n->getTag() == Thing::T_Import && e->d_loc == n->d_loc )
+    {
+        // the import declaration itself refers to the imported module
+        Module* m = cast<Import*>(n)->d_mod.data();
+        if( m )
+            n = m;
+    }
+    *sym = n;
+    return e;
+}
+
+QJsonValue LspServer::definition(const QJsonObject& params) const
+{
+    Named* sym = 0;
+    if( findSymbol(params, &sym) == 0 )
+        return QJsonValue();
+    Module* m = sym->getTag() == Thing::T_Module ? cast<Module*>(sym) : sym->getModule();
+    if( m == 0 || m->d_file.isEmpty() || m->d_synthetic )
+        return QJsonValue(); // e.g. built-in procedures
+    QJsonObject loc;
+    loc["uri"] = toUri(m->d_file);
+    loc["range"] = range(sym->d_loc.d_row, sym->d_loc.d_col, sym->d_name.size());
+    return loc;
+}
+
+QJsonValue LspServer::references(const QJsonObject& params) const
+{
+    Named* sym = 0;
+    if( findSymbol(params, &sym) == 0 )
+        return QJsonValue();
+    QJsonArray res;
+    if( params.value("context").toObject().value("includeDeclaration").toBool() )
+    {
+        Module* m = sym->getModule();
+        if( m && !m->d_file.isEmpty() )
+        {
+            QJsonObject loc;
+            loc["uri"] = toUri(m->d_file);
+            loc["range"] = range(sym->d_loc.d_row, sym->d_loc.d_col, sym->d_name.size());
+            res.append(loc);
+        }
+    }
+    const ExpList usage = d_pro->getUsage(sym);
+    foreach( const Ref<Expression>& e, usage )
+    {
+        Module* m = e->getModule();
+        if( m == 0 || m->d_file.isEmpty() )
+            continue;
+        QJsonObject loc;
+        loc["uri"] = toUri(m->d_file);
+        loc["range"] = range(e->d_loc.d_row, e->d_loc.d_col, sym->d_name.size());
+        res.append(loc);
+    }
+    return res;
+}
+
+QJsonValue LspServer::hover(const QJsonObject& params) const
+{
+    Named* sym = 0;
+    Expression* e = findSymbol(params, &sym);
+    if( e == 0 )
+        return QJsonValue();
+    QString str = QString("%1 %2").arg(sym->getTagName())
+            .arg(QString::fromUtf8(sym->getQualifiedName().join('.')));
+    if( !sym->d_type.isNull() && sym->getTag() != Thing::T_Module )
+    {
+        const QString type = sym->d_type->pretty();
+        if( !type.isEmpty() )
+            str += ": " + type;
+    }
+    QJsonObject contents;
+    contents["kind"] = QString("plaintext");
+    contents["value"] = str;
+    QJsonObject res;
+    res["contents"] = contents;
+    res["range"] = range(e->d_loc.d_row, e->d_loc.d_col, sym->d_name.size());
+    return res;
+}
+
+QString LspServer::toPath(const QString& uri)
+{
+    if( uri.isEmpty() )
+        return QString();
+    return QUrl(uri).toLocalFile();
+}
+
+QString LspServer::toUri(const QString& path)
+{
+    return QUrl::fromLocalFile(path).toString();
+}
+
+void LspParser::run()
+{
+    d_res = d_pro->reparse();
+}
+
+void LspReader::run()
+{
+    QFile in;
+    if( !in.open(stdin, QIODevice::ReadOnly) )
+    {
+        emit sigClosed();
+        return;
+    }
+    forever
+    {
+        int len = -1;
+        forever
+        {
+            const QByteArray line = in.readLine();
+            if( line.isEmpty() )
+            {
+                emit sigClosed(); // end of input
+                return;
+            }
+            const QByteArray header = line.trimmed();
+            if( header.isEmpty() )
+                break;
+            if( header.startsWith("Content-Length:") )
+                len = header.mid(15).trimmed().toInt();
+        }
+        if( len < 0 )
+            continue;
+        QByteArray body;
+        while( body.size() < len )
+        {
+            const QByteArray chunk = in.read(len - body.size()); // blocks like fread
+            if( chunk.isEmpty() )
+            {
+                emit sigClosed();
+                return;
+            }
+            body += chunk;
+        }
+        emit sigMessage(body);
+    }
+}
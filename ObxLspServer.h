@@ -0,0 +1,117 @@
+#ifndef OBXLSPSERVER_H
+#define OBXLSPSERVER_H
+
+/*
+* Copyright 2021 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Oberon+ parser/compiler library.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <QObject>
+#include <QThread>
+#include <QJsonObject>
+#include <QJsonValue>
+#include <QSet>
+#include <QHash>
+
+class QTimer;
+
+namespace Obx
+{
+    class Project;
+    class LspParser;
+    struct Expression;
+    struct Named;
+
+    // Language Server Protocol (JSON-RPC) on top of Obx::Project; supports full text synchronization,
+    // publishDiagnostics, definition, references and hover. Requests are answered from the last parsed
+    // model; edits only update the open documents and schedule a debounced reparse, so a series of edits costs
+    // a single reparse. The reparse runs in a worker thread on a second Project (the snapshot) which gets a
+    // copy of the open documents; when it is done, the two projects swap roles and the diagnostics are
+    // published. Edits arriving meanwhile cause another reparse when the worker is done. Project is not thread
+    // safe, so the main thread only touches the snapshot while the worker is idle; and the worker is the only
+    // one running the lexer meanwhile, because Lexer::getSymbol is not thread safe either.
+    class LspServer : public QObject
+    {
+        Q_OBJECT
+    public:
+        typedef void (*Send)(const QByteArray& msg, void* data); // receives each framed message
+
+        LspServer(Project*, QObject* = 0);
+        ~LspServer();
+        void setSend( Send, void* data );
+        void setReparseDelay(int ms);
+        void reparse(); // immediately start a reparse, or another one when the running is done
+        bool waitForReparse(); // blocks until the model is current and the diagnostics are published
+        bool hasPendingReparse() const;
+        static QByteArray frame(const QByteArray& json);
+    public slots:
+        void onMessage( const QByteArray& json );
+    protected slots:
+        void onReparse();
+        void onReparsed();
+    protected:
+        void send( const QJsonObject& );
+        void reply( const QJsonValue& id, const QJsonValue& result );
+        void replyError( const QJsonValue& id, int code, const QString& msg );
+        void initialize( const QJsonObject& params );
+        void publishDiagnostics();
+        Expression* findSymbol( const QJsonObject& params, Named** sym ) const;
+        QJsonValue definition( const QJsonObject& params ) const;
+        QJsonValue references( const QJsonObject& params ) const;
+        QJsonValue hover( const QJsonObject& params ) const;
+        static QString toPath( const QString& uri );
+        static QString toUri( const QString& path );
+    private:
+        Project* d_pro; // answers the requests
+        Project* d_next; // the snapshot reparsed by the worker
+        LspParser* d_worker;
+        QTimer* d_delay;
+        Send d_send;
+        void* d_data;
+        QHash<QString,QByteArray> d_docs; // file path -> text of the open documents
+        QSet<QString> d_known; // the file paths of all documents ever opened
+        QSet<QString> d_diagFiles; // files with diagnostics published after the last reparse
+        bool d_shutdown;
+        bool d_again; // there were edits while the worker was running
+    };
+
+    // reparses a project in a separate thread; see LspServer
+    class LspParser : public QThread
+    {
+    public:
+        Project* d_pro; // set while the result is not yet taken by the server
+        bool d_res;
+        LspParser(QObject* p = 0):QThread(p),d_pro(0),d_res(false) {}
+    protected:
+        void run();
+    };
+
+    // reads Content-Length framed messages from stdin and forwards them to the main thread
+    class LspReader : public QThread
+    {
+        Q_OBJECT
+    public:
+        LspReader(QObject* p = 0):QThread(p) {}
+    signals:
+        void sigMessage( const QByteArray& json );
+        void sigClosed();
+    protected:
+        void run();
+    };
+}
+
+#endif // OBXLSPSERVER_H
@@ -32,6 +32,7 @@
 #include "ObxCilGen.h"
 #include "ObFileCache.h"
 #include "ObxCGen2.h"
+#include "ObxBuildServer.h"
 
 
 static QStringList collectFiles( const QDir& dir )
@@ -68,6 +69,35 @@ static bool preloadLib( Obx::Project* pro, const QByteArray& name )
     return true;
 }
 
+class McBuildServer : public Obx::BuildServer
+{
+public:
+    bool d_genC, d_genAsm, d_build, d_debug, d_amalgamate;
+    Obx::CGen2::Profiling d_profiling;
+    Obx::CilGen::Aot d_aot;
+    QString d_outPath, d_profile;
+    McBuildServer(Obx::Project* pro):BuildServer(pro),d_genC(false),d_genAsm(false),d_build(false),d_debug(false),
+        d_amalgamate(false),d_profiling(Obx::CGen2::NoProfiling),d_aot(Obx::CilGen::NoAot){}
+protected:
+    bool generate( const QSet<QByteArray>& upToDate )
+    {
+        if( d_genC )
+            // the profile is not part of the fingerprints and might have changed since the last build
+            return Obx::CGen2::translateAll(getPro(), d_debug, d_outPath, d_amalgamate, d_profiling, d_profile,
+                                            d_profiling == Obx::CGen2::UseProfile ? QSet<QByteArray>() : upToDate);
+        if( !Obx::CilGen::translateAll(getPro(), d_genAsm ? Obx::CilGen::Ilasm : Obx::CilGen::Pelib, d_debug,
+                                       d_outPath, upToDate ) )
+            return false;
+#ifndef QT_NO_PROCESS
+        if( d_build && d_genAsm && QProcess::execute(QDir(d_outPath).absoluteFilePath("build.sh")) < 0 )
+            return false;
+#endif
+        if( d_aot != Obx::CilGen::NoAot && ( !d_genAsm || d_build ) )
+            return Obx::CilGen::compileAot(d_outPath, d_aot); // all assemblies, not only the regenerated
+        return true;
+    }
+};
+
 int main(int argc, char *argv[])
 {
     QCoreApplication a(argc, argv);
@@ -94,6 +124,12 @@ int main(int argc, char *argv[])
     bool build = false;
     bool debug = false;
     bool genC = false;
+    bool amalgamate = false;
+    Obx::CGen2::Profiling profiling = Obx::CGen2::NoProfiling;
+    QString profile;
+    Obx::CilGen::Aot aot = Obx::CilGen::NoAot;
+    bool watch = false;
+    QString listen;
     if( args.size() <= 1 )
     {
         // if there are no args look in the application directory for a file called obxljconfig which includes
@@ -120,7 +156,13 @@ int main(int argc, char *argv[])
             out << "  -debug        generate debug information and overflow checks (CIL only)" << endl;
             out << "  -build        run the generated build.sh script (Linux only)" << endl;
             out << "  -run          run the generated run.sh script (Linux only)" << endl;
+            out << "  -aot[=full|hybrid] precompile the assemblies with the Mono AOT compiler (CIL only)" << endl;
             out << "  -c            generate C code (CIL otherwise)" << endl;
+            out << "  -amalgamate   generate all C code to a single translation unit (with -c)" << endl;
+            out << "  -profile-gen  generate C code which writes obx.profile on exit (with -c)" << endl;
+            out << "  -profile-use[=file] optimize C code based on the profile (with -c)" << endl;
+            out << "  -watch        keep running and regenerate the modules affected by changed files" << endl;
+            out << "  -listen[=name] keep running and build on requests sent to local socket name (default obxmc)" << endl;
             out << "  the following options are overridden if a project file is loaded" << endl;
             out << "  -main=A[.B]   run module A or procedure B in module A and quit" << endl;
             out << "  -oak          use built-in oakwood definitions" << endl;
@@ -143,6 +185,29 @@ int main(int argc, char *argv[])
             build = true;
         else if( args[i] == "-c" )
             genC = true;
+        else if( args[i] == "-aot" )
+            aot = Obx::CilGen::AotDefault;
+        else if( args[i] == "-aot=hybrid" )
+            aot = Obx::CilGen::AotHybrid;
+        else if( args[i] == "-aot=full" )
+            aot = Obx::CilGen::AotFull;
+        else if( args[i] == "-amalgamate" )
+            amalgamate = true;
+        else if( args[i] == "-watch" )
+            watch = true;
+        else if( args[i] == "-listen" )
+            listen = "obxmc";
+        else if( args[i].startsWith("-listen=") )
+            listen = args[i].mid(8);
+        else if( args[i] == "-profile-gen" )
+            profiling = Obx::CGen2::Instrument;
+        else if( args[i] == "-profile-use" )
+            profiling = Obx::CGen2::UseProfile;
+        else if( args[i].startsWith("-profile-use=") )
+        {
+            profiling = Obx::CGen2::UseProfile;
+            profile = args[i].mid(13);
+        }
         else if( args[i].startsWith("-out=") )
         {
             outPath = args[i].mid(5);
@@ -236,15 +301,40 @@ int main(int argc, char *argv[])
         preloadLib(&pro,"XYPlane");
     }
 
-    QTime start = QTime::currentTime();
     pro.setOptions(options);
+    if( watch || !listen.isEmpty() )
+    {
+        if( outPath.isEmpty() || run )
+        {
+            err << "-watch and -listen require -out and cannot be combined with -run" << endl;
+            return -1;
+        }
+        McBuildServer server(&pro);
+        server.d_genC = genC;
+        server.d_genAsm = genAsm;
+        server.d_build = build;
+        server.d_debug = debug;
+        server.d_amalgamate = amalgamate;
+        server.d_profiling = profiling;
+        server.d_profile = profile;
+        server.d_aot = aot;
+        server.d_outPath = outPath;
+        server.build();
+        if( watch && !server.watch() )
+            return -1;
+        if( !listen.isEmpty() && !server.listen(listen) )
+            return -1;
+        return a.exec();
+    }
+
+    QTime start = QTime::currentTime();
     if( !pro.reparse() )
         return -1;
     qDebug() << "recompiled in" << start.msecsTo(QTime::currentTime()) << "[ms]";
     start = QTime::currentTime();
     if( genC )
     {
-        Obx::CGen2::translateAll(&pro, debug, outPath);
+        Obx::CGen2::translateAll(&pro, debug, outPath, amalgamate, profiling, profile);
     }else
     {
         Obx::CilGen::How how;
@@ -266,6 +356,13 @@ int main(int argc, char *argv[])
             qDebug() << "built with ilasm in" << start.msecsTo(QTime::currentTime()) << "[ms]";
 #endif
         }
+        if( aot != Obx::CilGen::NoAot && ( !genAsm || build ) )
+        {
+            start = QTime::currentTime();
+            if( !Obx::CilGen::compileAot(outPath, aot) )
+                return -1;
+            qDebug() << "AOT compiled in" << start.msecsTo(QTime::currentTime()) << "[ms]";
+        }
         if( run )
         {
 #ifndef QT_NO_PROCESS
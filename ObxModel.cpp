@@ -26,6 +26,7 @@
 #include <QFile>
 #include <QDir>
 #include <QFileInfo>
+#include <QElapsedTimer>
 #include <QtDebug>
 #include <qhash.h>
 #include <math.h>
@@ -412,7 +413,8 @@ struct Model::CrossReferencer : public AstVisitor
 
 };
 
-Model::Model(QObject *parent) : QObject(parent),d_fillXref(false),d_int16(false)
+Model::Model(QObject *parent) : QObject(parent),d_fillXref(false),d_int16(false),d_lazyBodies(false),
+    d_complete(false)
 {
     d_errs = new Errors(this);
     d_fc = new FileCache(this);
@@ -456,6 +458,9 @@ void Model::clear()
     d_others.clear();
     d_xref.clear();
     d_sloc = 0;
+    d_times = PhaseTimes();
+    d_relations.clear();
+    d_complete = false;
 }
 
 bool Model::parseFiles(const PackageList& files)
@@ -468,6 +473,8 @@ bool Model::parseFiles(const PackageList& files)
 
     clear();
 
+    QElapsedTimer timer;
+    timer.start();
     const quint32 before = d_errs->getErrCount();
     foreach( const Package& package, files )
     {
@@ -499,12 +506,297 @@ bool Model::parseFiles(const PackageList& files)
     }
 
     resolveImports();
-    if( !findProcessingOrder() )
+    d_times.d_parse = timer.nsecsElapsed();
+    timer.restart();
+    const bool ordered = findProcessingOrder();
+    d_times.d_order = timer.nsecsElapsed();
+    if( !ordered )
         return false;
 
     if( before != d_errs->getErrCount() )
         return false; // stop on parsing errors, but only after we found the dependency order
 
+    QSet<Module*> imported;
+    if( d_lazyBodies )
+    {
+        foreach( Module* m, d_depOrder )
+        {
+            foreach( Import* imp, m->d_imports )
+                imported.insert(imp->d_mod.data());
+        }
+    }
+
+    timer.restart();
+    foreach( Module* m, d_depOrder )
+    {
+        if( m == d_systemModule.data())
+            continue;
+        validate(m, imported);
+    }
+    d_times.d_validate = timer.nsecsElapsed() - d_times.d_instantiate;
+    qDebug() << "type relations:" << d_relations.getHits() << "hits" << d_relations.getMisses() << "misses"
+             << d_relations.getInterned() << "interned types";
+
+#if 0 // TEST
+    qDebug() << "**** generic module instances:";
+    ModInsts::const_iterator i;
+    for( i = d_insts.begin(); i != d_insts.end(); ++i )
+    {
+        foreach( const Ref<Module>& inst, i.value() )
+            qDebug() << inst->getName() << inst.data();
+    }
+    qDebug() << "**** end ";
+#endif
+
+    d_complete = before == d_errs->getErrCount();
+    return true;
+}
+
+void Model::validate(Module* m, const QSet<Module*>& imported)
+{
+    Q_ASSERT( m->d_metaActuals.isEmpty() );
+                  // generic module instances are not validated here,
+                  // but are validated in Validator::visit(Import*) for locality
+
+    qDebug() << "analyzing" << m->getName();
+
+    // the bodies of modules which are only imported are not required to validate the importing modules
+    Validator::check(m, getBaseTypes(), d_errs, this, imported.contains(m), &d_relations );
+
+    //m->dump(); // TEST
+    if( d_fillXref && !m->d_bodiesDeferred )
+    {
+        CrossReferencer(this,m);
+        for( int i = 0; i < m->d_imports.size(); i++ )
+        {
+            if( !m->d_imports[i]->d_metaActuals.isEmpty() )
+                CrossReferencer(this,m->d_imports[i]->d_mod.data());
+        }
+    }
+}
+
+bool Model::findDependents(const QStringList& files, QList<Module*>& res) const
+{
+    // res is in dependency order; d_depOrder lists the imported modules before the importing ones
+    QSet<QString> paths = files.toSet();
+    QSet<Module*> dirty;
+    foreach( Module* m, d_depOrder )
+    {
+        bool affected = paths.remove(m->d_file);
+        foreach( Import* imp, m->d_imports )
+        {
+            if( dirty.contains(imp->d_mod.data()) )
+                affected = true;
+        }
+        if( !affected )
+            continue;
+        if( !m->d_metaParams.isEmpty() || d_modules.value(m->d_fullName).data() != m )
+            return false; // the instances depend on their importers; preloads are not parsed from the files
+        foreach( Import* imp, m->d_imports )
+        {
+            if( !imp->d_metaActuals.isEmpty() )
+                return false; // an instance with actuals of the replaced module would be found by instantiate
+        }
+        dirty.insert(m);
+        res.append(m);
+    }
+    return paths.isEmpty(); // new files are unknown to the model
+}
+
+bool Model::canReparseFiles(const QStringList& changed) const
+{
+    if( !d_complete || d_fillXref )
+        return false; // the xref would point into the replaced modules
+    QList<Module*> mods;
+    return findDependents(changed, mods);
+}
+
+static void unlinkFromBase( Type* t )
+{
+    // the records of a replaced module are removed from the subclass lists of the records they extend;
+    // types referenced by name are owned by another declaration and therefore not followed
+    if( t == 0 )
+        return;
+    switch( t->getTag() )
+    {
+    case Thing::T_Record:
+        {
+            Record* r = cast<Record*>(t);
+            if( r->d_baseRec )
+                r->d_baseRec->d_subRecs.removeAll(r);
+            foreach( const Ref<Field>& f, r->d_fields )
+                unlinkFromBase(f->d_type.data());
+        }
+        break;
+    case Thing::T_Array:
+        unlinkFromBase(cast<Array*>(t)->d_type.data());
+        break;
+    case Thing::T_Pointer:
+        unlinkFromBase(cast<Pointer*>(t)->d_to.data());
+        break;
+    case Thing::T_ProcType:
+        {
+            ProcType* pt = cast<ProcType*>(t);
+            foreach( const Ref<Parameter>& p, pt->d_formals )
+                unlinkFromBase(p->d_type.data());
+            unlinkFromBase(pt->d_return.data());
+        }
+        break;
+    }
+}
+
+static void unlinkFromBase( Named* n )
+{
+    switch( n->getTag() )
+    {
+    case Thing::T_Procedure:
+        {
+            Procedure* p = cast<Procedure*>(n);
+            if( p->d_super )
+                p->d_super->d_subs.removeAll(p);
+            unlinkFromBase(p->d_type.data());
+            foreach( const Ref<Named>& l, p->d_order )
+                unlinkFromBase(l.data());
+        }
+        break;
+    case Thing::T_NamedType:
+    case Thing::T_Variable:
+    case Thing::T_LocalVar:
+        unlinkFromBase(n->d_type.data());
+        break;
+    }
+}
+
+bool Model::reparseFiles(const QStringList& changed)
+{
+    QList<Module*> old;
+    if( !d_complete || !findDependents(changed, old) )
+    {
+        Q_ASSERT( false ); // see canReparseFiles
+        return false;
+    }
+
+    d_errs->clear(); // there were no errors, but the warnings of the replaced modules would be reported twice
+    d_times = PhaseTimes();
+    d_relations.clear(); // the memo refers to types of the replaced modules
+    d_complete = false;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // the kept modules don't import the replaced ones, but they know their importers and subclasses
+    QList<QPair<VirtualPath,QString> > files;
+    foreach( Module* m, old )
+    {
+        foreach( Import* imp, m->d_imports )
+        {
+            if( !imp->d_mod.isNull() )
+                imp->d_mod->d_usedBy.removeAll(m);
+        }
+        foreach( const Ref<Named>& n, m->d_order )
+            unlinkFromBase(n.data());
+        m->d_scope = 0;
+        const VirtualPath package = m->d_fullName.mid(0,m->d_fullName.size()-1);
+        d_packages[package].removeAll(m);
+        files.append(qMakePair(package,m->d_file));
+    }
+    foreach( Module* m, old )
+        d_modules.remove(m->d_fullName); // the project still owns them until it is updated
+    old.clear();
+
+    QList<Module*> mods;
+    for( int i = 0; i < files.size(); i++ )
+    {
+        const VirtualPath& package = files[i].first;
+        const QString& filePath = files[i].second;
+        qDebug() << "parsing" << filePath;
+        Ref<Module> m = parseFile(filePath);
+        if( m.isNull() )
+            error( filePath, tr("cannot open file") );
+        else
+        {
+            m->d_fullName = package;
+            m->d_fullName << m->d_name;
+
+            if( d_modules.contains( m->d_fullName ) )
+                error( filePath,tr("Module name is not unique in package: %1").
+                       arg(m->d_fullName.join('.').constData()));
+            else
+            {
+                if( m->d_isExt )
+                    m->d_scope = d_globalsLower.data();
+                else
+                    m->d_scope = d_globals.data();
+                d_modules.insert( m->d_fullName, m );
+                d_packages[package].append(m.data());
+                mods.append(m.data());
+            }
+        }
+    }
+    foreach( Module* m, mods )
+        resolveImport(m);
+    d_times.d_parse = timer.nsecsElapsed();
+
+    timer.restart();
+    const ModInsts insts = d_insts; // the instances imported by the kept modules stay valid
+    const bool ordered = findProcessingOrder();
+    d_insts = insts;
+    d_times.d_order = timer.nsecsElapsed();
+    if( !ordered || d_errs->getErrCount() != 0 )
+        return false;
+
+    QSet<Module*> imported;
+    if( d_lazyBodies )
+    {
+        foreach( Module* m, d_depOrder )
+        {
+            foreach( Import* imp, m->d_imports )
+                imported.insert(imp->d_mod.data());
+        }
+    }
+
+    timer.restart();
+    const QSet<Module*> toValidate = mods.toSet();
+    foreach( Module* m, d_depOrder )
+    {
+        if( toValidate.contains(m) )
+            validate(m, imported);
+    }
+    d_times.d_validate = timer.nsecsElapsed() - d_times.d_instantiate;
+    qDebug() << "reparsed" << mods.size() << "of" << d_modules.size() << "modules in"
+             << ( d_times.d_parse + d_times.d_order + d_times.d_validate ) / 1000000 << "[ms]";
+
+    d_complete = d_errs->getErrCount() == 0;
+    return true;
+}
+
+bool Model::validateBodies(Module* m)
+{
+    if( m == 0 || !m->d_bodiesDeferred )
+        return m != 0 && !m->d_hasErrors;
+    qDebug() << "analyzing bodies of" << m->getName();
+    QElapsedTimer timer;
+    timer.start();
+    const bool res = Validator::checkBodies(m, getBaseTypes(), d_errs, this, &d_relations );
+    if( d_fillXref )
+        CrossReferencer(this,m);
+    d_times.d_validate += timer.nsecsElapsed();
+    return res;
+}
+
+bool Model::validateAllBodies()
+{
+    bool res = true;
+    foreach( Module* m, d_depOrder )
+    {
+        if( m->d_bodiesDeferred && !validateBodies(m) )
+            res = false;
+    }
+    return res;
+}
+
+Validator::BaseTypes Model::getBaseTypes() const
+{
     Validator::BaseTypes bt;
     bt.d_noType = d_noType.data();
     bt.d_boolType = d_boolType.data();
@@ -525,44 +817,7 @@ bool Model::parseFiles(const PackageList& files)
     bt.d_anyRec = d_anyRec.data();
     bt.d_wcharType = d_wcharType.data();
     bt.d_wstringType = d_wstringType.data();
-
-    foreach( Module* m, d_depOrder )
-    {
-        if( m == d_systemModule.data())
-            continue;
-
-        Q_ASSERT( m->d_metaActuals.isEmpty() );
-                      // generic module instances are not validated here,
-                      // but are validated in Validator::visit(Import*) for locality
-
-        qDebug() << "analyzing" << m->getName();
-
-        Validator::check(m, bt, d_errs, this );
-
-        //m->dump(); // TEST
-        if( d_fillXref )
-        {
-            CrossReferencer(this,m);
-            for( int i = 0; i < m->d_imports.size(); i++ )
-            {
-                if( !m->d_imports[i]->d_metaActuals.isEmpty() )
-                    CrossReferencer(this,m->d_imports[i]->d_mod.data());
-            }
-        }
-    }
-
-#if 0 // TEST
-    qDebug() << "**** generic module instances:";
-    ModInsts::const_iterator i;
-    for( i = d_insts.begin(); i != d_insts.end(); ++i )
-    {
-        foreach( const Ref<Module>& inst, i.value() )
-            qDebug() << inst->getName() << inst.data();
-    }
-    qDebug() << "**** end ";
-#endif
-
-    return true;
+    return bt;
 }
 
 Ref<Module> Model::parseFile(const QString& filePath)
@@ -829,9 +1084,14 @@ Module* Model::instantiate(Module* generic, const MetaActuals& actuals)
     }
     if( inst.isNull() )
     {
+        QElapsedTimer timer;
+        timer.start();
         inst = parseFile( generic->d_file );
         if( inst.isNull() || inst->d_hasErrors )
+        {
+            d_times.d_instantiate += timer.nsecsElapsed();
             return 0; // already reported
+        }
         if( !actuals.isEmpty() )
         {
             for( int i = 0; i < actuals.size(); i++ )
@@ -871,6 +1131,7 @@ Module* Model::instantiate(Module* generic, const MetaActuals& actuals)
         if( resolveImport(inst.data()) )
             inst->d_hasErrors = true;
         insts.append(inst);
+        d_times.d_instantiate += timer.nsecsElapsed();
     }
     return inst.data();
 }
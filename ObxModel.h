@@ -21,6 +21,7 @@
 */
 
 #include <Oberon/ObxParser.h>
+#include <Oberon/ObxValidator.h>
 
 namespace Ob
 {
@@ -36,6 +37,11 @@ namespace Obx
         void clear();
 
         bool parseFiles(const PackageList& files);
+        // re-parses and validates only the modules of the given files and the modules which (transitively) import
+        // them, the others are kept; only possible after a parseFiles without errors and without xref, and if no
+        // generic module nor instance is involved, otherwise parseFiles has to be used
+        bool canReparseFiles( const QStringList& changed ) const;
+        bool reparseFiles( const QStringList& changed );
         Ref<Module> parseFile( const QString& filePath );
         Ref<Module> parseFile(QIODevice* , const QString& filePath);
         const QList<Module*>& getDepOrder() const { return d_depOrder; }
@@ -43,11 +49,25 @@ namespace Obx
         void setOptions(const QByteArrayList& o) { d_options = o; }
 
         void setFillXref( bool b ) { d_fillXref = b; }
+        // if set, parseFiles validates only the declarations of modules which are imported by other modules;
+        // their bodies are validated on demand by validateBodies
+        void setLazyBodies( bool b ) { d_lazyBodies = b; }
+        bool getLazyBodies() const { return d_lazyBodies; }
+        bool validateBodies( Module* );
+        bool validateAllBodies();
         typedef QHash<Named*,ExpList> XRef; // name used by ident expression
         const XRef& getXref() const { return d_xref; }
 
         Ref<Module> treeShaken(Module*) const;
 
+        struct PhaseTimes // nanoseconds spent in the phases of the last parseFiles
+        {
+            qint64 d_parse, d_order, d_instantiate, d_validate; // d_validate excludes d_instantiate
+            PhaseTimes():d_parse(0),d_order(0),d_instantiate(0),d_validate(0){}
+        };
+        const PhaseTimes& getPhaseTimes() const { return d_times; }
+        const TypeRelations& getTypeRelations() const { return d_relations; }
+
         Ob::Errors* getErrs() const { return d_errs; }
         Ob::FileCache* getFc() const { return d_fc; }
         void addPreload(const QByteArray& name, const QByteArray& source);
@@ -64,6 +84,9 @@ namespace Obx
         bool resolveImports();
         bool resolveImport(Module*);
         bool findProcessingOrder();
+        bool findDependents( const QStringList& files, QList<Module*>& ) const;
+        void validate( Module*, const QSet<Module*>& imported );
+        Validator::BaseTypes getBaseTypes() const;
         QPair<Module*, Module*> findModule(const VirtualPath& package, const VirtualPath& module);
         bool error( const QString& file, const QString& msg );
         bool error( const Ob::Loc& loc, const QString& msg );
@@ -108,12 +131,16 @@ namespace Obx
         Packages d_packages;
         XRef d_xref;
         quint32 d_sloc;
+        PhaseTimes d_times;
+        TypeRelations d_relations; // refers to the types of the parsed modules
         QByteArrayList d_options;
 
         Ob::Errors* d_errs;
         Ob::FileCache* d_fc;
         bool d_fillXref;
         bool d_int16;
+        bool d_lazyBodies;
+        bool d_complete; // the last parseFiles or reparseFiles had no errors
     };
 }
 
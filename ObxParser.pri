@@ -34,6 +34,7 @@ SOURCES += \
     $$PWD/ObxModel.cpp \
     $$PWD/ObxEvaluator.cpp \
     $$PWD/ObxAst.cpp \
+    $$PWD/ObxLowering.cpp \
     $$PWD/ObTokenType.cpp
 
 HEADERS  += \
@@ -49,5 +50,6 @@ HEADERS  += \
     $$PWD/ObxModel.h \
     $$PWD/ObxEvaluator.h \
     $$PWD/ObxAst.h \
+    $$PWD/ObxLowering.h \
     $$PWD/ObTokenType.h
 
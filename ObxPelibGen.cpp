@@ -1033,6 +1033,27 @@ struct PelibGen::Imp : public PELib
         m->AddInstruction(new Instruction((Instruction::iop)op, new Operand( new MethodName( sig ))));
     }
 
+    void addCalliOp( Method* m, quint8 op, const QByteArray& callSiteSig )
+    {
+        // callSiteSig is "ret(arg, arg, ...)"; the signature has no Managed flag, i.e. it is unmanaged cdecl
+        const int lpar = callSiteSig.indexOf('(');
+        Q_ASSERT( lpar > 0 && callSiteSig.endsWith(')') );
+        MethodSignature* sig = new MethodSignature( "", 0, 0 );
+        SignatureParser::Node* ret = find(SignatureParser::TypeRef,callSiteSig.left(lpar).trimmed());
+        sig->ReturnType( dynamic_cast<Type*>(ret->thing) );
+        const QByteArray args = callSiteSig.mid(lpar+1,callSiteSig.size()-lpar-2).trimmed();
+        if( !args.isEmpty() )
+        {
+            const QList<QByteArray> types = args.split(',');
+            for( int i = 0; i < types.size(); i++ )
+            {
+                SignatureParser::Node* t = find(SignatureParser::TypeRef,types[i].trimmed());
+                sig->AddParam( new Param( "", dynamic_cast<Type*>(t->thing), i ) );
+            }
+        }
+        m->AddInstruction(new Instruction((Instruction::iop)op, new Operand( new MethodName( sig ))));
+    }
+
     void addFieldOp( Method* m, quint8 op, SignatureParser::MemberHint hint, const QByteArray& fieldRef )
     {
         SignatureParser::Node* node = find(hint,fieldRef);
@@ -1366,6 +1387,9 @@ void PelibGen::addMethod(const IlMethod& m)
         case IL_callvirt:
             d_imp->addMethodOp(mm,op.d_ilop,SignatureParser::Virtual,op.d_arg);
             break;
+        case IL_calli:
+            d_imp->addCalliOp(mm,op.d_ilop,op.d_arg);
+            break;
         case IL_newobj:
             d_imp->addMethodOp(mm,op.d_ilop,SignatureParser::Instance,op.d_arg);
             break;
@@ -1376,6 +1400,7 @@ void PelibGen::addMethod(const IlMethod& m)
         case IL_ldelem:
         case IL_ldelema:
         case IL_ldobj:
+        case IL_ldtoken:
         case IL_newarr:
         case IL_stelem:
         case IL_stobj:
@@ -1485,7 +1510,9 @@ void PelibGen::beginClass(const QByteArray& className, bool isPublic, quint8 cla
     SignatureParser::Node* me = d_imp->level.back()->subs.value(name);
     Qualifiers flags = Qualifiers::Public;
     if( classKind == IlEmitter::Value )
-        flags |= Qualifiers::Value | Qualifiers::Sealed | Qualifiers::Explicit | Qualifiers::Ansi;
+        // cstructs have explicit layout and size; value records are laid out by the engine
+        flags |= Qualifiers::Value | Qualifiers::Sealed | Qualifiers::Ansi |
+                ( byteSize >= 0 ? Qualifiers::Explicit : Qualifiers::Sequential );
     else if( classKind == IlEmitter::Delegate )
         flags |= Qualifiers::Sealed;
     Class* cls = 0;
@@ -980,6 +980,9 @@ Expression*Project::findSymbolBySourcePos(Module* m, quint32 line, quint16 col,
 {
     Q_ASSERT(m);
 
+    if( m->d_bodiesDeferred )
+        d_mdl->validateBodies(m); // idents in bodies are only resolved after validation
+
     ObxHitTest hit;
     hit.col = col;
     hit.line = line;
@@ -1015,6 +1018,14 @@ Project::FileMod Project::findFile(const QString& file) const
     return qMakePair( f.data(), f->d_mod.data() );
 }
 
+bool Project::validateBodies(const QString& file)
+{
+    FileMod f = findFile(file);
+    if( f.second == 0 )
+        return false;
+    return d_mdl->validateBodies(f.second);
+}
+
 ExpList Project::getUsage(Named* n) const
 {
     const Model::XRef& xref = d_mdl->getXref();
@@ -1280,6 +1291,24 @@ bool Project::reparse()
     }
     d_mdl->setOptions(d_options);
     const bool res = d_mdl->parseFiles( fgs );
+    indexModules();
+    emit sigReparsed();
+    return res;
+}
+
+bool Project::reparse(const QStringList& changed)
+{
+    if( d_mdl->getDepOrder().isEmpty() || !d_mdl->canReparseFiles(changed) )
+        return reparse();
+    const bool res = d_mdl->reparseFiles(changed);
+    indexModules();
+    emit sigReparsed();
+    return res;
+}
+
+void Project::indexModules()
+{
+    d_modules.clear();
     QList<Module*> mods = d_mdl->getDepOrder();
     foreach( Module* m, mods )
     {
@@ -1306,13 +1335,15 @@ bool Project::reparse()
             Q_ASSERT( false );
         }
     }
-    emit sigReparsed();
-    return res;
 }
 
 QList<Module*> Project::getModulesToGenerate(bool includeTemplates) const
 {
     QList<Module*> res;
+    // the generators need the validated bodies, also of the lazily validated modules; if one of them has errors
+    // nothing is generated, since the modules depending on it would be generated against an invalid module
+    if( !d_mdl->validateAllBodies() )
+        return res;
     FileHash::const_iterator i;
     QList<Module*> mods = d_mdl->getDepOrder();
 #if 0
@@ -104,6 +104,8 @@ namespace Obx
         bool removePackagePath( const VirtualPath& path );
 
         bool reparse();
+        bool reparse( const QStringList& changed ); // only the changed files and their dependents if possible
+        bool validateBodies( const QString& file ); // only required if getMdl()->getLazyBodies()
 
         const FileHash& getFiles() const { return d_files; }
         const FileGroups& getFileGroups() const { return d_groups; }
@@ -129,6 +131,7 @@ namespace Obx
         QStringList findFiles(const QDir& , bool recursive = false);
         void touch();
         int findPackage(const VirtualPath& path ) const;
+        void indexModules();
         // bool generate( Module* );
     private:
         Model* d_mdl;
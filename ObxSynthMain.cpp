@@ -0,0 +1,558 @@
+/*
+* Copyright 2021 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Oberon+ parser/compiler library.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QTextStream>
+#include <QFileInfo>
+#include <QBuffer>
+#include <QFile>
+#include <QDir>
+#include <QSet>
+#include <QtDebug>
+#include <math.h>
+#include "ObxModel.h"
+#include "ObErrors.h"
+#include "ObxProject.h"
+#include "ObxCGen2.h"
+#include "ObxCilGen.h"
+#include "ObxLjbcGen.h"
+
+// Generates synthetic but valid Oberon+ projects of configurable size and shape and measures how the
+// front-end phases and the backends scale with them; used to track superlinear behaviour of the compiler
+// with sources which can be published in bug reports.
+
+struct Shape
+{
+    int d_modules;  // number of ordinary modules
+    int d_fanOut;   // random imports per module (from the modules declared before)
+    int d_hubs;     // the first d_hubs modules are imported by all others (fan-in)
+    int d_generics; // number of generic modules
+    int d_insts;    // generic instantiations per module
+    int d_procs;    // procedures per module
+    int d_stmts;    // statements per procedure
+    int d_depth;    // record extension depth per module
+    quint32 d_seed;
+    Shape():d_modules(100),d_fanOut(3),d_hubs(1),d_generics(2),d_insts(1),d_procs(10),d_stmts(20),d_depth(3),
+        d_seed(1){}
+};
+
+static quint32 nextRandom( quint32& state )
+{
+    // deterministic across platforms, in contrast to qrand
+    state = state * 1103515245 + 12345;
+    return ( state >> 16 ) & 0x7fff;
+}
+
+static QByteArray modName( int i )
+{
+    return "M" + QByteArray::number(i).rightJustified(4,'0');
+}
+
+static QByteArray genName( int i )
+{
+    return "G" + QByteArray::number(i).rightJustified(2,'0');
+}
+
+static bool writeFile( const QString& path, const QByteArray& text )
+{
+    QFile f(path);
+    if( !f.open(QIODevice::WriteOnly) )
+    {
+        qCritical() << "cannot write" << path;
+        return false;
+    }
+    f.write(text);
+    return true;
+}
+
+static QByteArray generic( int g )
+{
+    QByteArray res;
+    QTextStream out(&res);
+    out << "MODULE " << genName(g) << "(T);" << endl
+        << "  TYPE List* = POINTER TO RECORD next*: List; val*: T END;" << endl << endl
+        << "  PROCEDURE add*(VAR l: List; IN v: T);" << endl
+        << "    VAR n: List;" << endl
+        << "  BEGIN" << endl
+        << "    NEW(n); n.val := v; n.next := l; l := n" << endl
+        << "  END add;" << endl << endl
+        << "  PROCEDURE count*(l: List): INTEGER;" << endl
+        << "    VAR c: INTEGER; p: List;" << endl
+        << "  BEGIN" << endl
+        << "    c := 0; p := l;" << endl
+        << "    WHILE p # NIL DO INC(c); p := p.next END;" << endl
+        << "    RETURN c" << endl
+        << "  END count;" << endl
+        << "END " << genName(g) << "." << endl;
+    out.flush();
+    return res;
+}
+
+struct Inst
+{
+    int d_gen; // index of the generic module
+    int d_imp; // index of the imported module providing the actual type
+};
+
+static QByteArray module( int i, const Shape& s, quint32& rnd )
+{
+    QList<int> imports;
+    for( int j = 0; j < qMin(s.d_hubs, i); j++ )
+        imports << j;
+    const int avail = i - imports.size();
+    for( int k = 0; k < qMin(s.d_fanOut, avail); k++ )
+    {
+        int j = nextRandom(rnd) % i;
+        while( imports.contains(j) )
+            j = ( j + 1 ) % i;
+        imports << j;
+    }
+
+    QList<Inst> insts;
+    if( s.d_generics > 0 && !imports.isEmpty() )
+    {
+        for( int k = 0; k < s.d_insts; k++ )
+        {
+            Inst inst;
+            inst.d_gen = nextRandom(rnd) % s.d_generics;
+            inst.d_imp = imports[ nextRandom(rnd) % imports.size() ];
+            insts << inst;
+        }
+    }
+    const int depth = qMax(s.d_depth,1);
+    const QByteArray last = "T" + QByteArray::number(depth-1);
+
+    QByteArray res;
+    QTextStream out(&res);
+    out << "MODULE " << modName(i) << ";" << endl;
+    if( !imports.isEmpty() )
+    {
+        out << "  IMPORT ";
+        for( int k = 0; k < imports.size(); k++ )
+        {
+            if( k != 0 )
+                out << ", ";
+            out << modName(imports[k]);
+        }
+        for( int k = 0; k < insts.size(); k++ )
+            out << "," << endl << "    L" << k << " := " << genName(insts[k].d_gen)
+                << "(" << modName(insts[k].d_imp) << ".T0)";
+        out << ";" << endl;
+    }
+    out << endl << "  TYPE" << endl;
+    out << "    T0* = POINTER TO RECORD f0*: INTEGER END;" << endl;
+    for( int d = 1; d < depth; d++ )
+        out << "    T" << d << "* = POINTER TO RECORD (T" << d-1 << ") f" << d << "*: INTEGER END;" << endl;
+    out << endl << "  VAR" << endl;
+    out << "    cur*: " << last << ";" << endl;
+    for( int k = 0; k < insts.size(); k++ )
+        out << "    l" << k << ": L" << k << ".List; n" << k << ": " << modName(insts[k].d_imp) << ".T0;" << endl;
+    out << endl;
+
+    for( int p = 0; p < s.d_procs; p++ )
+    {
+        out << "  PROCEDURE P" << p << "*(x: INTEGER; t: " << last << "): INTEGER;" << endl
+            << "    VAR i, r: INTEGER;" << endl
+            << "  BEGIN" << endl
+            << "    r := x;" << endl;
+        for( int st = 0; st < s.d_stmts; st++ )
+        {
+            out << "    ";
+            switch( st % 6 )
+            {
+            case 0:
+                out << "r := r * 3 + x;";
+                break;
+            case 1:
+                out << "IF r > 1000 THEN r := r DIV 7 ELSE INC(r) END;";
+                break;
+            case 2:
+                out << "FOR i := 0 TO 3 DO r := r + i END;";
+                break;
+            case 3:
+                out << "IF t # NIL THEN t.f" << ( st % depth ) << " := r; r := r + t.f0 END;";
+                break;
+            case 4:
+                if( !imports.isEmpty() && s.d_procs > 0 )
+                    out << "r := r + " << modName(imports[ nextRandom(rnd) % imports.size() ])
+                        << ".P" << ( nextRandom(rnd) % s.d_procs ) << "(r, NIL);";
+                else if( p > 0 )
+                    out << "r := r + P" << ( nextRandom(rnd) % p ) << "(r, t);";
+                else
+                    out << "r := r - x;";
+                break;
+            case 5:
+                if( !insts.isEmpty() )
+                {
+                    const int k = nextRandom(rnd) % insts.size();
+                    out << "L" << k << ".add(l" << k << ", n" << k << "); r := r + L" << k << ".count(l" << k << ");";
+                }else
+                    out << "WHILE r > 100 DO r := r DIV 2 END;";
+                break;
+            }
+            out << endl;
+        }
+        out << "    RETURN r" << endl
+            << "  END P" << p << ";" << endl << endl;
+    }
+    out << "BEGIN" << endl
+        << "  NEW(cur)" << endl
+        << "END " << modName(i) << "." << endl;
+    out.flush();
+    return res;
+}
+
+static QString generate( const QDir& dir, const Shape& s )
+{
+    if( !dir.mkpath(dir.path()) )
+    {
+        qCritical() << "cannot create directory" << dir.path();
+        return QString();
+    }
+    Obx::Project pro;
+    pro.createNew();
+    quint32 rnd = s.d_seed;
+    for( int g = 0; g < s.d_generics; g++ )
+    {
+        const QString path = dir.absoluteFilePath(genName(g) + ".obx");
+        if( !writeFile( path, generic(g) ) )
+            return QString();
+        pro.addFile(path);
+    }
+    for( int i = 0; i < s.d_modules; i++ )
+    {
+        const QString path = dir.absoluteFilePath(modName(i) + ".obx");
+        if( !writeFile( path, module(i, s, rnd) ) )
+            return QString();
+        pro.addFile(path);
+    }
+    if( s.d_modules > 0 )
+        pro.setMain(Obx::Project::ModProc(modName(s.d_modules-1),QByteArray()));
+    const QString proFile = dir.absoluteFilePath("Synth.obxpro");
+    if( !pro.saveTo(proFile) )
+        return QString();
+    return proFile;
+}
+
+static qint64 residentBytes()
+{
+    // only available on Linux; returns -1 otherwise
+    QFile f("/proc/self/status");
+    if( !f.open(QIODevice::ReadOnly) )
+        return -1;
+    while( !f.atEnd() )
+    {
+        const QByteArray line = f.readLine();
+        if( line.startsWith("VmRSS:") )
+            return line.mid(6).trimmed().split(' ').first().toLongLong() * 1024;
+    }
+    return -1;
+}
+
+struct Sample
+{
+    quint32 d_modules, d_sloc;
+    qint64 d_parse, d_order, d_inst, d_validate, d_reparse, d_edit, d_c, d_cil, d_lj, d_rss;
+    double d_memoHits; // share of type relations found in the memo
+    Sample():d_modules(0),d_sloc(0),d_parse(0),d_order(0),d_inst(0),d_validate(0),d_reparse(0),
+        d_edit(-1),d_c(-1),d_cil(-1),d_lj(-1),d_rss(-1),d_memoHits(0){}
+};
+
+static bool generateLj( Obx::Project* pro )
+{
+    // same order as LjRuntime::generate, but without the runtime
+    QSet<Obx::Module*> generated;
+    foreach( Obx::Module* m, pro->getModulesToGenerate() )
+    {
+        if( m->d_synthetic || !m->d_metaParams.isEmpty() )
+            continue;
+        Obx::LjbcGen::allocateSlots(m);
+        if( m->d_isDef )
+            continue;
+        QList<Obx::Module*> result;
+        m->findAllInstances(result);
+        foreach( Obx::Module* inst, result )
+        {
+            if( generated.contains(inst) )
+                continue;
+            generated.insert(inst);
+            Obx::LjbcGen::allocateSlots(inst);
+            QBuffer buf;
+            buf.open(QIODevice::WriteOnly);
+            if( !Obx::LjbcGen::translate(inst, &buf, false, pro->getErrs()) )
+                return false;
+        }
+        QBuffer buf;
+        buf.open(QIODevice::WriteOnly);
+        if( !Obx::LjbcGen::translate(m, &buf, false, pro->getErrs()) )
+            return false;
+    }
+    return true;
+}
+
+enum Backend { GenC = 1, GenCil = 2, GenLj = 4 };
+
+static bool measure( const QString& proFile, const QString& outDir, int backends, bool lazy, Sample& s )
+{
+    Obx::Project pro;
+    if( !pro.loadFrom(proFile) )
+        return false;
+    pro.getMdl()->setLazyBodies(lazy);
+    s.d_modules = pro.getFiles().size();
+    QElapsedTimer t;
+    t.start();
+    if( !pro.reparse() || pro.getErrs()->getErrCount() != 0 )
+    {
+        qCritical() << "synthetic project has errors" << proFile;
+        return false;
+    }
+    s.d_reparse = t.nsecsElapsed();
+    s.d_rss = residentBytes();
+    const Obx::Model::PhaseTimes& pt = pro.getMdl()->getPhaseTimes();
+    s.d_parse = pt.d_parse;
+    s.d_order = pt.d_order;
+    s.d_inst = pt.d_instantiate;
+    s.d_validate = pt.d_validate;
+    s.d_sloc = pro.getMdl()->getSloc();
+    const Obx::TypeRelations& rel = pro.getMdl()->getTypeRelations();
+    if( rel.getHits() + rel.getMisses() )
+        s.d_memoHits = double(rel.getHits()) / double(rel.getHits() + rel.getMisses());
+
+    // the latency of the build servers after an edit of the most dependent module (the last in dependency order)
+    const QList<Obx::Module*>& order = pro.getMdl()->getDepOrder();
+    for( int i = order.size() - 1; i >= 0; i-- )
+    {
+        if( !pro.getFiles().contains(order[i]->d_file) )
+            continue;
+        const bool incremental = pro.getMdl()->canReparseFiles( QStringList() << order[i]->d_file );
+        t.restart();
+        if( !pro.reparse( QStringList() << order[i]->d_file ) || pro.getErrs()->getErrCount() != 0 )
+            return false;
+        if( incremental )
+            s.d_edit = t.nsecsElapsed();
+        break;
+    }
+    QDir out(outDir);
+    if( backends & GenC )
+    {
+        out.mkpath("c");
+        t.restart();
+        if( !Obx::CGen2::translateAll(&pro, false, out.absoluteFilePath("c")) )
+            return false;
+        s.d_c = t.nsecsElapsed();
+    }
+    if( backends & GenCil )
+    {
+        out.mkpath("il");
+        t.restart();
+        if( !Obx::CilGen::translateAll(&pro, Obx::CilGen::Ilasm, false, out.absoluteFilePath("il")) )
+            return false;
+        s.d_cil = t.nsecsElapsed();
+    }
+    if( backends & GenLj )
+    {
+        t.restart();
+        if( !generateLj(&pro) )
+            return false;
+        s.d_lj = t.nsecsElapsed();
+    }
+    return true;
+}
+
+static QString ms( qint64 ns )
+{
+    if( ns < 0 )
+        return "-";
+    return QString::number( ns / 1e6, 'f', 1 );
+}
+
+static QString growth( qint64 prev, qint64 cur, double sizeRatio )
+{
+    // exponent of the growth relative to the previous size; flagged if clearly superlinear
+    if( prev <= 0 || cur <= 0 || sizeRatio <= 1.0 )
+        return QString();
+    const double e = ::log( double(cur) / double(prev) ) / ::log(sizeRatio);
+    return QString("^%1%2").arg( e, 0, 'f', 2 ).arg( e > 1.3 ? "!" : "" );
+}
+
+static void report( QTextStream& out, const QList<Sample>& samples )
+{
+    out << "modules\tsloc\tparse\torder\tinst\tvalid\treparse\tedit\tC\tCIL\tLJ\tRSS[MB]\tmemo%  "
+           "(times in ms, ^ growth exponent, edit - if generics prevent an incremental reparse)" << endl;
+    for( int i = 0; i < samples.size(); i++ )
+    {
+        const Sample& s = samples[i];
+        const Sample* p = i > 0 ? &samples[i-1] : 0;
+        const double r = p && p->d_sloc ? double(s.d_sloc) / double(p->d_sloc) : 0.0;
+        out << s.d_modules << "\t" << s.d_sloc
+            << "\t" << ms(s.d_parse) << ( p ? growth(p->d_parse, s.d_parse, r) : QString() )
+            << "\t" << ms(s.d_order) << ( p ? growth(p->d_order, s.d_order, r) : QString() )
+            << "\t" << ms(s.d_inst) << ( p ? growth(p->d_inst, s.d_inst, r) : QString() )
+            << "\t" << ms(s.d_validate) << ( p ? growth(p->d_validate, s.d_validate, r) : QString() )
+            << "\t" << ms(s.d_reparse) << ( p ? growth(p->d_reparse, s.d_reparse, r) : QString() )
+            << "\t" << ms(s.d_edit)
+            << "\t" << ms(s.d_c) << ( p ? growth(p->d_c, s.d_c, r) : QString() )
+            << "\t" << ms(s.d_cil) << ( p ? growth(p->d_cil, s.d_cil, r) : QString() )
+            << "\t" << ms(s.d_lj) << ( p ? growth(p->d_lj, s.d_lj, r) : QString() )
+            << "\t" << ( s.d_rss < 0 ? QString("-") : QString::number( s.d_rss / 1048576.0, 'f', 1 ) )
+            << "\t" << QString::number( s.d_memoHits * 100.0, 'f', 1 )
+            << endl;
+    }
+}
+
+static bool s_verbose = false;
+static QtMessageHandler s_oldHandler = 0;
+static void messageHander(QtMsgType type, const QMessageLogContext& ctx, const QString& msg)
+{
+    // the model reports each parsed and analyzed module, which would dominate the measurement
+    if( type == QtDebugMsg && !s_verbose )
+        return;
+    s_oldHandler(type, ctx, msg );
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    a.setOrganizationName("Rochus Keller");
+    a.setOrganizationDomain("https://github.com/rochus-keller/Oberon");
+    a.setApplicationName("OBXSYNTH");
+    a.setApplicationVersion("2023-10-14");
+    s_oldHandler = qInstallMessageHandler(messageHander);
+
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    Shape shape;
+    QString genDir, outPath;
+    QStringList projects;
+    QList<int> scale;
+    int backends = 0;
+    bool lazy = false;
+    QStringList args = QCoreApplication::arguments();
+    for( int i = 1; i < args.size(); i++ ) // arg 0 enthaelt Anwendungspfad
+    {
+        const QString& arg = args[i];
+        if(  arg == "-h" || args.size() == 1 )
+        {
+            out << "OBXSYNTH version: " << a.applicationVersion() <<
+                         " author: me@rochus-keller.ch  license: GPL" << endl;
+            out << "usage: OBXSYNTH [options] [project files]" << endl;
+            out << "  generates synthetic Oberon+ projects and/or measures the front-end and backends on projects" << endl;
+            out << "options:" << endl;
+            out << "  -gen=dir      generate a project with the given shape to dir and quit" << endl;
+            out << "  -scale=n,m,.. generate projects with n, m, .. modules to -out and measure each of them" << endl;
+            out << "  -out=path     where to put generated projects and backend output (default ./synth)" << endl;
+            out << "  -modules=n    number of modules (default " << shape.d_modules << ")" << endl;
+            out << "  -fanout=n     random imports per module (default " << shape.d_fanOut << ")" << endl;
+            out << "  -hubs=n       modules imported by all others (default " << shape.d_hubs << ")" << endl;
+            out << "  -generics=n   number of generic modules (default " << shape.d_generics << ")" << endl;
+            out << "  -insts=n      generic instantiations per module (default " << shape.d_insts << ")" << endl;
+            out << "  -procs=n      procedures per module (default " << shape.d_procs << ")" << endl;
+            out << "  -stmts=n      statements per procedure (default " << shape.d_stmts << ")" << endl;
+            out << "  -depth=n      record extension depth (default " << shape.d_depth << ")" << endl;
+            out << "  -seed=n       seed of the generator (default " << shape.d_seed << ")" << endl;
+            out << "  -c -cil -lj   also measure the C, CIL (ilasm) or LuaJIT backend" << endl;
+            out << "  -lazy         only validate the declarations of imported modules on reparse" << endl;
+            out << "  -v            show the messages of the compiler" << endl;
+            out << "  -h            display this information" << endl;
+            return 0;
+        }else if( arg.startsWith("-gen=") )
+            genDir = arg.mid(5);
+        else if( arg.startsWith("-out=") )
+            outPath = arg.mid(5);
+        else if( arg.startsWith("-scale=") )
+        {
+            foreach( const QString& n, arg.mid(7).split(',', QString::SkipEmptyParts) )
+                scale << n.toInt();
+        }else if( arg.startsWith("-modules=") )
+            shape.d_modules = arg.mid(9).toInt();
+        else if( arg.startsWith("-fanout=") )
+            shape.d_fanOut = arg.mid(8).toInt();
+        else if( arg.startsWith("-hubs=") )
+            shape.d_hubs = arg.mid(6).toInt();
+        else if( arg.startsWith("-generics=") )
+            shape.d_generics = arg.mid(10).toInt();
+        else if( arg.startsWith("-insts=") )
+            shape.d_insts = arg.mid(7).toInt();
+        else if( arg.startsWith("-procs=") )
+            shape.d_procs = arg.mid(7).toInt();
+        else if( arg.startsWith("-stmts=") )
+            shape.d_stmts = arg.mid(7).toInt();
+        else if( arg.startsWith("-depth=") )
+            shape.d_depth = arg.mid(7).toInt();
+        else if( arg.startsWith("-seed=") )
+            shape.d_seed = arg.mid(6).toUInt();
+        else if( arg == "-c" )
+            backends |= GenC;
+        else if( arg == "-cil" )
+            backends |= GenCil;
+        else if( arg == "-lj" )
+            backends |= GenLj;
+        else if( arg == "-lazy" )
+            lazy = true;
+        else if( arg == "-v" )
+            s_verbose = true;
+        else if( !arg.startsWith('-') )
+            projects << arg;
+        else
+        {
+            err << "error: invalid command line option " << arg << endl;
+            return -1;
+        }
+    }
+    if( outPath.isEmpty() )
+        outPath = QDir::current().absoluteFilePath("synth");
+
+    if( !genDir.isEmpty() )
+    {
+        const QString proFile = generate( QDir(genDir), shape );
+        if( proFile.isEmpty() )
+            return -1;
+        out << "generated " << proFile << endl;
+        return 0;
+    }
+
+    foreach( int n, scale )
+    {
+        Shape s = shape;
+        s.d_modules = n;
+        const QString proFile = generate( QDir(QDir(outPath).absoluteFilePath(QString("m%1").arg(n))), s );
+        if( proFile.isEmpty() )
+            return -1;
+        projects << proFile;
+    }
+    if( projects.isEmpty() )
+    {
+        err << "nothing to measure; use -scale or pass project files (use -h option for help)" << endl;
+        return -1;
+    }
+
+    QList<Sample> samples;
+    foreach( const QString& proFile, projects )
+    {
+        Sample s;
+        const QString where = QDir(QFileInfo(proFile).absolutePath()).absoluteFilePath("out");
+        if( !measure( proFile, where, backends, lazy, s ) )
+            return -1;
+        samples << s;
+    }
+    report(out, samples);
+    return 0;
+}
@@ -19,6 +19,7 @@
 
 #include "ObxEvaluator.h"
 #include "ObxValidator.h"
+#include "ObxLowering.h"
 #include <QtDebug>
 #include <limits>
 using namespace Obx;
@@ -91,8 +92,12 @@ struct ValidatorImp : public AstVisitor
     QList< QPair<Type*,Type*> > deferExtensionCheck;
     bool returnValueFound;
     bool selfRefBroken;
+    bool interfaceOnly; // don't visit the procedure and module bodies of mod
+    TypeRelations* memo;
+    bool inStats; // all declarations visible from here are resolved, so type relations no longer change
 
-    ValidatorImp():err(0),mod(0),curTypeDecl(0),prevStat(0),returnValueFound(false),selfRefBroken(false) {}
+    ValidatorImp():err(0),mod(0),curTypeDecl(0),prevStat(0),returnValueFound(false),selfRefBroken(false),
+        interfaceOnly(false),memo(0),inStats(false) {}
 
     //////// Scopes
 
@@ -153,8 +158,16 @@ struct ValidatorImp : public AstVisitor
         }
         foreach( const Ref<Named>& n, me->d_order )
         {
-            if( n->getTag() == Thing::T_Procedure )
-                visitBody( cast<Procedure*>(n.data()) );
+            if( n->getTag() == Thing::T_Procedure && !cast<Procedure*>(n.data())->d_receiver.isNull() )
+                connectSuperSubBoundProc( cast<Procedure*>(n.data()) ); // receiver was already accepted
+        }
+        if( !interfaceOnly || me != mod )
+        {
+            foreach( const Ref<Named>& n, me->d_order )
+            {
+                if( n->getTag() == Thing::T_Procedure )
+                    visitBody( cast<Procedure*>(n.data()) );
+            }
         }
         foreach( const Ref<Named>& n, me->d_order )
         {
@@ -260,6 +273,26 @@ struct ValidatorImp : public AstVisitor
         levels.push_back(me);
         // imports are supposed to be already resolved at this place
         visitScope(me);
+        if( !interfaceOnly )
+            visitModuleBody(me);
+        levels.pop_back();
+    }
+
+    void visitBodies( Module* me )
+    {
+        // completes a validation which was done with interfaceOnly
+        levels.push_back(me);
+        foreach( const Ref<Named>& n, me->d_order )
+        {
+            if( n->getTag() == Thing::T_Procedure )
+                visitBody( cast<Procedure*>(n.data()) );
+        }
+        visitModuleBody(me);
+        levels.pop_back();
+    }
+
+    void visitModuleBody( Module* me )
+    {
         foreach( const Ref<Named>& n, me->d_order )
         {
             if( n->getTag() == Thing::T_Procedure && ( n->d_upvalSource || n->d_upvalIntermediate || n->d_upvalSink ) )
@@ -278,8 +311,6 @@ struct ValidatorImp : public AstVisitor
                 error( e->d_loc, Validator::tr("this procedure depends on the environment and cannot be assigned"));
         }
         deferProcCheck.clear();
-
-        levels.pop_back();
     }
 
     void registerBoundProc( Procedure* me )
@@ -394,12 +425,6 @@ struct ValidatorImp : public AstVisitor
 
     void visitBody( Procedure* me )
     {
-        if( !me->d_receiver.isNull() )
-        {
-            // receiver was already accepted
-            connectSuperSubBoundProc(me);
-        }
-
         levels.push_back(me);
         visitScope(me); // also handles formal parameters
         returnValueFound = false;
@@ -418,6 +443,8 @@ struct ValidatorImp : public AstVisitor
                 }
             }
         }
+        if( me->d_upvalSource )
+            Lowering::markReadOnlyUpvals(me);
 
         if( !mod->d_isDef &&
                 !( me->d_noBody && me->d_order.size() == me->d_parCount ) // empty or only one return statement, and no declarations
@@ -3418,7 +3445,7 @@ struct ValidatorImp : public AstVisitor
                 err2.setShowWarnings(true);
                 err2.setReportToConsole(false);
                 err2.setRecord(true);
-                Validator::check(me->d_mod.data(),bt, &err2, insts );
+                Validator::check(me->d_mod.data(),bt, &err2, insts, false, memo );
                 if( err2.getErrCount() || err2.getWrnCount() )
                 {
                     error( me->d_loc, Validator::tr("errors when instantiating generic module"));
@@ -3498,6 +3525,8 @@ struct ValidatorImp : public AstVisitor
 
     void visitStats( const StatSeq& ss )
     {
+        const bool stats = inStats;
+        inStats = true;
         Statement* ps = prevStat;
         foreach( const Ref<Statement>& s, ss )
         {
@@ -3508,6 +3537,7 @@ struct ValidatorImp : public AstVisitor
             }
         }
         prevStat = ps;
+        inStats = stats;
     }
 
     void error(const RowCol& r, const QString& msg) const
@@ -3766,6 +3796,18 @@ struct ValidatorImp : public AstVisitor
             return false;
         lhs = derefed(lhs);
         rhs = derefed(rhs);
+        bool res;
+        if( memo && inStats && memo->find( TypeRelations::EqualType, lhs, rhs, res ) )
+            return res;
+        res = equalTypeImp(lhs,rhs);
+        if( memo && inStats )
+            memo->insert( TypeRelations::EqualType, lhs, rhs, res );
+        return res;
+    }
+
+    bool equalTypeImp( Type* lhs, Type* rhs ) const
+    {
+        // expects derefed types which are not the same
 
 #ifdef _OBX_USE_NEW_FFI_
         if( lhs->d_unsafe != rhs->d_unsafe )
@@ -3807,6 +3849,18 @@ struct ValidatorImp : public AstVisitor
             return false;
         if( sameType(super,sub))
             return true;
+        const TypeRelations::Relation r = checkKind ? TypeRelations::TypeExtensionKind : TypeRelations::TypeExtension;
+        bool res;
+        if( memo && inStats && memo->find( r, super, sub, res ) )
+            return res;
+        res = typeExtensionImp(super, sub, checkKind);
+        if( memo && inStats )
+            memo->insert( r, super, sub, res );
+        return res;
+    }
+
+    bool typeExtensionImp( Type* super, Type* sub, bool checkKind ) const
+    {
         bool superIsPointer = false;
         if( super->getTag() == Thing::T_Pointer )
         {
@@ -4179,6 +4233,19 @@ struct ValidatorImp : public AstVisitor
     {
         if( lhs == 0 || rhs == 0 )
             return false;
+        const TypeRelations::Relation r = allowRhsCovariance ? TypeRelations::MatchingParamsCovariant :
+                                                               TypeRelations::MatchingParams;
+        bool res;
+        if( memo && inStats && memo->find( r, lhs, rhs, res ) )
+            return res;
+        res = matchingFormalParamListsImp(lhs, rhs, allowRhsCovariance);
+        if( memo && inStats )
+            memo->insert( r, lhs, rhs, res );
+        return res;
+    }
+
+    bool matchingFormalParamListsImp( ProcType* lhs, ProcType* rhs, bool allowRhsCovariance ) const
+    {
         if( lhs->d_formals.size() != rhs->d_formals.size() || lhs->d_varargs != rhs->d_varargs )
             return false;
         if( !lhs->d_return.isNull() && !rhs->d_return.isNull() )
@@ -4293,7 +4360,8 @@ struct ValidatorImp : public AstVisitor
     }
 };
 
-bool Validator::check(Module* m, const BaseTypes& bt, Ob::Errors* err, Instantiator* insts)
+bool Validator::check(Module* m, const BaseTypes& bt, Ob::Errors* err, Instantiator* insts, bool interfaceOnly,
+                      TypeRelations* memo)
 {
     Q_ASSERT( m != 0 && err != 0 );
 
@@ -4308,15 +4376,181 @@ bool Validator::check(Module* m, const BaseTypes& bt, Ob::Errors* err, Instantia
     imp.bt.check();
     imp.mod = m;
     imp.insts = insts;
+    imp.interfaceOnly = interfaceOnly && !m->d_isDef;
+    imp.memo = memo;
     m->accept(&imp);
 
     m->d_isValidated = true;
+    m->d_bodiesDeferred = imp.interfaceOnly;
 
     m->d_hasErrors = ( err->getErrCount() - errCount ) != 0;
 
     return !m->d_hasErrors;
 }
 
+bool Validator::checkBodies(Module* m, const BaseTypes& bt, Ob::Errors* err, Instantiator* insts, TypeRelations* memo)
+{
+    Q_ASSERT( m != 0 && err != 0 );
+
+    if( !m->d_bodiesDeferred )
+        return !m->d_hasErrors;
+    m->d_bodiesDeferred = false;
+    if( m->d_hasErrors )
+        return false;
+
+    const quint32 errCount = err->getErrCount();
+
+    ValidatorImp imp;
+    imp.err = err;
+    imp.bt = bt;
+    imp.bt.check();
+    imp.mod = m;
+    imp.insts = insts;
+    imp.memo = memo;
+    imp.visitBodies(m);
+
+    m->d_hasErrors = ( err->getErrCount() - errCount ) != 0;
+
+    return !m->d_hasErrors;
+}
+
+TypeRelations::TypeRelations()
+{
+    clear();
+}
+
+void TypeRelations::clear()
+{
+    for( int i = 0; i < MaxRelation; i++ )
+    {
+        d_memo[i].clear();
+        d_hits[i] = 0;
+        d_misses[i] = 0;
+    }
+    d_canon.clear();
+    d_reps.clear();
+    d_interned = 0;
+}
+
+bool TypeRelations::find(TypeRelations::Relation r, Type* lhs, Type* rhs, bool& res)
+{
+    QHash<Pair,bool>::const_iterator i = d_memo[r].find( qMakePair(canonical(lhs),canonical(rhs)) );
+    if( i == d_memo[r].end() )
+    {
+        d_misses[r]++;
+        return false;
+    }
+    d_hits[r]++;
+    res = i.value();
+    return true;
+}
+
+void TypeRelations::insert(TypeRelations::Relation r, Type* lhs, Type* rhs, bool res)
+{
+    d_memo[r].insert( qMakePair(canonical(lhs),canonical(rhs)), res );
+}
+
+quint32 TypeRelations::getHits() const
+{
+    quint32 res = 0;
+    for( int i = 0; i < MaxRelation; i++ )
+        res += d_hits[i];
+    return res;
+}
+
+quint32 TypeRelations::getMisses() const
+{
+    quint32 res = 0;
+    for( int i = 0; i < MaxRelation; i++ )
+        res += d_misses[i];
+    return res;
+}
+
+Type* TypeRelations::canonical(Type* t)
+{
+    if( t == 0 )
+        return 0;
+    QHash<Type*,Type*>::const_iterator i = d_canon.find(t);
+    if( i != d_canon.end() )
+        return i.value();
+    Type* res = t;
+    const int tag = t->getTag();
+    if( tag == Thing::T_Pointer || tag == Thing::T_ProcType ||
+            ( tag == Thing::T_Array && cast<Array*>(t)->d_lenExpr.isNull() ) )
+    {
+        QSet<Type*> visiting;
+        const QByteArray sig = signature(t, visiting);
+        QHash<QByteArray,Type*>::const_iterator j = d_reps.find(sig);
+        if( j == d_reps.end() )
+            d_reps.insert(sig,t);
+        else
+        {
+            res = j.value();
+            d_interned++;
+        }
+    }
+    d_canon.insert(t,res);
+    return res;
+}
+
+static inline QByteArray identity( Type* t )
+{
+    return "#" + QByteArray::number( quintptr(t), 16 );
+}
+
+QByteArray TypeRelations::component(Type* t, QSet<Type*>& visiting)
+{
+    Type* td = t ? t->derefed() : 0;
+    if( td == 0 )
+        return identity(t); // unresolved types are never merged
+    return signature(td, visiting);
+}
+
+QByteArray TypeRelations::signature(Type* t, QSet<Type*>& visiting)
+{
+    // only merges types the relations cannot tell apart; identity is always a safe fallback,
+    // e.g. for named types, records, fixed length arrays or recursive structures
+    if( t == 0 )
+        return "0";
+    const int tag = t->getTag();
+    const bool structural = tag == Thing::T_Pointer || tag == Thing::T_ProcType ||
+            ( tag == Thing::T_Array && cast<Array*>(t)->d_lenExpr.isNull() );
+    if( !structural || visiting.contains(t) )
+        return identity(t);
+    visiting.insert(t);
+    QByteArray res;
+    res += t->d_unsafe ? "u" : "s";
+    switch( tag )
+    {
+    case Thing::T_Pointer:
+        res += "P" + component( cast<Pointer*>(t)->d_to.data(), visiting );
+        break;
+    case Thing::T_Array:
+        res += "A" + component( cast<Array*>(t)->d_type.data(), visiting );
+        break;
+    case Thing::T_ProcType:
+        {
+            ProcType* pt = cast<ProcType*>(t);
+            res += "F";
+            res += pt->d_typeBound ? "b" : "";
+            res += pt->d_varargs ? "v" : "";
+            res += "(";
+            foreach( const Ref<Parameter>& p, pt->d_formals )
+            {
+                res += p->d_var ? "V" : "";
+                res += p->d_const ? "C" : "";
+                res += component( p->d_type.data(), visiting ) + ",";
+            }
+            // return types are compared by identity
+            res += ")" + ( pt->d_return.isNull() ? QByteArray("0") :
+                               identity( pt->d_return->derefed() ? pt->d_return->derefed() : pt->d_return.data() ) );
+        }
+        break;
+    }
+    visiting.remove(t);
+    return res;
+}
+
 bool Validator::includesType(quint8 lhs, quint8 rhs)
 {
     if( lhs == rhs )
@@ -25,6 +25,34 @@
 
 namespace Obx
 {
+    // Memo of the type relations computed by the validator, shared by all modules of a model and keyed by
+    // type identity; structurally equal anonymous open arrays, pointers and procedure types are interned
+    // so they share their entries. Must be cleared whenever the types of the model are deleted.
+    class TypeRelations
+    {
+    public:
+        enum Relation { EqualType, TypeExtension, TypeExtensionKind, MatchingParams, MatchingParamsCovariant,
+                        MaxRelation };
+        TypeRelations();
+        void clear();
+        bool find( Relation, Type* lhs, Type* rhs, bool& res );
+        void insert( Relation, Type* lhs, Type* rhs, bool res );
+        quint32 getHits() const;
+        quint32 getMisses() const;
+        quint32 getInterned() const { return d_interned; } // number of types sharing a representative
+    private:
+        Type* canonical( Type* );
+        QByteArray signature( Type*, QSet<Type*>& visiting );
+        QByteArray component( Type*, QSet<Type*>& visiting );
+        typedef QPair<Type*,Type*> Pair;
+        QHash<Pair,bool> d_memo[MaxRelation];
+        QHash<Type*,Type*> d_canon; // type -> representative
+        QHash<QByteArray,Type*> d_reps; // signature -> representative
+        quint32 d_hits[MaxRelation];
+        quint32 d_misses[MaxRelation];
+        quint32 d_interned;
+    };
+
     class Validator : public QObject // for tr
     {
     public:
@@ -54,7 +82,10 @@ namespace Obx
         };
 
         // assumes imports are already resolved
-        static bool check( Module*, const BaseTypes&, Ob::Errors*, Instantiator*);
+        static bool check( Module*, const BaseTypes&, Ob::Errors*, Instantiator*, bool interfaceOnly = false,
+                           TypeRelations* = 0 );
+        // validates the procedure and module bodies skipped by an interfaceOnly check
+        static bool checkBodies( Module*, const BaseTypes&, Ob::Errors*, Instantiator*, TypeRelations* = 0 );
 
         static bool includesType( quint8 lhs, quint8 rhs ); // lhs, rhs: Type::BT
         static QPair<quint8,bool> inclusiveType( quint8 lhs, quint8 rhs ); // lhs, rhs, return: Type::BT; bool: no information loss
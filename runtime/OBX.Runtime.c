@@ -39,7 +39,7 @@ struct OBX$Anyrec$Class$ OBX$Anyrec$class$ = {
 
 struct OBX$Anyrec OBX$defaultException = { &OBX$Anyrec$class$, };
 
-void* OBX$ClassOf(void* inst) { return inst ? ((struct OBX$Inst*)inst)->class$ : 0; }
+void* OBX$ClassOf(const void* inst) { return inst ? ((struct OBX$Inst*)inst)->class$ : 0; }
 
 int OBX$IsSubclass( void* superClass, void* subClass )
 {
@@ -278,39 +278,58 @@ void OBX$StrCopy(struct OBX$Array$1* lhs, int lwide, const struct OBX$Array$1* r
 
 #define MIN(a,b) (((a)<(b))?(a):(b))
 
+void OBX$ArrCopy1(struct OBX$Array$1* l, const struct OBX$Array$1* r, int size )
+{
+    memcpy( l->$a, r->$a, MIN(l->$1,r->$1)*size );
+}
+
+void OBX$ArrCopy2(struct OBX$Array$2* l, const struct OBX$Array$2* r, int size )
+{
+    assert(l->$1==r->$1 && l->$2==r->$2);
+    memcpy( l->$a, r->$a, l->$1*l->$2*size );
+}
+
+void OBX$ArrCopy3(struct OBX$Array$3* l, const struct OBX$Array$3* r, int size )
+{
+    assert(l->$1==r->$1 && l->$2==r->$2 && l->$3==r->$3);
+    memcpy( l->$a, r->$a, l->$1*l->$2*l->$3*size );
+}
+
+void OBX$ArrCopy4(struct OBX$Array$4* l, const struct OBX$Array$4* r, int size )
+{
+    assert(l->$1==r->$1 && l->$2==r->$2 && l->$3==r->$3 && l->$4==r->$4);
+    memcpy( l->$a, r->$a, l->$1*l->$2*l->$3*l->$4*size );
+}
+
+void OBX$ArrCopy5(struct OBX$Array$5* l, const struct OBX$Array$5* r, int size )
+{
+    assert(l->$1==r->$1 && l->$2==r->$2 && l->$3==r->$3 && l->$4==r->$4 && l->$5==r->$5);
+    memcpy( l->$a, r->$a, l->$1*l->$2*l->$3*l->$4*l->$5*size );
+}
+
 void OBX$ArrCopy(void* lhs, const void* rhs, int dims, int size )
 {
-    if( dims == 1 )
-    {
-        struct OBX$Array$1* l = lhs;
-        const struct OBX$Array$1* r = rhs;
-        memcpy( l->$a, r->$a, MIN(l->$1,r->$1)*size );
-    }else if( dims == 2 )
+    // kept for compatibility; the code generator directly calls the OBX$ArrCopyN variants
+    switch( dims )
     {
-        struct OBX$Array$2* l = lhs;
-        const struct OBX$Array$2* r = rhs;
-        assert(l->$1==r->$1 && l->$2==r->$2);
-        memcpy( l->$a, r->$a, l->$1*l->$2*size );
-    }else if( dims == 3 )
-    {
-        struct OBX$Array$3* l = lhs;
-        const struct OBX$Array$3* r = rhs;
-        assert(l->$1==r->$1 && l->$2==r->$2 && l->$3==r->$3);
-        memcpy( l->$a, r->$a, l->$1*l->$2*l->$3*size );
-    }else if( dims == 4 )
-    {
-        struct OBX$Array$4* l = lhs;
-        const struct OBX$Array$4* r = rhs;
-        assert(l->$1==r->$1 && l->$2==r->$2 && l->$3==r->$3 && l->$4==r->$4);
-        memcpy( l->$a, r->$a, l->$1*l->$2*l->$3*l->$4*size );
-    }else if( dims == 5 )
-    {
-        struct OBX$Array$5* l = lhs;
-        const struct OBX$Array$5* r = rhs;
-        assert(l->$1==r->$1 && l->$2==r->$2 && l->$3==r->$3 && l->$4==r->$4 && l->$5==r->$5);
-        memcpy( l->$a, r->$a, l->$1*l->$2*l->$3*l->$4*l->$5*size );
-    }else
+    case 1:
+        OBX$ArrCopy1(lhs,rhs,size);
+        break;
+    case 2:
+        OBX$ArrCopy2(lhs,rhs,size);
+        break;
+    case 3:
+        OBX$ArrCopy3(lhs,rhs,size);
+        break;
+    case 4:
+        OBX$ArrCopy4(lhs,rhs,size);
+        break;
+    case 5:
+        OBX$ArrCopy5(lhs,rhs,size);
+        break;
+    default:
         assert(0);
+    }
 }
 
 void OBX$Pack32(float* x, int n)
@@ -764,6 +783,44 @@ void OBX$RegisterModule(const char* module, OBX$Lookup lookup)
 	appendArray(&modules,module,lookup);
 }
 
+typedef struct ObxProfile {
+  const char* module;
+  uint64_t* counters;
+  int count;
+  struct ObxProfile* next;
+} ObxProfile;
+
+static ObxProfile* profiles = 0;
+
+static void writeProfiles()
+{
+  // one line per module: name, number of counters, counters; the file is read by the C generator
+  const char* path = getenv("OBX_PROFILE");
+  FILE* f = fopen( path ? path : "obx.profile", "w");
+  if( f == 0 )
+    return;
+  for( ObxProfile* p = profiles; p != 0; p = p->next )
+  {
+    fprintf(f, "%s %d", p->module, p->count );
+    for( int i = 0; i < p->count; i++ )
+      fprintf(f, " %" PRIu64, p->counters[i] );
+    fprintf(f, "\n");
+  }
+  fclose(f);
+}
+
+void OBX$RegisterProfile(const char* module, uint64_t* counters, int count)
+{
+  if( profiles == 0 )
+    atexit(writeProfiles);
+  ObxProfile* p = malloc(sizeof(ObxProfile));
+  p->module = module;
+  p->counters = counters;
+  p->count = count;
+  p->next = profiles;
+  profiles = p;
+}
+
 OBX$Cmd OBX$LoadCmd(const char* module, const char* command)
 {
 	OBX$Lookup lookup = OBX$LoadModule(module);
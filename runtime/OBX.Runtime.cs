@@ -542,6 +542,235 @@ namespace OBX
 				keepRefs.Add(o);
 		}
 		
+		// entry points of external procedures called by calli instead of pinvoke; like pinvoke on Mono the library
+		// name is first mapped by the dllmap entries of the module assembly config and the global Mono config, and
+		// then searched in the directory of the module assembly, the application directory and by the OS
+		private static Hashtable externLibs = new Hashtable();
+		public static IntPtr resolveExtern( Type module, string lib, string name )
+		{
+			Assembly a = module.Assembly;
+			string key = a.Location + "|" + lib;
+			IntPtr h;
+			lock( externLibs )
+			{
+				if( externLibs.ContainsKey(key) )
+					h = (IntPtr)externLibs[key];
+				else
+				{
+					h = loadExtern(a, mapExtern(a, lib));
+					externLibs[key] = h;
+				}
+			}
+			if( h == IntPtr.Zero )
+				throw new DllNotFoundException(lib);
+			IntPtr res = isWindows() ? Win32.GetProcAddress(h, name) : dlsym(h, name);
+			if( res == IntPtr.Zero )
+				throw new EntryPointNotFoundException(name + " in " + lib);
+			return res;
+		}
+		private static bool isWindows()
+		{
+			return Environment.OSVersion.Platform == PlatformID.Win32NT;
+		}
+		private static bool isMacOS()
+		{
+			// Mono reports Unix also on macOS
+			return !isWindows() && Directory.Exists("/System/Library/Frameworks");
+		}
+		private static string mapExtern( Assembly a, string lib )
+		{
+			if( Type.GetType("Mono.Runtime") == null )
+				return lib; // only Mono supports dllmap
+			string res = mapExtern(a.Location + ".config", lib);
+			if( res == null )
+				res = mapExtern(monoConfig(), lib);
+			return res != null ? res : lib;
+		}
+		private static string monoConfig()
+		{
+			string path = Environment.GetEnvironmentVariable("MONO_CONFIG");
+			if( path != null )
+				return path;
+			// mscorlib is in <prefix>/lib/mono/<version>, the global config in <prefix>/etc/mono
+			string dir = Path.GetDirectoryName(typeof(object).Assembly.Location);
+			path = Path.Combine(dir, "../../../etc/mono/config");
+			if( File.Exists(path) )
+				return path;
+			return "/etc/mono/config";
+		}
+		private static string mapExtern( string config, string lib )
+		{
+			// returns the target of the first <dllmap dll="lib" target="..."/> matching this platform or null;
+			// dllentry mappings of single functions are not supported
+			string xml;
+			try
+			{
+				if( !File.Exists(config) )
+					return null;
+				xml = File.ReadAllText(config);
+			}catch
+			{
+				return null;
+			}
+			int pos = 0;
+			while( ( pos = xml.IndexOf("<dllmap", pos) ) >= 0 )
+			{
+				int end = xml.IndexOf('>', pos);
+				if( end < 0 )
+					break;
+				string elem = xml.Substring(pos, end - pos);
+				pos = end;
+				string dll = attribute(elem, "dll");
+				string target = attribute(elem, "target");
+				if( dll == null || target == null )
+					continue;
+				bool match;
+				if( dll.StartsWith("i:") )
+					match = String.Compare(dll.Substring(2), lib, true) == 0;
+				else
+					match = dll == lib;
+				string os = isWindows() ? "windows" : isMacOS() ? "osx" : "linux";
+				string cpu = IntPtr.Size == 8 ? "x86-64" : "x86"; // only distinguished by pointer size
+				if( match && matchesPlatform(attribute(elem, "os"), os) && matchesPlatform(attribute(elem, "cpu"), cpu) )
+					return target;
+			}
+			return null;
+		}
+		private static string attribute( string elem, string name )
+		{
+			int pos = 0;
+			while( ( pos = elem.IndexOf(name + "=", pos) ) > 0 )
+			{
+				int start = pos + name.Length + 1;
+				if( Char.IsWhiteSpace(elem[pos - 1]) && start < elem.Length && ( elem[start] == '"' || elem[start] == '\'' ) )
+				{
+					int end = elem.IndexOf(elem[start], start + 1);
+					if( end < 0 )
+						return null;
+					return elem.Substring(start + 1, end - start - 1);
+				}
+				pos = start;
+			}
+			return null;
+		}
+		private static bool matchesPlatform( string list, string name )
+		{
+			// list is e.g. "linux,osx" or "!windows"
+			if( list == null )
+				return true;
+			bool negate = list.StartsWith("!");
+			if( negate )
+				list = list.Substring(1);
+			bool found = false;
+			foreach( string s in list.Split(',') )
+			{
+				if( s.Trim() == name )
+					found = true;
+			}
+			return found != negate;
+		}
+		private static IntPtr loadExtern( Assembly a, string lib )
+		{
+			string name = lib.EndsWith(".dll") ? lib.Substring(0, lib.Length - 4) : lib;
+			string[] variants;
+			if( isWindows() )
+				variants = new string[] { name + ".dll", name };
+			else
+				variants = new string[] { name, "lib" + name + ".so", name + ".so", "lib" + name + ".dylib", name + ".dylib" };
+			string[] dirs = new string[] { Path.GetDirectoryName(a.Location), AppDomain.CurrentDomain.BaseDirectory };
+			foreach( string v in variants )
+			{
+				IntPtr h = IntPtr.Zero;
+				if( Path.IsPathRooted(v) )
+					h = openExtern(v);
+				else
+				{
+					foreach( string dir in dirs )
+					{
+						string path = Path.Combine(dir, v);
+						if( h == IntPtr.Zero && File.Exists(path) )
+							h = openExtern(path);
+					}
+					if( h == IntPtr.Zero )
+						h = openExtern(v);
+				}
+				if( h != IntPtr.Zero )
+					return h;
+			}
+			return IntPtr.Zero;
+		}
+		
+		// the library providing dlopen and dlsym is only determined on first use; 1..libdl.so.2 (glibc),
+		// 2..libc (e.g. musl, where Mono maps it by its global dllmap), 3..libSystem (macOS)
+		private static int dlLib = 0;
+		private static IntPtr openExtern( string path )
+		{
+			if( isWindows() )
+				return Win32.LoadLibrary(path);
+			if( dlLib == 0 )
+				dlLib = isMacOS() ? 3 : 1;
+			while( true )
+			{
+				try
+				{
+					switch( dlLib )
+					{
+					case 1:
+						return LibDl.dlopen(path, 1); // RTLD_LAZY
+					case 2:
+						return LibC.dlopen(path, 1);
+					default:
+						return LibSystem.dlopen(path, 1);
+					}
+				}catch( DllNotFoundException )
+				{
+					if( dlLib != 1 )
+						throw;
+					dlLib = 2;
+				}
+			}
+		}
+		private static IntPtr dlsym( IntPtr h, string name )
+		{
+			switch( dlLib )
+			{
+			case 1:
+				return LibDl.dlsym(h, name);
+			case 2:
+				return LibC.dlsym(h, name);
+			default:
+				return LibSystem.dlsym(h, name);
+			}
+		}
+		private class Win32
+		{
+			[DllImport("kernel32", CharSet = CharSet.Ansi)]
+			public static extern IntPtr LoadLibrary( string path );
+			[DllImport("kernel32", CharSet = CharSet.Ansi)]
+			public static extern IntPtr GetProcAddress( IntPtr h, string name );
+		}
+		private class LibDl
+		{
+			[DllImport("libdl.so.2")]
+			public static extern IntPtr dlopen( string path, int mode );
+			[DllImport("libdl.so.2")]
+			public static extern IntPtr dlsym( IntPtr h, string name );
+		}
+		private class LibC
+		{
+			[DllImport("libc")]
+			public static extern IntPtr dlopen( string path, int mode );
+			[DllImport("libc")]
+			public static extern IntPtr dlsym( IntPtr h, string name );
+		}
+		private class LibSystem
+		{
+			[DllImport("/usr/lib/libSystem.dylib")]
+			public static extern IntPtr dlopen( string path, int mode );
+			[DllImport("/usr/lib/libSystem.dylib")]
+			public static extern IntPtr dlsym( IntPtr h, string name );
+		}
+		
 		public static string toHex(uint adr)
 		{
 			return String.Format("0x{0:x}",adr);
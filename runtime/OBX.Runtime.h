@@ -35,6 +35,25 @@
 #include <setjmp.h>
 #include <ctype.h>
 
+#ifdef OBX_AMALGAMATED
+// the runtime is part of the same translation unit as the generated code, so the small helpers can be inlined
+#define OBX_INLINE static inline
+#else
+#define OBX_INLINE extern
+#endif
+
+#ifdef __GNUC__
+#define OBX_LIKELY(x) __builtin_expect(!!(x),1)
+#define OBX_UNLIKELY(x) __builtin_expect(!!(x),0)
+#define OBX_HOT __attribute__((hot))
+#define OBX_COLD __attribute__((cold))
+#else
+#define OBX_LIKELY(x) (x)
+#define OBX_UNLIKELY(x) (x)
+#define OBX_HOT
+#define OBX_COLD
+#endif
+
 struct OBX$Array$1 { uint32_t $1: 31; uint32_t $s: 1; void* $a; }; // $s..static, 1 if literal or pointer to stack, 0 if allocated with OBX$Alloc
 struct OBX$Array$2 { uint32_t $1; uint32_t $2: 31; uint32_t $s: 1; void* $a; };
 struct OBX$Array$3 { uint32_t $1,$2; uint32_t $3: 31; uint32_t $s: 1; void* $a; };
@@ -79,19 +98,24 @@ extern struct OBX$Jump* OBX$PushJump();
 extern struct OBX$Jump* OBX$TopJump();
 extern void OBX$PopJump();
 
-extern void* OBX$ClassOf(void* inst);
-int OBX$IsSubclass( void* superClass, void* subClass );
-uint32_t OBX$SetDiv( uint32_t lhs, uint32_t rhs );
-int32_t OBX$Div32( int32_t a, int32_t b );
-int64_t OBX$Div64( int64_t a, int64_t b );
-int32_t OBX$Mod32( int32_t a, int32_t b );
-int64_t OBX$Mod64( int64_t a, int64_t b );
+OBX_INLINE void* OBX$ClassOf(const void* inst);
+OBX_INLINE int OBX$IsSubclass( void* superClass, void* subClass );
+OBX_INLINE uint32_t OBX$SetDiv( uint32_t lhs, uint32_t rhs );
+OBX_INLINE int32_t OBX$Div32( int32_t a, int32_t b );
+OBX_INLINE int64_t OBX$Div64( int64_t a, int64_t b );
+OBX_INLINE int32_t OBX$Mod32( int32_t a, int32_t b );
+OBX_INLINE int64_t OBX$Mod64( int64_t a, int64_t b );
 extern void* OBX$Alloc( size_t );
 extern int OBX$StrOp( const struct OBX$Array$1* lhs, int lwide, const struct OBX$Array$1* rhs, int rwide, int op );
 extern struct OBX$Array$1 OBX$StrJoin( const struct OBX$Array$1* lhs, int lwide, const struct OBX$Array$1* rhs, int rwide );
 extern struct OBX$Array$1 OBX$CharToStr( int lwide, wchar_t ch );
 extern void OBX$StrCopy(struct OBX$Array$1* lhs, int lwide, const struct OBX$Array$1* rhs, int rwide );
 extern void OBX$ArrCopy(void* lhs, const void* rhs, int dims, int size ); // lhs and rhs are pointer to OBX$Array$*
+extern void OBX$ArrCopy1(struct OBX$Array$1* lhs, const struct OBX$Array$1* rhs, int size );
+extern void OBX$ArrCopy2(struct OBX$Array$2* lhs, const struct OBX$Array$2* rhs, int size );
+extern void OBX$ArrCopy3(struct OBX$Array$3* lhs, const struct OBX$Array$3* rhs, int size );
+extern void OBX$ArrCopy4(struct OBX$Array$4* lhs, const struct OBX$Array$4* rhs, int size );
+extern void OBX$ArrCopy5(struct OBX$Array$5* lhs, const struct OBX$Array$5* rhs, int size );
 extern void* OBX$Copy(void* data, int len);
 extern uint32_t OBX$UtfDecode(const uint8_t* in, int* len );
 extern void* OBX$FromUtf(const char* in, int len, int wide ); // len is decoded len incl. terminating zero
@@ -108,14 +132,23 @@ extern void OBX$Pack32(float* lhs, int rhs);
 extern void OBX$Unpack32(float* lhs, int* rhs);
 
 extern uint32_t OBX$MakeSet(int count, ... );
-extern int64_t OBX$Asr64(int64_t x, int n);
-extern int32_t OBX$Asr32(int32_t x, int n);
-extern int64_t OBX$Ash64(int64_t x, int n);
-extern int32_t OBX$Ash32(int32_t x, int n);
-extern uint64_t OBX$Lsl64(uint64_t x, int n);
-extern uint32_t OBX$Lsl32(uint32_t x, int n);
-extern uint64_t OBX$Ror64(uint64_t x, int n);
-extern uint32_t OBX$Ror32(uint32_t x, int n);
+static inline uint32_t OBX$SetRange(int32_t a, int32_t b)
+{
+    // the set {a..b}, empty if a > b; the bounds are clipped to 0..31 so that no shift is out of range
+    if( a < 0 )
+        a = 0;
+    if( b > 31 )
+        b = 31;
+    return a > b ? 0 : ( 0xffffffffu >> ( 31 - b ) ) & ( 0xffffffffu << a );
+}
+OBX_INLINE int64_t OBX$Asr64(int64_t x, int n);
+OBX_INLINE int32_t OBX$Asr32(int32_t x, int n);
+OBX_INLINE int64_t OBX$Ash64(int64_t x, int n);
+OBX_INLINE int32_t OBX$Ash32(int32_t x, int n);
+OBX_INLINE uint64_t OBX$Lsl64(uint64_t x, int n);
+OBX_INLINE uint32_t OBX$Lsl32(uint32_t x, int n);
+OBX_INLINE uint64_t OBX$Ror64(uint64_t x, int n);
+OBX_INLINE uint32_t OBX$Ror32(uint32_t x, int n);
 
 extern OBX$Lookup OBX$LoadModule(const char* module); // load OBX module dynamically or statically
 extern void OBX$RegisterModule(const char* module, OBX$Lookup);
@@ -124,5 +157,6 @@ extern void* OBX$LoadDynLib(const char* path); // load any shared library
 extern OBX$Cmd OBX$LoadProc(void* lib, const char* name); // load any procedure of given shared library
 extern void OBX$InitApp(int argc, char **argv);
 extern const char* OBX$AppPath();
+extern void OBX$RegisterProfile(const char* module, uint64_t* counters, int count); // written on exit
 
 #endif
@@ -1,6 +1,7 @@
 local tochar = require("string").char
 local ffi = require("ffi")
 local module = {}
+local hasObnString, ObnString = pcall(ffi.typeof, "ObnString") -- only declared by the pure Lua obnljlib
 
 -- just a quick first implementation
 
@@ -16,7 +17,7 @@ function module.Char(ch)
 end
 
 function module.String(s)
-	if type(s) == "cdata" then
+	if type(s) == "cdata" and not ( hasObnString and ffi.istype(ObnString, s) ) then
 		io.stdout:write(ffi.string(s))
 	else
 	    io.stdout:write(tostring(s))
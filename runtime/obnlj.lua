@@ -81,8 +81,8 @@ ffi.cdef[[
     int LjLibFfi_MOD( int a, int b );
 ]]
 
-module.DIV = C.LjLibFfi_DIV
-module.MOD = C.LjLibFfi_MOD
+module.DIV = _lib.DIV or C.LjLibFfi_DIV
+module.MOD = _lib.MOD or C.LjLibFfi_MOD
 
 function module.BOUNDS( index, table, file, line )
     -- _lib.TRACE( "bounds at "..file.." "..tonumber(line) )
@@ -15,6 +15,340 @@
 * requirements will be met: https://www.gnu.org/licenses/lgpl.html and
 * http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html.]]--
 
+-- Pure Lua/FFI implementation of the obnljlib interface provided by ObLjLib.cpp; in contrast to the
+-- latter all functions and metamethods can be compiled into LuaJIT traces.
+-- Differences: a CHAR is represented by its code (a number) instead of a one character string
+-- object; comparisons between numbers and string objects are supported by the string metamethods,
+-- which LuaJIT (in contrast to plain Lua) also calls when the operands have different types.
+
+local ffi = require 'ffi'
+local bit = require 'bit'
+local math = require 'math'
+local string = require 'string'
+
 local lib = {}
 
+ffi.cdef[[
+	typedef struct { int32_t bits; } ObnSet;
+	typedef struct { int32_t n; uint8_t s[?]; } ObnString;
+]]
+
+---------------- SET -----------------
+
+local SetMeta = {}
+local Set = ffi.metatype( "ObnSet", SetMeta )
+local band, bor, bxor, bnot, lshift, rshift = bit.band, bit.bor, bit.bxor, bit.bnot, bit.lshift, bit.rshift
+
+local function isSet(s)
+	return ffi.istype(Set, s)
+end
+SetMeta.__add = function( a, b )
+	return Set( bor( a.bits, b.bits ) )
+end
+SetMeta.__sub = function( a, b )
+	return Set( band( a.bits, bnot( b.bits ) ) )
+end
+SetMeta.__mul = function( a, b )
+	return Set( band( a.bits, b.bits ) )
+end
+SetMeta.__div = function( a, b )
+	return Set( bxor( a.bits, b.bits ) )
+end
+SetMeta.__unm = function( a )
+	return Set( bnot( a.bits ) )
+end
+SetMeta.__eq = function( a, b )
+	return isSet(a) and isSet(b) and a.bits == b.bits
+end
+SetMeta.__tostring = function( a )
+	local res = {}
+	for i=31,0,-1 do
+		res[#res+1] = band( a.bits, lshift( 1, i ) ) ~= 0 and "1" or "0"
+	end
+	return table.concat(res)
+end
+
+function lib.SET(...)
+	local n = select('#',...)
+	if n <= 1 then
+		return Set( (...) or 0 )
+	end
+	local bits = 0
+	for i=1,n,2 do
+		local a, b = select(i,...)
+		b = b or 0
+		if a >= 0 and b >= 0 then
+			if a <= b then
+				if b > 31 then
+					b = 31
+				end
+				bits = bor( bits, band( lshift( -1, a ), rshift( -1, 31 - b ) ) )
+			end
+		elseif a >= 0 and a < 32 then
+			bits = bor( bits, lshift( 1, a ) )
+		else
+			error( "argument must be between 0 and 31", 2 )
+		end
+	end
+	return Set( bits )
+end
+
+function lib.IN( x, s )
+	return x >= 0 and x < 32 and band( s.bits, lshift( 1, x ) ) ~= 0
+end
+
+function lib.INCL( s, x )
+	if x < 0 or x > 31 then
+		error( "argument must be between 0 and 31", 2 )
+	end
+	s.bits = bor( s.bits, lshift( 1, x ) )
+end
+
+function lib.EXCL( s, x )
+	if x < 0 or x > 31 then
+		error( "argument must be between 0 and 31", 2 )
+	end
+	s.bits = band( s.bits, bnot( lshift( 1, x ) ) )
+end
+
+---------------- STRING -----------------
+
+local StrMeta = {}
+local Str = ffi.metatype( "ObnString", StrMeta )
+
+local function isStr(s)
+	return ffi.istype(Str, s)
+end
+local function strlen(s)
+	for i=0,s.n-1 do
+		if s.s[i] == 0 then
+			return i
+		end
+	end
+	return s.n
+end
+local function charAt( x, i )
+	-- x is either a string object, a char code or a Lua string; i is zero based
+	local t = type(x)
+	if t == "number" then
+		if i == 0 then
+			return x
+		else
+			return 0
+		end
+	elseif t == "string" then
+		return string.byte( x, i + 1 ) or 0
+	elseif i < x.n then
+		return x.s[i]
+	else
+		return 0
+	end
+end
+local function compare( lhs, rhs )
+	local i = 0
+	while true do
+		local l = charAt( lhs, i )
+		local r = charAt( rhs, i )
+		if l ~= r or l == 0 then
+			return l - r
+		end
+		i = i + 1
+	end
+end
+local function isText(x)
+	local t = type(x)
+	return t == "number" or t == "string" or isStr(x)
+end
+local function assig( lhs, rhs )
+	local t = type(rhs)
+	if t == "string" then
+		local len = #rhs + 1
+		if len > lhs.n then
+			error( "rhs is longer than lhs", 2 )
+		end
+		ffi.copy( lhs.s, rhs ) -- includes the terminating zero
+	elseif t == "number" then
+		if rhs < 0 or rhs > 255 then
+			error( "char out of range", 2 )
+		end
+		if lhs.n < 2 then
+			error( "rhs is longer than lhs", 2 )
+		end
+		lhs.s[0] = rhs
+		lhs.s[1] = 0
+	else
+		local len = strlen(rhs)
+		if len >= lhs.n then
+			error( "rhs is longer than lhs", 2 )
+		end
+		ffi.copy( lhs.s, rhs.s, len )
+		lhs.s[len] = 0
+	end
+end
+StrMeta.__index = function( s, i )
+	if type(i) == "number" then
+		if i < 1 or i > s.n then
+			error( "string index out of range", 2 )
+		end
+		return s.s[i-1]
+	elseif i == "assig" then
+		return assig
+	end
+	error( "invalid index", 2 )
+end
+StrMeta.__newindex = function( s, i, v )
+	if i < 1 or i > s.n then
+		error( "string index out of range", 2 )
+	end
+	local t = type(v)
+	if t == "number" then
+		if v < 0 or v > 255 then
+			error( "char out of range", 2 )
+		end
+		s.s[i-1] = v
+	elseif t == "string" then
+		if #v > 1 then
+			error( "expecting single char", 2 )
+		end
+		s.s[i-1] = string.byte(v) or 0
+	else
+		if strlen(v) > 1 then
+			error( "expecting single char", 2 )
+		end
+		s.s[i-1] = v.s[0]
+	end
+end
+StrMeta.__len = function( s )
+	return s.n
+end
+StrMeta.__tostring = function( s )
+	return ffi.string( s.s, strlen(s) )
+end
+StrMeta.__eq = function( lhs, rhs )
+	return isText(lhs) and isText(rhs) and compare( lhs, rhs ) == 0
+end
+StrMeta.__lt = function( lhs, rhs )
+	return compare( lhs, rhs ) < 0
+end
+StrMeta.__le = function( lhs, rhs )
+	return compare( lhs, rhs ) <= 0
+end
+
+function lib.Str( x )
+	if type(x) == "string" then
+		local len = #x + 1
+		local s = Str( len, len )
+		ffi.copy( s.s, x, len - 1 ) -- the remainder is zero initialized
+		return s
+	end
+	if x <= 0 then
+		error( "argument must be greater than zero", 2 )
+	end
+	return Str( x, x )
+end
+
+function lib.Char( c )
+	if c < 0 or c > 255 then
+		error( "char out of range", 2 )
+	end
+	return c
+end
+
+---------------- OTHER -----------------
+
+function lib.instance( class )
+	local obj = {}
+	if type(class) == "table" then
+		setmetatable(obj,class)
+	end
+	return obj
+end
+
+function lib.is_a( obj, class )
+	if type(obj) ~= "table" or type(class) ~= "table" then
+		return false
+	end
+	local meta = getmetatable(obj)
+	while meta and meta ~= class do
+		meta = getmetatable(meta)
+	end
+	return meta == class
+end
+
+function lib.ORD( x )
+	local t = type(x)
+	if t == "number" then
+		return math.floor( x + 0.5 )
+	elseif t == "boolean" then
+		return x and 1 or 0
+	elseif t == "string" then
+		return string.byte(x) or 0
+	elseif t == "table" then
+		return tonumber( string.match( tostring(x), "0x(%x+)" ) or "0", 16 )
+	elseif isSet(x) then
+		local bits = x.bits
+		if bits < 0 then
+			bits = bits + 4294967296
+		end
+		return bits
+	else
+		return charAt( x, 0 )
+	end
+end
+
+function lib.ASSERT( ok, file, line )
+	if not ok then
+		error( string.format( "assert fail at %s %d", tostring(file), line or 0 ) )
+	end
+end
+
+function lib.TRACE(...)
+end
+
+function lib.TRAP()
+	local trap = rawget( _G, "TRAP" ) -- the debugger hook of the engine if present
+	if trap then
+		trap()
+	end
+end
+
+function lib.PACK( x, n )
+	return math.ldexp( x, n )
+end
+
+function lib.UNPK( x )
+	local m, n = math.frexp( x )
+	return m + m, n - 1
+end
+
+function lib.DIV( a, b )
+	-- same as LjLibFfi_DIV; the quotient is truncated like in C
+	local q
+	if a < 0 then
+		q = ( a - b + 1 ) / b
+	else
+		q = a / b
+	end
+	if q < 0 then
+		return math.ceil(q)
+	else
+		return math.floor(q)
+	end
+end
+
+function lib.MOD( a, b )
+	-- same as LjLibFfi_MOD; math.fmod truncates like the C % operator
+	if a < 0 then
+		return ( b - 1 ) + math.fmod( a - b + 1, b )
+	else
+		return math.fmod( a, b )
+	end
+end
+
+function lib.Copy( lhs, rhs )
+	for k,v in pairs(rhs) do
+		rawset( lhs, k, v )
+	end
+end
+
 return lib
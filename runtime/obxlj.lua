@@ -125,15 +125,12 @@ function module.addRangeToSet( set, from, to )
 	if from > to then
 		return set
 	end
-	for i=from,to do
-		set = addElemToSet(set,i)
-	end
-	return set
+	return bit.bor( set, bit.band( bit.lshift( -1, from ), bit.rshift( -1, 31 - to ) ) )
 end
 local function strlen( str, wide )
 	local count = bytesize(str)
 	if wide then
-		count = count / 2
+		count = bit.rshift(count,1)
 	end
 	for i=0,count-1 do
 		if str[i] == 0 then
@@ -152,14 +149,22 @@ function module.joinStrings( lhs, rhs, lwide, rwide )
 	else
 		res = ffi.new( CharArray, count )
 	end
-	local i
-	for i = 0,lhslen-1 do
-		res[i] = lhs[i]
-	end
-	for i = 0,rhslen-1 do
-		res[i+lhslen] = rhs[i]
+	-- ffi.new zero-fills, so the terminating zero is already there
+	if lwide == rwide then
+		local size = 1
+		if lwide then
+			size = 2
+		end
+		ffi.copy( res, lhs, lhslen * size )
+		ffi.copy( res + lhslen, rhs, rhslen * size )
+	else
+		for i = 0,lhslen-1 do
+			res[i] = lhs[i]
+		end
+		for i = 0,rhslen-1 do
+			res[i+lhslen] = rhs[i]
+		end
 	end
-	res[lhslen+rhslen] = 0
 	return res
 end
 function module.charToString(ch,forceWide)
@@ -173,26 +178,49 @@ function module.charToString(ch,forceWide)
 	a[1] = 0
 	return a
 end
-local function toWide(str)
-	local count = bytesize(str)
-	local res = ffi.new( WcharArray, count )
-	for i=0,count do
-		res[i] = str[i]
+local function strcmp( lhs, wideL, rhs, wideR )
+	-- compares code units up to the terminating zero; mixed CHAR and WCHAR arrays are compared
+	-- directly, so there are neither temporary arrays nor calls to C
+	local lcount = bytesize(lhs)
+	if wideL then
+		lcount = bit.rshift(lcount,1)
 	end
-	return res
-end
-function module.stringRelOp( lhs, wideL, rhs, wideR, op )
-	if wideL or wideR then
-		if not wideL then
-			lhs = toWide(lhs)
+	local rcount = bytesize(rhs)
+	if wideR then
+		rcount = bit.rshift(rcount,1)
+	end
+	local i = 0
+	while true do
+		local l = 0
+		if i < lcount then
+			l = lhs[i]
 		end
-		if not wideR then
-			rhs = toWide(rhs)
+		local r = 0
+		if i < rcount then
+			r = rhs[i]
 		end
-		return C.ObxFfi_wstrRelOp(lhs,bytesize(lhs)/2,rhs,bytesize(rhs)/2,op) ~= 0
-	else
-		return C.ObxFfi_strRelOp(lhs,rhs,op) ~= 0
-	end	
+		if l ~= r or l == 0 then
+			return l - r
+		end
+		i = i + 1
+	end
+end
+function module.stringRelOp( lhs, wideL, rhs, wideR, op )
+	local res = strcmp( lhs, wideL, rhs, wideR )
+	if op == 1 then
+		return res == 0
+	elseif op == 2 then
+		return res ~= 0
+	elseif op == 3 then
+		return res < 0
+	elseif op == 4 then
+		return res <= 0
+	elseif op == 5 then
+		return res > 0
+	elseif op == 6 then
+		return res >= 0
+	end
+	return false
 end
 function module.setSub( lhs, rhs )
 	rhs = bit.bnot(rhs)
@@ -242,9 +270,11 @@ function module.isFfiString( val )
 end
 function module.strcpy( lhs, rhs )
 	local i = 0
-	while rhs[i] ~= 0 do
-		lhs[i] = rhs[i]
+	local c = rhs[0]
+	while c ~= 0 do
+		lhs[i] = c
 		i = i + 1
+		c = rhs[i]
 	end
 	lhs[i] = 0
 end
@@ -285,6 +315,86 @@ function module.ldcmd(mod,cmd)
 	return nil
 end
 
+-- Trace diagnostics: collects aborted traces by location and reason; the handler only runs on trace
+-- events, so the overhead is negligible even for long runs. Lines are the packed row/col of the compiler.
+local traceStartFunc = {}
+local traceStartPc = {}
+local vmdef = nil
+local jutil = nil
+local function traceReason( err, info )
+	if type(err) ~= "number" then
+		return tostring(err)
+	end
+	if vmdef == nil then
+		local ok, res = pcall(require, 'jit.vmdef')
+		vmdef = ok and res or false
+	end
+	if not vmdef or vmdef.traceerr[err] == nil then
+		return "trace error "..err
+	end
+	local fmt = vmdef.traceerr[err]
+	if fmt == "NYI: bytecode %d" and type(info) == "number" then
+		fmt = "NYI: bytecode %s"
+		info = string.sub(vmdef.bcnames, 6*info+1, 6*info+6)
+	elseif type(info) == "function" then
+		local fi = jutil.funcinfo(info)
+		if fi.ffid then
+			info = vmdef.ffnames[fi.ffid]
+		elseif fi.addr then
+			info = string.format("C function 0x%x", fi.addr)
+		else
+			info = tostring(fi.loc)
+		end
+	end
+	local ok, res = pcall(string.format, fmt, info)
+	if ok then
+		return res
+	else
+		return fmt
+	end
+end
+local function onTraceEvent( what, tr, func, pc, otr, oex )
+	if what == "start" then
+		traceStartFunc[tr] = func
+		traceStartPc[tr] = pc
+	elseif what == "abort" then
+		local start = jutil.funcinfo(traceStartFunc[tr] or func, traceStartPc[tr] or pc)
+		local at = jutil.funcinfo(func, pc)
+		if at.source == nil then
+			at = start -- aborted in a C function
+		end
+		local reason = traceReason(otr, oex)
+		local key = tostring(at.source)..":"..tostring(at.currentline)..":"..tostring(start.currentline)..":"..reason
+		local e = module.traceAborts[key]
+		if e == nil then
+			e = { source = at.source, line = at.currentline, defined = at.linedefined, 
+				start = start.currentline, reason = reason, count = 0 }
+			module.traceAborts[key] = e
+		end
+		e.count = e.count + 1
+	end
+end
+function module.startTraceDiag()
+	jutil = require 'jit.util'
+	module.traceAborts = {}
+	jit.attach(onTraceEvent, "trace")
+end
+function module.stopTraceDiag()
+	jit.attach(onTraceEvent)
+end
+
+-- module name -> { [row] = true } for each row with a breakpoint; the generated code only
+-- calls DBGBREAK when the flag of the row is set, so the check is a table load which traces
+module.breakRows = {}
+function module.breakTable(name)
+	local t = module.breakRows[name]
+	if t == nil then
+		t = {}
+		module.breakRows[name] = t
+	end
+	return t
+end
+
 -- Magic mumbers used by the compiler
 module[1] = module.charToStringArray
 module[2] = module.createWcharArray
@@ -340,6 +450,8 @@ module[51] = module.min_size
 module[52] = jit.off
 module[53] = module.ldmod
 module[54] = module.ldcmd
+module[55] = DBGBREAK
+module[56] = module.breakTable
 
 return module
 
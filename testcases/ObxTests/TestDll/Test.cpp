@@ -143,6 +143,61 @@ TESTSHARED_EXPORT int doit10(Callback cb)
     return res;
 }
 
+// SDL-like entry points used by ExternCalls.obx; all but SDL_SetColor have blittable signatures
+
+struct Renderer
+{
+    int points;
+    unsigned int color;
+    int x, y;
+};
+
+static Renderer renderer;
+
+TESTSHARED_EXPORT Renderer* SDL_GetRenderer()
+{
+    return &renderer;
+}
+
+TESTSHARED_EXPORT int SDL_SetRenderDrawColor( Renderer* r, unsigned char red, unsigned char green,
+                                              unsigned char blue, unsigned char alpha )
+{
+    r->color = ( alpha << 24 ) | ( blue << 16 ) | ( green << 8 ) | red;
+    return 0;
+}
+
+TESTSHARED_EXPORT int SDL_RenderDrawPoint( Renderer* r, int x, int y )
+{
+    r->points++;
+    r->x = x;
+    r->y = y;
+    return 0;
+}
+
+struct Color
+{
+    unsigned char r, g, b, a;
+};
+
+TESTSHARED_EXPORT int SDL_SetColor( Renderer* r, Color c )
+{
+    return SDL_SetRenderDrawColor( r, c.r, c.g, c.b, c.a );
+}
+
+typedef int (*DrawPointProc)( Renderer*, int, int );
+
+TESTSHARED_EXPORT DrawPointProc SDL_GetDrawPointProc()
+{
+    return SDL_RenderDrawPoint;
+}
+
+typedef int (*SetColorProc)( Renderer*, Color );
+
+TESTSHARED_EXPORT SetColorProc SDL_GetSetColorProc()
+{
+    return SDL_SetColor;
+}
+
 TESTSHARED_EXPORT void doit11(const char* fmt, ...)
 {
     va_list args;